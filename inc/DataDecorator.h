@@ -26,16 +26,23 @@
 #define DATADECORATOR_H_
 
 // General files
+#include <ilvq/PowerLaw.h>
 #include <map>
+#include <vector>
+#include <string>
+#include <iostream>
 
 /* **************************************************************************************
  * Interface of DataContainer
  * **************************************************************************************/
 
-enum DataType { DT_MAP, DT_F2DARRAY };
+enum DataType { DT_MAP, DT_F2DARRAY, DT_FLAT };
 
 typedef double DataDecoratorType;
 
+//! Pairs of (x, count) sorted on x, the storage of DT_FLAT
+typedef std::vector<std::pair<DataDecoratorType,int> > DataFlat;
+
 /**
  * A "container" class that does not contain data itself, but which can point to different
  * types of data structures. This container is meant to be used in cases where power law
@@ -52,14 +59,42 @@ public:
 	virtual ~DataContainer();
 
 	//! Sets the data type
-	inline void SetType(DataType dataType) { this->dataType = dataType; }
+	inline void SetType(DataType dataType) { this->dataType = dataType; estimated = false; }
 
 	//! Point towards data in the form of a map
-	inline void SetData(std::map<DataDecoratorType,int> & data) { this->map_data = &data; dataType = DT_MAP; }
+	inline void SetData(std::map<DataDecoratorType,int> & data) { this->map_data = &data; dataType = DT_MAP; estimated = false; }
 
 	//! Point towards data in the form of an array
 	inline void SetData(float *data, int len) { float_data = data; float_data_len = len; dataType = DT_F2DARRAY; }
 
+	//! Point towards data in the form of a sorted vector of pairs, item() is O(1) then
+	inline void SetData(DataFlat & data) { flat_data = &data; dataType = DT_FLAT; estimated = false; }
+
+	//! Add a pair to DT_FLAT data without keeping the order, call Sort() after the last one
+	inline void Append(DataDecoratorType x, int count) {
+		flat_data->push_back(std::make_pair(x, count));
+		if (estimated) estimator.addEvent(x, count);
+	}
+
+	//! Add "count" events with value x to DT_MAP data, changes to the map that do not go through
+	//! the container are only seen by the power law estimate after SetData
+	void AddEvent(DataDecoratorType x, int count = 1);
+
+	//! Sort DT_FLAT data on x and keep the first pair of equal x (as read does), linear if it is sorted already
+	void Sort();
+
+	//! Count for x, 0 if it is not there (binary search for DT_FLAT)
+	int Count(DataDecoratorType x);
+
+	//! Copy the (x, count) pairs of DT_MAP or DT_FLAT data in order, linear time
+	void Flatten(DataFlat & out);
+
+	//! The DT_FLAT storage itself, to read it without a copy, NULL for other types
+	inline const DataFlat *GetFlat() { return (dataType == DT_FLAT) ? flat_data : NULL; }
+
+	//! The DT_F2DARRAY array itself, NULL for other types, see size() for its length
+	inline const float *GetArray() { return (dataType == DT_F2DARRAY) ? float_data : NULL; }
+
 	//! Get data item
 	template<class T>
 	T item(int index);
@@ -70,15 +105,21 @@ public:
 	//! Read data from stream (can be a file)
 	void read(std::istream& in); //, DataDecoratorType resolution = -1);
 
+	//! Read data from a file, memory mapped and parsed in chunks by "threads" threads (<= 0 is all)
+	bool read(const std::string & filename, int threads = 0);
+
 	//! Write to file or stream
 	void write(std::ostream& out);
 
 	//! Clear the data
 	void clear();
 
-	//! Calculate the slope in the loglog plot
+	//! Exponent of the power law at the x_min of the last FitPowerLaw (which is done first if needed)
 	float CalculateSlope();
 
+	//! Power law fit with a scan over x_min (see dobots::PowerLawEstimator), the x are event sizes
+	dobots::PowerLawFit FitPowerLaw(int threads = 0, int max_candidates = 1000);
+
 	//! Id can be used for identification purposes (e.g. in plotting)
 	inline void SetID(int id) { this->id = id; }
 
@@ -87,6 +128,12 @@ public:
 
 	//! Apply bins to the data (in DT_MAP case)
 	void ApplyBins(int no_bins, DataDecoratorType min, DataDecoratorType max);
+protected:
+	//! Parse "x: y" pairs from a buffer into the map or array, see read
+	void parse(const char *begin, const char *end, int threads);
+
+	//! Feed all DT_MAP or DT_FLAT data to the estimator, if it does not have it yet
+	void Estimate();
 private:
 	int id;
 
@@ -96,12 +143,21 @@ private:
 	//! Data in the form of a map
 	std::map<DataDecoratorType,int> * map_data;
 
+	//! Data in the form of a sorted vector
+	DataFlat * flat_data;
+
 	//! An array of data
 	float *float_data;
 
 	//! Length of float data
 	int float_data_len;
 
+	//! Power law estimate of the DT_MAP or DT_FLAT data, fed with the events that pass the container
+	dobots::PowerLawEstimator estimator;
+
+	//! The estimator has all data, and its x_min is fitted to it
+	bool estimated, fitted;
+
 };
 
 #endif /* DATADECORATOR_H_ */
@@ -0,0 +1,134 @@
+/**
+ * @brief Image of the decision regions of a model in two of its input dimensions
+ * @file DecisionMap.h
+ *
+ * This file is created at Almende B.V. It is open-source software and part of the Common
+ * Hybrid Agent Platform (CHAP). A toolbox with a lot of open-source tools, ranging from
+ * thread pools and TCP/IP components to control architectures and learning algorithms.
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless,
+ * we personally strongly object against this software used by the military, in the
+ * bio-industry, for animal experimentation, or anything that violates the Universal
+ * Declaration of Human Rights.
+ *
+ * Copyright © 2012 Anne van Rossum <anne@almende.com>
+ *
+ * @author     Anne C. van Rossum
+ * @date       Apr 22, 2012
+ * @project    Replicator FP7
+ * @company    Almende B.V.
+ * @case       Machine learning (fit for Surveyeor robots)
+ */
+
+
+
+#ifndef DECISIONMAP_H_
+#define DECISIONMAP_H_
+
+#include <ilvq/ILVQ_XSZ.h>
+
+#include <algorithm>
+#include <vector>
+
+namespace dobots {
+
+struct DecisionMapConfig {
+	int width;
+	int height;
+	int dimension; // of the inputs of the model
+	int x_dim, y_dim; // input dimensions along the horizontal and the vertical axis
+	ILVQ_TYPE x_min, x_max, y_min, y_max; // range of the image, the first row is at y_min
+	std::vector<ILVQ_TYPE> base; // values of the other input dimensions, empty is all zero
+	int classes; // number of classes, for the colours
+	int block; // size of the blocks of pixels that are tested as a whole (ILVQ_XSZ), 1 is every pixel
+	int threads; // <= 0 is all processors
+};
+
+//! Defaults: the unit square in the first two dimensions, two classes
+DecisionMapConfig decision_map_config(int width, int height, int dimension);
+
+/**
+ * Colour for a value in [0,1] in four sections, from blue through cyan, green and yellow to red.
+ * Negative values are black. This is the colour map of Plot::DrawPPM.
+ */
+inline void ppm_colour(float value, unsigned char *rgb) {
+	value *= 4 * 255;
+	if (value < 0) {
+		rgb[0] = rgb[1] = rgb[2] = 0;
+	} else if (value < 256) {
+		rgb[0] = 0; rgb[1] = value; rgb[2] = 255; // 0 b is bluest, and up to g+b=cyan
+	} else if (value < 511) {
+		rgb[0] = 0; rgb[1] = 255; rgb[2] = 511 - value; // 255 is g+b=cyan, 511 g is greenest
+	} else if (value < 766) {
+		rgb[0] = value - 511; rgb[1] = 255; rgb[2] = 0; // 511 g is greenest, 765 is r+g=yellow
+	} else {
+		rgb[0] = 255; rgb[1] = std::max(0.0f, 1020 - value); rgb[2] = 0; // 765 is r+g=yellow, 1020 is reddest
+	}
+}
+
+/**
+ * Classifies the center of every pixel of a grid over two input dimensions of a model and keeps
+ * the result as an RGB image in a single buffer, which is written as PPM in one go. Every class
+ * has its own colour, see ppm_colour.
+ *
+ * For an ILVQ_XSZ with the euclidean or manhattan metric not every pixel has to be classified.
+ * The grid is divided into blocks and the center of a block is classified with its k nearest
+ * prototypes. If the nearest one of another class is further away than the nearest one plus the
+ * diameter of the block, every pixel in it has the same class (triangle inequality). Other blocks
+ * are divided in four, down to single pixels. Only the blocks along the boundaries remain, so the
+ * cost grows with the length of the boundaries instead of with the area. All centers of a level
+ * go through the batched top-k path at once, over all processors.
+ */
+class DecisionMap {
+public:
+	DecisionMap(const DecisionMapConfig & config);
+
+	//! Classify every pixel with the batched classify of the model, a band of rows at a time
+	void render(ILVQ & model);
+
+	//! Idem, but by blocks as described above if the metric allows it
+	void render(ILVQ_XSZ & model);
+
+	//! Mark the prototypes that are within the range with a white cross with a black center
+	void overlay(ILVQ_XSZ & model, int size = 2);
+
+	//! Write the image as binary PPM, false if that fails
+	bool write(const char *path);
+
+	//! Class of every pixel, row by row
+	inline const std::vector<ILVQ_CLASS_REPRESENTATION> & getClasses() const { return classes; }
+
+	//! RGB values of every pixel, row by row
+	inline const std::vector<unsigned char> & getImage() const { return image; }
+
+	//! Number of points that have been classified by the last render
+	inline long getEvaluated() const { return evaluated; }
+protected:
+	//! Input with the given (fractional) pixel coordinates
+	void point(ILVQ_TYPE px, ILVQ_TYPE py, ILVQ_ASPECT & aspect);
+
+	//! Fill a rectangle of pixels with a class
+	void fill(int x, int y, int w, int h, ILVQ_CLASS_REPRESENTATION class_rep);
+
+	//! Colour the image after the classes
+	void colour();
+private:
+	DecisionMapConfig config;
+
+	//! Size of a pixel in input units
+	ILVQ_TYPE sx, sy;
+
+	std::vector<ILVQ_CLASS_REPRESENTATION> classes;
+
+	std::vector<unsigned char> image;
+
+	long evaluated;
+
+	//! Inputs of one batch, kept so their buffers are reused
+	std::vector<ILVQ_ASPECT> batch;
+};
+
+}
+
+#endif /* DECISIONMAP_H_ */
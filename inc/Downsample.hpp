@@ -0,0 +1,133 @@
+/**
+ * @brief Shape-preserving downsampling of long series for plotting
+ * @file Downsample.hpp
+ *
+ * This file is created at Almende B.V. It is open-source software and part of the Common
+ * Hybrid Agent Platform (CHAP). A toolbox with a lot of open-source tools, ranging from
+ * thread pools and TCP/IP components to control architectures and learning algorithms.
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless,
+ * we personally strongly object against this software used by the military, in the
+ * bio-industry, for animal experimentation, or anything that violates the Universal
+ * Declaration of Human Rights.
+ *
+ * Copyright © 2012 Anne van Rossum <anne@almende.com>
+ *
+ * @author     Anne C. van Rossum
+ * @date       Apr 22, 2012
+ * @project    Replicator FP7
+ * @company    Almende B.V.
+ * @case       Machine learning (fit for Surveyeor robots)
+ */
+
+
+#ifndef DOWNSAMPLE_HPP_
+#define DOWNSAMPLE_HPP_
+
+#include <vector>
+#include <algorithm>
+#include <cmath>
+
+namespace dobots {
+
+/**
+ * Both functions below select the indices of the points to draw from a series that is sorted on
+ * x. A series is anything with x(i) and y(i), so the points can be read in place (and scaled on
+ * the fly) without a copy of the full series. The first and last point are always kept, the
+ * indices are in increasing order.
+ */
+
+/**
+ * Min/max bucketing (M4). The x range is divided into "columns" buckets, one per pixel column,
+ * and of every bucket the first, last, lowest and highest point are kept. Drawn as a line this
+ * rasterizes the same as the full series, peaks are never lost. At most 4 points per column. If
+ * all x are equal, the buckets are taken over the indices instead.
+ */
+template <typename S>
+void downsample_minmax(const S & s, int len, int columns, std::vector<int> & keep) {
+	keep.clear();
+	if (columns < 1 || len <= 4 * columns) {
+		for (int i = 0; i < len; ++i) keep.push_back(i);
+		return;
+	}
+	double x0 = s.x(0), range = s.x(len-1) - x0;
+	bool by_index = !(range > 0);
+	int bucket = -1, first = 0, last = 0, lo = 0, hi = 0;
+	double y_lo = 0, y_hi = 0;
+	for (int i = 0; i <= len; ++i) {
+		int b = columns;
+		if (i < len) {
+			b = by_index ? (int)((long)i * columns / len) : (int)((s.x(i) - x0) / range * columns);
+			if (b >= columns) b = columns - 1;
+			if (b < 0) b = 0;
+		}
+		if (b != bucket) {
+			if (bucket >= 0) {
+				int p[4] = { first, lo, hi, last };
+				std::sort(p, p + 4);
+				for (int j = 0; j < 4; ++j) {
+					if (j == 0 || p[j] != p[j-1]) keep.push_back(p[j]);
+				}
+			}
+			if (i == len) break;
+			bucket = b;
+			first = lo = hi = i;
+			y_lo = y_hi = s.y(i);
+		} else {
+			double y = s.y(i);
+			if (y < y_lo) { y_lo = y; lo = i; }
+			if (y > y_hi) { y_hi = y; hi = i; }
+		}
+		last = i;
+	}
+}
+
+/**
+ * Largest-Triangle-Three-Buckets (Steinarsson, 2013). The points between the first and the last
+ * are divided over threshold-2 buckets of equal count. From every bucket the point is kept that
+ * makes the largest triangle with the point kept from the previous bucket and the average of the
+ * next bucket. Exactly "threshold" points, it follows the visual shape better than picking every
+ * n-th point, but a single spike can be traded for a neighbour.
+ */
+template <typename S>
+void downsample_lttb(const S & s, int len, int threshold, std::vector<int> & keep) {
+	keep.clear();
+	if (threshold < 3 || len <= threshold) {
+		for (int i = 0; i < len; ++i) keep.push_back(i);
+		return;
+	}
+	double every = (double)(len - 2) / (threshold - 2);
+	int a = 0;
+	keep.push_back(a);
+	for (int b = 0; b < threshold - 2; ++b) {
+		int next_begin = (int)((b + 1) * every) + 1;
+		int next_end = std::min((int)((b + 2) * every) + 1, len);
+		double avg_x = 0, avg_y = 0;
+		for (int j = next_begin; j < next_end; ++j) {
+			avg_x += s.x(j);
+			avg_y += s.y(j);
+		}
+		avg_x /= (next_end - next_begin);
+		avg_y /= (next_end - next_begin);
+
+		int begin = (int)(b * every) + 1, end = (int)((b + 1) * every) + 1;
+		double ax = s.x(a), ay = s.y(a);
+		double best = -1;
+		int chosen = begin;
+		for (int j = begin; j < end; ++j) {
+			double area = std::fabs((ax - avg_x) * (s.y(j) - ay) - (ax - s.x(j)) * (avg_y - ay));
+			if (area > best) {
+				best = area;
+				chosen = j;
+			}
+		}
+		keep.push_back(chosen);
+		a = chosen;
+	}
+	keep.push_back(len - 1);
+}
+
+}
+
+#endif /* DOWNSAMPLE_HPP_ */
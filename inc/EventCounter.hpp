@@ -27,67 +27,137 @@
 
 // General files
 #include <map>
+#include <vector>
+#include <algorithm>
 #include <iostream>
 #include <iomanip>
 #include <iterator>
+#include <stdint.h>
+#include <string.h>
 
 /* **************************************************************************************
  * Interface of EventCounter
  * **************************************************************************************/
 
 /**
- * Count events of a given "type" (might e.g. be size)
+ * Storage of the counts. EC_MAP is a std::map. EC_DENSE is an array indexed by the type, for
+ * small non-negative integer types, other types go into a map next to it. EC_HASHED is an open
+ * addressing hash table with linear probing, for sparse types. The last two do not allocate per
+ * event, so an event costs an array access or a probe or two.
+ */
+enum EventCounterMode { EC_MAP, EC_DENSE, EC_HASHED };
+
+//! Finalizer of splitmix64 over the bits of the type, with -0 the same as 0
+template <typename T>
+inline uint64_t event_hash(T type) {
+	if (type == T()) type = T();
+	uint64_t z = 0;
+	memcpy(&z, &type, std::min(sizeof(T), sizeof(z)));
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	return z ^ (z >> 31);
+}
+
+/**
+ * Count events of a given "type" (might e.g. be size). In the EC_DENSE and EC_HASHED modes the
+ * map that getEvents returns is a copy that is made on that call, changes to it are not kept.
  */
 template <typename T>
 class EventCounter {
 public:
-	//! Construct an event counter
-	EventCounter() { events.clear(); }
+	//! Construct an event counter, size is the range [0,size) of EC_DENSE or the initial capacity of EC_HASHED
+	EventCounter(EventCounterMode mode = EC_MAP, long size = 0): mode(mode), used(0) {
+		events.clear();
+		if (mode == EC_DENSE) dense.resize(size);
+		if (mode == EC_HASHED) {
+			long capacity = 16;
+			while (capacity < size) capacity <<= 1;
+			slots.resize(capacity);
+		}
+	}
 
 	//! Add one event of given type
-	void AddEvent(const T type) {
-		typename std::map<T,int>::iterator f = events.find(type);
-		if (f == events.end()) {
-			events.insert(std::make_pair<T,int>(type, 1));
-		} else {
-			(*f).second++;
-		}
+	inline void AddEvent(const T type) {
+		AddEvent(type, 1);
 	}
 
 	//! Add "freq" events of a given type
-	void AddEvent(const T type, int freq) {
+	inline void AddEvent(const T type, int freq) {
+		switch (mode) {
+		case EC_DENSE: {
+			long index = denseIndex(type);
+			if (index >= 0) {
+				dense[index] += freq;
+				return;
+			}
+			break;
+		}
+		case EC_HASHED:
+			slot(type).count += freq;
+			return;
+		default:
+			break;
+		}
 		typename std::map<T,int>::iterator f = events.find(type);
 		if (f == events.end()) {
-			events.insert(std::make_pair<T,int>(type, freq));
+			events.insert(std::make_pair(type, freq));
 		} else {
 			(*f).second += freq;
 		}
 	}
 
-	//! Take the existing events and put them in bins
+	/**
+	 * Take the existing events and put them in bins. This is a single pass over the counts into an
+	 * array of no_bins+1 bins, after which only the bins are stored. Types below min go to the first
+	 * bin, types above max to the last one, and a bin is represented by its lowest type.
+	 */
 	void Bin(int no_bins, T min, T max) {
-		typename std::map<T,int>::iterator f;
-		if (events.empty()) return;
-		EventCounter binned_cntr;
-
+		if (empty()) return;
 		T delta = (max - min) / no_bins;
 		std::cout << "Delta is " << delta << std::endl;
+		if (!(delta > T(0))) {
+			std::cerr << "Bins of width " << delta << " are not possible, use fewer bins or a larger range" << std::endl;
+			return;
+		}
+		bins.assign(no_bins + 1, 0);
+		hits.assign(no_bins + 1, 0);
+		int size = 0;
+		switch (mode) {
+		case EC_DENSE:
+			for (long i = 0; i < (long)dense.size(); ++i) {
+				if (dense[i] == 0) continue;
+				int bin_id = binOf((T)i, no_bins, min, max, delta);
+				bins[bin_id] += dense[i];
+				hits[bin_id] = 1;
+				size++;
+			}
+			break;
+		case EC_HASHED:
+			for (unsigned int i = 0; i < slots.size(); ++i) {
+				if (!slots[i].used) continue;
+				int bin_id = binOf(slots[i].type, no_bins, min, max, delta);
+				bins[bin_id] += slots[i].count;
+				hits[bin_id] = 1;
+				size++;
+			}
+			break;
+		default:
+			break;
+		}
+		typename std::map<T,int>::iterator f;
 		for (f = events.begin(); f != events.end(); ++f) {
-			T value = (*f).first;
-			int bin_id = 0;
-			if (value >= min) bin_id = (value - min) / delta;
-			if (value > max) bin_id = no_bins;
-			T bin_value = min + delta * bin_id;
-//			std::cout << "Bin id is " << bin_id << "(" << value << "-" << min << ") /" << no_bins << " and bin value thus: " << bin_value << std::endl;
-			binned_cntr.AddEvent(bin_value, (*f).second);
-		}
-		int size = events.size();
-		events.clear();
-		for (f = binned_cntr.getEvents().begin(); f != binned_cntr.getEvents().end(); ++f) {
-			AddEvent(f->first, f->second);
+			int bin_id = binOf((*f).first, no_bins, min, max, delta);
+			bins[bin_id] += (*f).second;
+			hits[bin_id] = 1;
+			size++;
+		}
+		Clear();
+		for (int b = 0; b <= no_bins; ++b) {
+			if (hits[b]) AddEvent(min + delta * b, bins[b]);
 		}
-		std::cerr << "Goes from size " << size << " to " << events.size() << std::endl;
-		if (events.size() < 10) {
+		int binned = getEvents().size();
+		std::cerr << "Goes from size " << size << " to " << binned << std::endl;
+		if (binned < 10) {
 			std::cerr << "Maybe use more than " << no_bins << " bins" << std::endl;
 		}
 
@@ -97,6 +167,7 @@ public:
 	//! Print
 	void Print(int print_list = 0) {
 		typename std::map<T,int>::iterator f;
+		getEvents();
 
 		int line_items = 20; int i = 0;
 
@@ -126,11 +197,141 @@ public:
 
 	}
 
-	//! Get events
-	std::map<T, int> & getEvents() { return events; }
+	//! Get events, sorted on type
+	std::map<T, int> & getEvents() {
+		if (mode == EC_MAP) return events;
+		// in the other modes the map holds only the types that did not fit, add the rest to a copy
+		snapshot = events;
+		if (mode == EC_DENSE) {
+			for (long i = 0; i < (long)dense.size(); ++i) {
+				if (dense[i] != 0) snapshot[(T)i] += dense[i];
+			}
+		} else {
+			std::vector<std::pair<T,int> > pairs;
+			pairs.reserve(used);
+			for (unsigned int i = 0; i < slots.size(); ++i) {
+				if (slots[i].used) pairs.push_back(std::make_pair(slots[i].type, slots[i].count));
+			}
+			std::sort(pairs.begin(), pairs.end());
+			snapshot.insert(pairs.begin(), pairs.end());
+		}
+		return snapshot;
+	}
+
+	//! Count of the given type, 0 if there are none
+	int GetCount(const T type) {
+		if (mode == EC_DENSE) {
+			long index = denseIndex(type);
+			if (index >= 0) return dense[index];
+		}
+		if (mode == EC_HASHED) {
+			long i = find(type);
+			return (i < 0) ? 0 : slots[i].count;
+		}
+		typename std::map<T,int>::const_iterator f = events.find(type);
+		return (f == events.end()) ? 0 : f->second;
+	}
+
+	//! Remove all events, the capacity of the dense array and the hash table is kept
+	void Clear() {
+		events.clear();
+		std::fill(dense.begin(), dense.end(), 0);
+		for (unsigned int i = 0; i < slots.size(); ++i) slots[i].used = false;
+		used = 0;
+	}
+
+	inline EventCounterMode getMode() const { return mode; }
+protected:
+	struct Slot {
+		T type;
+		int count;
+		bool used;
+		Slot(): type(), count(0), used(false) {}
+	};
+
+	//! Index in the dense array, -1 if the type is not an integer in its range
+	inline long denseIndex(T type) const {
+		if (!(type >= T(0) && type < (T)dense.size())) return -1;
+		long index = (long)type;
+		return ((T)index == type) ? index : -1;
+	}
+
+	/**
+	 * Old behaviour of Bin: below min is bin 0, above max is bin no_bins, else truncated. For an
+	 * integer T the delta is rounded down, so values near max are clamped to bin no_bins as well.
+	 */
+	static inline int binOf(T value, int no_bins, T min, T max, T delta) {
+		int bin_id = 0;
+		if (value >= min) bin_id = std::min<long>((value - min) / delta, no_bins);
+		if (value > max) bin_id = no_bins;
+		return bin_id;
+	}
+
+	//! Index of the slot with the type, -1 if it is not there
+	long find(T type) const {
+		const uint64_t mask = slots.size() - 1;
+		for (uint64_t i = event_hash(type) & mask; slots[i].used; i = (i + 1) & mask) {
+			if (slots[i].type == type) return i;
+		}
+		return -1;
+	}
+
+	//! Slot of the type, created if needed, the table grows at a load of 1/2
+	Slot & slot(T type) {
+		uint64_t mask = slots.size() - 1;
+		uint64_t i = event_hash(type) & mask;
+		for (; slots[i].used; i = (i + 1) & mask) {
+			if (slots[i].type == type) return slots[i];
+		}
+		if (2 * (used + 1) > (long)slots.size()) {
+			grow();
+			return slot(type);
+		}
+		slots[i].used = true;
+		slots[i].type = type;
+		slots[i].count = 0;
+		used++;
+		return slots[i];
+	}
+
+	void grow() {
+		std::vector<Slot> old(slots.size() * 2);
+		old.swap(slots);
+		const uint64_t mask = slots.size() - 1;
+		for (unsigned int j = 0; j < old.size(); ++j) {
+			if (!old[j].used) continue;
+			uint64_t i = event_hash(old[j].type) & mask;
+			while (slots[i].used) i = (i + 1) & mask;
+			slots[i] = old[j];
+		}
+	}
+
+	bool empty() const {
+		if (!events.empty() || used > 0) return false;
+		for (unsigned int i = 0; i < dense.size(); ++i) {
+			if (dense[i] != 0) return false;
+		}
+		return true;
+	}
 private:
-	//! Probably a sparse vector is the best, but to stay in STL, we will use a map
+	EventCounterMode mode;
+
+	//! Probably a sparse vector is the best, but to stay in STL, we will use a map (EC_MAP, or the rest of EC_DENSE)
 	std::map<T, int> events;
+
+	//! Counts of EC_DENSE
+	std::vector<int> dense;
+
+	//! Table of EC_HASHED and the number of used slots
+	std::vector<Slot> slots;
+	long used;
+
+	//! What getEvents returns in EC_DENSE and EC_HASHED mode
+	std::map<T, int> snapshot;
+
+	//! Bins while binning, kept to reuse
+	std::vector<int> bins;
+	std::vector<char> hits;
 };
 
 #endif /* EVENTCOUNTER_H_ */
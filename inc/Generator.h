@@ -0,0 +1,153 @@
+/**
+ * @brief Deterministic generator of synthetic workloads
+ * @file Generator.h
+ *
+ * This file is created at Almende B.V. It is open-source software and part of the Common
+ * Hybrid Agent Platform (CHAP). A toolbox with a lot of open-source tools, ranging from
+ * thread pools and TCP/IP components to control architectures and learning algorithms.
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless,
+ * we personally strongly object against this software used by the military, in the
+ * bio-industry, for animal experimentation, or anything that violates the Universal
+ * Declaration of Human Rights.
+ *
+ * Copyright © 2012 Anne van Rossum <anne@almende.com>
+ *
+ * @author     Anne C. van Rossum
+ * @date       Apr 22, 2012
+ * @project    Replicator FP7
+ * @company    Almende B.V.
+ * @case       Machine learning (fit for Surveyeor robots)
+ */
+
+
+#ifndef GENERATOR_H_
+#define GENERATOR_H_
+
+#include <ilvq/defs.h>
+
+#include <stdint.h>
+#include <vector>
+
+namespace dobots {
+
+enum GeneratorType {
+	GT_HALVES, // class by the first coordinate (the "halves" of main/test.cpp)
+	GT_CIRCLE, // class by the distance to the center in the first two coordinates (the "circle")
+	GT_XOR, // class by the parity of the first xor_bits coordinates being above 0.5
+	GT_MIXTURE, // a mixture of gaussians, "clusters" per class
+	GT_MANIFOLD, // a curved low dimensional manifold, class by the first latent coordinate
+	GT_TYPES
+};
+
+struct GeneratorConfig {
+	GeneratorType type;
+	int dimension;
+	int classes;
+	uint64_t seed;
+	int clusters; // per class (mixture)
+	float spread; // standard deviation of the clusters (mixture) or of the noise (manifold)
+	float imbalance; // class c is imbalance^c times as frequent as class 0, 1 is balanced
+	float drift; // drift of the concept per million samples, in radians or for the mixture in units
+	int xor_bits; // number of coordinates in the parity (xor)
+	int manifold_dimension; // dimension of the latent space (manifold)
+};
+
+//! Defaults for the given type, dimension and number of classes
+GeneratorConfig generator_config(GeneratorType type, int dimension, int classes = 2, uint64_t seed = 1);
+
+//! Finalizer of splitmix64, a bijective mix of 64 bits
+inline uint64_t mix64(uint64_t z) {
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	return z ^ (z >> 31);
+}
+
+/**
+ * Counter-based random numbers: the n-th number of a stream is a hash of the key of the stream
+ * and n. There is no state to share or to skip ahead, so every sample can have its own stream and
+ * the samples can be generated in any order, by any number of threads, with the same result.
+ */
+struct CounterRNG {
+	uint64_t key;
+	uint64_t counter;
+	float spare; // second value of the last Box-Muller pair
+	bool has_spare;
+
+	CounterRNG(uint64_t seed, uint64_t stream): key(mix64(seed ^ mix64(stream + 0x9E3779B97F4A7C15ULL))),
+			counter(0), spare(0), has_spare(false) {}
+
+	inline uint64_t next() {
+		return mix64(key + (++counter) * 0x9E3779B97F4A7C15ULL);
+	}
+
+	//! Uniform in [0,1), 24 bits
+	inline float uniform() {
+		return (next() >> 40) * (1.0f / 16777216.0f);
+	}
+
+	//! Standard normal (Box-Muller, one pair for two calls)
+	float gaussian();
+};
+
+/**
+ * Generates labeled samples for a given seed. Sample i is always the same, whatever the block it
+ * is generated in and whatever the number of threads, so runs can be reproduced and training and
+ * test sets are just disjoint ranges of sample indices. With drift the concept depends on the
+ * index of the sample, so later samples follow a moved boundary.
+ *
+ * The block functions write row by row with a stride of getStride() values, which is the dimension
+ * rounded up to 64 bytes, so that every row in a buffer from allocate() is aligned.
+ */
+class Generator {
+public:
+	Generator(const GeneratorConfig & config);
+
+	//! Sample with the given index
+	void sample(uint64_t index, ILVQ_TYPE *out, ILVQ_CLASS_REPRESENTATION & class_rep) const;
+
+	//! Idem in an aspect
+	void sample(uint64_t index, ILVQ_ASPECT & aspect, ILVQ_CLASS_REPRESENTATION & class_rep) const;
+
+	//! Samples first..first+count-1 into out (count rows of getStride()) and classes
+	void generate(uint64_t first, int count, ILVQ_TYPE *out, ILVQ_CLASS_REPRESENTATION *classes,
+			int threads = 0) const;
+
+	//! Idem into aspects, for the functions of the engines that take vectors
+	void generate(uint64_t first, int count, std::vector<ILVQ_ASPECT> & aspects,
+			std::vector<ILVQ_CLASS_REPRESENTATION> & classes, int threads = 0) const;
+
+	//! Buffer of "rows" rows of getStride() values, aligned at 64 bytes, release it with free()
+	ILVQ_TYPE *allocate(int rows) const;
+
+	inline int getStride() const { return stride; }
+
+	inline const GeneratorConfig & getConfig() const { return config; }
+protected:
+	//! Class with the configured imbalance
+	ILVQ_CLASS_REPRESENTATION drawClass(CounterRNG & rng) const;
+
+	//! For the types that derive the class from the sample, whether to keep a sample of that class
+	bool accept(CounterRNG & rng, ILVQ_CLASS_REPRESENTATION class_rep) const;
+private:
+	GeneratorConfig config;
+
+	int stride;
+
+	//! Cumulative and relative class weights
+	std::vector<float> cumulative;
+	std::vector<float> relative;
+
+	//! Centers and drift directions of the clusters, class by class (mixture)
+	std::vector<float> centers;
+	std::vector<float> directions;
+
+	//! Frequencies and phases of the embedding (manifold)
+	std::vector<float> frequencies;
+	std::vector<float> phases;
+};
+
+}
+
+#endif /* GENERATOR_H_ */
@@ -27,9 +27,11 @@
 
 #include <ilvq/defs.h>
 
+#include <stddef.h>
+
 namespace dobots {
 
-enum DistanceMetric { DM_EUCLIDEAN, DM_DOTPRODUCT, DM_TYPES };
+enum DistanceMetric { DM_EUCLIDEAN, DM_DOTPRODUCT, DM_COSINE, DM_MANHATTAN, DM_TYPES };
 
 class ILVQ {
 public:
@@ -40,14 +42,44 @@ public:
 	//! Add new input
 	virtual void add(ILVQ_ASPECT & input, ILVQ_CLASS_REPRESENTATION & class_rep) = 0;
 
+	//! Class of the prototype closest to the input
+	virtual ILVQ_CLASS_REPRESENTATION classify(ILVQ_ASPECT & input) = 0;
+
+	//! Classify a batch of inputs, by default one by one (threads is ignored)
+	virtual void classify(const std::vector<ILVQ_ASPECT> & inputs, std::vector<ILVQ_CLASS_REPRESENTATION> & classes,
+			int threads = 1);
+
+	//! Number of prototypes in the model
+	virtual int getPrototypeCount() = 0;
+
 	//! Calculate the distance between aspect and prototype
 	ILVQ_TYPE distance(const ILVQ_ASPECT & aspect, const ILVQ_PROTOTYPE & prototype, DistanceMetric metric);
 
-	//! Increase the distance given a new input (by updating prototype)
-	void increaseDistance(ILVQ_PROTOTYPE & prototype, const ILVQ_ASPECT & input, ILVQ_TYPE mu);
+	//! Idem, but with the (euclidean) norms of both already known, only DM_COSINE uses them
+	ILVQ_TYPE distance(const ILVQ_ASPECT & aspect, const ILVQ_PROTOTYPE & prototype, DistanceMetric metric,
+			ILVQ_TYPE aspect_norm, ILVQ_TYPE prototype_norm);
+
+	/**
+	 * Distance between a sparse aspect and a prototype that represents the vector scale*prototype,
+	 * with the (euclidean) norms of aspect and of that vector known. This costs a single pass over
+	 * the non-zero entries of the aspect. DM_MANHATTAN is not supported.
+	 */
+	ILVQ_TYPE distance(const ILVQ_SPARSE_ASPECT & aspect, const ILVQ_PROTOTYPE & prototype, DistanceMetric metric,
+			ILVQ_TYPE aspect_norm, ILVQ_TYPE prototype_norm, ILVQ_TYPE scale = 1);
+
+	//! Euclidean norm of a vector
+	static ILVQ_TYPE norm(const ILVQ_ASPECT & aspect);
+
+	//! Euclidean norm of a sparse vector
+	static ILVQ_TYPE norm(const ILVQ_SPARSE_ASPECT & aspect);
+
+	//! Increase the distance given a new input (by updating prototype), and update its cached norm
+	void increaseDistance(ILVQ_PROTOTYPE & prototype, const ILVQ_ASPECT & input, ILVQ_TYPE mu,
+			ILVQ_TYPE *prototype_norm = NULL);
 
-	//! Decrease distance (by updating prototype)
-	void decreaseDistance(ILVQ_PROTOTYPE & prototype, const ILVQ_ASPECT & input, ILVQ_TYPE mu);
+	//! Decrease distance (by updating prototype), and update its cached norm
+	void decreaseDistance(ILVQ_PROTOTYPE & prototype, const ILVQ_ASPECT & input, ILVQ_TYPE mu,
+			ILVQ_TYPE *prototype_norm = NULL);
 
 protected:
 	//! For debugging purposes
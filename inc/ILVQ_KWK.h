@@ -28,27 +28,63 @@
 #include <ilvq/defs.h>
 #include <ilvq/ILVQ.h>
 
+#include <vector>
+
 namespace dobots {
 
+/**
+ * The prototypes of one class are stored packed, one after the other, so the search over a
+ * class is a single linear pass over memory.
+ */
+struct ILVQ_KWK_CLASS {
+	ILVQ_CLASS_REPRESENTATION class_id;
+	int count;
+	std::vector<ILVQ_TYPE> prototypes; // count * dimension values
+	std::vector<int> ids; // of every prototype over all classes, in order of creation (trace)
+};
+
 /*
  * First, I picked this one: "Rapid Online Learning of Objects in a Biologically Motivated
  * Recognition Architecture" by Kirstein, Wersing, Körner (2005). However, it is vague at many
  * point so I decided to switch to "An incremental learning vector quantization algorithm for
  * pattern classification" by Xu, Shen, Zhao (2010).
+ * It is implemented nevertheless, so both can be compared. A new aspect becomes a prototype if it
+ * is not similar enough to any prototype of its own class. Otherwise the most similar prototype
+ * is adjusted by LVQ: towards the aspect if it has the same class, away from it if not (and then
+ * the most similar prototype of the right class is moved towards it).
  */
 class ILVQ_KWK: public ILVQ {
 public:
+	ILVQ_KWK(ILVQ_TYPE S_t=0.9, ILVQ_TYPE mu=0.05);
+
+	~ILVQ_KWK();
+
+	void add(ILVQ_ASPECT & input, ILVQ_CLASS_REPRESENTATION & class_rep);
+
+	ILVQ_CLASS_REPRESENTATION classify(ILVQ_ASPECT & input);
+
+	using ILVQ::classify;
+
+	int getPrototypeCount();
 
 	/**
 	 * Similarity is measured as: A_i^l = exp ( -||x^i - r^l||^2 / sigma )
 	 */
-	void similarity(ILVQ_ASPECT aspect, ILVQ_PROTOTYPE prototype);
+	ILVQ_TYPE similarity(const ILVQ_ASPECT & aspect, const ILVQ_PROTOTYPE & prototype);
 
 	/**
 	 * Iterate through all prototypes of a class and returns maximum similarity:
 	 *   A_i^max = max { A_i^l }
+	 * Returns 0 if there are no prototypes of this class.
 	 */
-	float max_similar(ILVQ_ASPECT aspect, ILVQ_CLASS_INDEX class_index);
+	ILVQ_TYPE max_similar(const ILVQ_ASPECT & aspect, ILVQ_CLASS_REPRESENTATION class_index);
+
+	/**
+	 * The maximum similarity for every class in one pass over all prototypes. The exponentials
+	 * are calculated at the end, over all classes at once, with a vectorized approximation.
+	 */
+	void max_similarities(const ILVQ_ASPECT & aspect, std::vector<ILVQ_CLASS_REPRESENTATION> & classes,
+			std::vector<ILVQ_TYPE> & similarities);
 
 	/**
 	 * If too similar, do not accept the new aspect. Too similar is just defined
@@ -56,15 +92,49 @@ public:
 	 *   A_i^max >= S_t.
 	 * This function hence returns "true" A_i^max < S_t.
 	 */
-	bool accept(float similarity);
+	bool accept(ILVQ_TYPE similarity);
+
+	inline ILVQ_TYPE getSigma() { return sigma; }
+protected:
+	/**
+	 * One pass over all classes: the smallest squared distance within each class (stored in
+	 * min_dist, in the order of "classes") and the overall winner.
+	 */
+	void getClosePrototypes(const ILVQ_ASPECT & input, int & winner_class, int & winner_index);
+
+	//! Index in "classes" of the given class, -1 if it does not exist
+	int findClass(ILVQ_CLASS_REPRESENTATION class_rep);
 
+	//! Update sigma from the running average of the squared distance between successive inputs
+	void updateSigma(const ILVQ_ASPECT & input);
 private:
 	// Similarity threshold, if exceeded a new aspect will not be incorporated
-	float S_t;
+	ILVQ_TYPE S_t;
 
 	//! Chosen such that average similarity is appr. equal to 0.5
-	float sigma;
+	ILVQ_TYPE sigma;
+
+	//! Squared distance that corresponds with S_t: A >= S_t <=> d <= -sigma ln(S_t)
+	ILVQ_TYPE d_t;
+
+	//! Learning rate
+	ILVQ_TYPE mu;
+
+	//! Running average of squared distance between successive inputs, and number of samples in it
+	ILVQ_TYPE d_mean;
+	int d_samples;
+
+	//! Previous input (for the estimation of sigma)
+	ILVQ_ASPECT previous;
+
+	//! Prototypes grouped per class
+	std::vector<ILVQ_KWK_CLASS> classes;
+
+	//! Temporary field with smallest distance per class
+	std::vector<ILVQ_TYPE> min_dist;
 
+	//! Index of the closest prototype per class
+	std::vector<int> min_index;
 };
 
 }
@@ -27,34 +27,144 @@
 
 #include <ilvq/defs.h>
 #include <ilvq/ILVQ.h>
+#include <ilvq/Trace.h>
+#include <ilvq/Kernels.h>
 
 #include <map>
 #include <set>
 #include <list>
+#include <vector>
 #include <algorithm>
+#include <stdint.h>
+#include <stdio.h>
 
 namespace dobots {
 
 struct ILVQ_XSZ_CONNECTION;
 
+//! Neighbour update that is not applied yet (lazy mode): w = w + mu (w - x), with x in the input log
+struct ILVQ_XSZ_PENDING {
+	ILVQ_TYPE mu;
+	int slot;
+};
+
+//! Maximum number of inputs in the log of lazy updates
+#define ILVQ_LAZY_MAX 64
+
 typedef std::list<ILVQ_XSZ_CONNECTION*> ILVQ_XSZ_CONNECTIONS;
 
 struct ILVQ_XSZ_PROTOTYPE {
 	ILVQ_PROTOTYPE *prototype;
+	ILVQ_PROTOTYPE_INDEX index; // unique id, e.g. for tracing
+	ILVQ_TYPE norm; // euclidean norm of prototype, kept up to date by increase/decreaseDistance
+	int version; // incremented every time the prototype moves
+	std::vector<ILVQ_XSZ_PENDING> pending; // updates not yet applied to prototype (lazy mode)
+	ILVQ_TYPE scale; // the position is scale * prototype (sparse mode, else 1)
+	ILVQ_TYPE norm2; // squared norm of prototype itself, without scale (sparse mode)
+	std::vector<uint64_t> support; // a bit for every entry that can be non-zero, empty if not kept (sparse mode)
+	int support_count; // number of bits set, the dimension if the support is not kept
+	std::vector<ILVQ_TYPE> sketch; // random projection of the prototype (prefilter)
+	std::vector<ILVQ_TYPE> norms; // euclidean norm of every modality (view mode)
 	ILVQ_TYPE T_s; // state
 	int winner_count; //M_s
 	ILVQ_CLASS_REPRESENTATION class_id; // class represented by index/id (not distributed)
 	ILVQ_XSZ_CONNECTIONS *outgoing_connections;
+	ILVQ_XSZ_CONNECTIONS incoming_connections; // same connections, stored at s2
+	int bucket; // number of outgoing connections if 0 or 1, else -1 (see deleteNodes)
+	ILVQ_XSZ_PROTOTYPE *bucket_prev, *bucket_next; // intrusive list of prototypes in the same bucket
+	long born; // value of the clock of the prototype budget when it was created
+	long last_win; // value of the clock of the prototype budget when it was created or last won
+	long budget_key; // priority in the eviction heap, the lowest is evicted first
+	int budget_heap; // position in the eviction heap, -1 if not in it, -2 if in its grace period
+	std::list<ILVQ_XSZ_PROTOTYPE*>::iterator budget_young; // position in the grace list, if in its grace period
 };
 
 struct ILVQ_XSZ_CONNECTION {
 	ILVQ_XSZ_PROTOTYPE *s1;
 	ILVQ_XSZ_PROTOTYPE *s2;
 	int age;
+	ILVQ_TYPE length; // cached distance between s1 and s2
+	int version1, version2; // versions of s1 and s2 for which length is valid
+	ILVQ_TYPE dot; // dot product of the stored s1 and s2 prototypes, without scale (sparse mode)
 };
 
 typedef ILVQ_XSZ_CONNECTION ILVQ_XSZ_PROTOTYPE_PAIR;
 
+/**
+ * Header of a model file (see ILVQ_XSZ::save). It is followed by the modalities, by the
+ * prototypes, each as index, class id and winner count (int32_t), threshold and "dimension" values
+ * (float), and then by the connections as index of s1, index of s2 and age (int32_t). All in host
+ * byte order. Files of version 1 have neither the modalities nor the field that counts them.
+ */
+struct ILVQ_XSZ_FILE_HEADER {
+	char magic[8]; // "ILVQXSZ2", or "ILVQXSZ1" for version 1
+	int32_t dimension;
+	int32_t prototypes;
+	int32_t connections;
+	int32_t metric;
+	int32_t sparse;
+	int32_t age_old;
+	int32_t lambda;
+	int32_t lambda_i;
+	int32_t next_index;
+	float mu1, mu2;
+	int32_t modalities;
+};
+
+//! A modality in a model file, without the offset, which follows from the order
+struct ILVQ_XSZ_FILE_MODALITY {
+	int32_t dimension;
+	int32_t metric;
+	float weight;
+};
+
+//! Bytes used by one kind of structure (see ILVQ_XSZ::memoryUsage)
+struct ILVQ_MEMORY_PART {
+	size_t payload; // the values of the prototype positions
+	size_t bookkeeping; // fields, pointers, container nodes and derived data around them
+	size_t slack; // allocator headers and rounding, and unused capacity of vectors
+
+	inline size_t total() const { return payload + bookkeeping + slack; }
+};
+
+struct ILVQ_XSZ_MEMORY {
+	int prototypes;
+	int connections;
+	int dimension;
+	ILVQ_MEMORY_PART prototype; // the ILVQ_XSZ_PROTOTYPE structs and their nodes in the set
+	ILVQ_MEMORY_PART position; // the position vectors
+	ILVQ_MEMORY_PART connection; // connections, their list nodes (outgoing and incoming), the outgoing lists
+	ILVQ_MEMORY_PART extra; // vectors of the modes, per prototype: pending updates, sketch, norms
+	ILVQ_MEMORY_PART model; // the object itself, prefilter projection, lazy log and temporaries
+	size_t heap_free; // free bytes within the heap of the whole process (fragmentation)
+
+	inline size_t total() const {
+		return prototype.total() + position.total() + connection.total() + extra.total() + model.total();
+	}
+};
+
+//! Which prototype to evict when the prototype budget is full (see ILVQ_XSZ::setBudget)
+enum ILVQ_EVICTION {
+	EV_LEAST_RECENT, // the one that won least recently
+	EV_LEAST_WINS, // the one with the lowest winner count, after a grace period
+	EV_REDUNDANT, // one with a close neighbour of the same class, then the lowest winner count, after a grace period
+	EV_TYPES
+};
+
+//! One modality of a multi-modal input (ILVQ_VIEW), with its own metric and weight
+struct ILVQ_MODALITY {
+	int dimension;
+	DistanceMetric metric;
+	ILVQ_TYPE weight;
+	int offset; // start of this modality in the packed prototype, set by setModalities
+};
+
+//! A multi-modal input prepared for the distance, per modality
+struct ILVQ_XSZ_VIEW {
+	std::vector<const ILVQ_TYPE*> x; // start of the modality, NULL if absent
+	std::vector<ILVQ_TYPE> norms; // euclidean norm of the modality, if the metric needs it
+};
+
 /**
  * First, I picked this one: "Rapid Online Learning of Objects in a Biologically Motivated
  * Recognition Architecture" by Kirstein, Wersing, Körner (2005). However, it is vague at many
@@ -74,7 +184,8 @@ typedef ILVQ_XSZ_CONNECTION ILVQ_XSZ_PROTOTYPE_PAIR;
  */
 class ILVQ_XSZ: public ILVQ {
 public:
-	ILVQ_XSZ(int ageOld=16, ILVQ_TYPE mu1=0.1, ILVQ_TYPE mu2=0.001, int lambda=16);
+	ILVQ_XSZ(int ageOld=16, ILVQ_TYPE mu1=0.1, ILVQ_TYPE mu2=0.001, int lambda=16,
+			DistanceMetric metric=DM_EUCLIDEAN);
 
 	~ILVQ_XSZ();
 
@@ -82,18 +193,271 @@ public:
 
 	ILVQ_CLASS_REPRESENTATION classify(ILVQ_ASPECT & input);
 
+	/**
+	 * Add a sparse input. The cost is proportional to the number of non-zero entries (times the
+	 * number of edges of the prototypes that move), not to the dimension. A model is trained with
+	 * either dense or sparse inputs, not both, and sparse mode does not support DM_MANHATTAN and
+	 * lazy mode.
+	 */
+	void add(const ILVQ_SPARSE_ASPECT & input, ILVQ_CLASS_REPRESENTATION & class_rep);
+
+	//! Class of the prototype closest to the sparse input
+	ILVQ_CLASS_REPRESENTATION classify(const ILVQ_SPARSE_ASPECT & input);
+
+	/**
+	 * Use multi-modal inputs, with the given modalities. The prototypes store all modalities
+	 * packed one after the other. The distance is the weighted sum of the distances per modality,
+	 * each with its own metric, in one pass over the prototype. Call it before adding data.
+	 */
+	void setModalities(const std::vector<ILVQ_MODALITY> & modalities);
+
+	/**
+	 * Add a multi-modal input, with an aspect per modality. A modality that is absent from the
+	 * input (NULL or empty aspect) is not used to find the winners and not updated. For the rest
+	 * it is taken from the winner: a new prototype gets the absent modalities of the winner, and
+	 * the distances that are compared with the thresholds are over all modalities, the same as
+	 * the edge lengths the thresholds are calculated from. Only the very first prototype gets
+	 * zeros. Sparse, lazy and prefilter modes are not available.
+	 */
+	void add(const ILVQ_VIEW & input, ILVQ_CLASS_REPRESENTATION & class_rep);
+
+	//! Class of the prototype closest to the multi-modal input
+	ILVQ_CLASS_REPRESENTATION classify(const ILVQ_VIEW & input);
+
+	//! Classify a batch of inputs, spread over "threads" threads (<= 0 means all processors)
+	void classify(const std::vector<ILVQ_ASPECT> & inputs, std::vector<ILVQ_CLASS_REPRESENTATION> & classes,
+			int threads = 1);
+
+	/**
+	 * The k nearest prototypes of the input, sorted on distance, in a single scan over the
+	 * prototypes. The class ids and distances are written to out_ids and out_dists (both of size
+	 * k, out_dists may be NULL). Returns the number of prototypes found, which is less than k if
+	 * there are not that many prototypes.
+	 */
+	int classifyTopK(const ILVQ_ASPECT & input, int k, ILVQ_CLASS_REPRESENTATION *out_ids,
+			ILVQ_TYPE *out_dists);
+
+	//! Batch version of the above, the outputs are of size inputs.size()*k, missing entries are -1
+	void classifyTopK(const std::vector<ILVQ_ASPECT> & inputs, int k, ILVQ_CLASS_REPRESENTATION *out_ids,
+			ILVQ_TYPE *out_dists, int threads = 1);
+
+	/**
+	 * Distance-weighted vote over the k nearest prototypes. Each prototype votes for its class with
+	 * weight 1/(d+epsilon). The confidence is the share of the total weight of the winning class.
+	 */
+	ILVQ_CLASS_REPRESENTATION classifyKNN(const ILVQ_ASPECT & input, int k, ILVQ_TYPE *confidence = NULL);
+
+	//! Batch version of the above, confidences may be NULL
+	void classifyKNN(const std::vector<ILVQ_ASPECT> & inputs, int k, std::vector<ILVQ_CLASS_REPRESENTATION> & classes,
+			std::vector<ILVQ_TYPE> *confidences = NULL, int threads = 1);
+
+	//! Index of the prototype closest to the input, as found by classifyTopK, -1 if there are none
+	ILVQ_PROTOTYPE_INDEX getWinner(const ILVQ_ASPECT & input);
+
 	int getPrototypeCount();
 
+	//! Dimension of the prototypes, 0 if there are none yet
+	int getDimension();
+
+	/**
+	 * Write the model to a file. The prototypes are stored at their current position, so pending
+	 * lazy updates and the scale of sparse mode are applied. The modalities are stored as well.
+	 * Returns false on a write error.
+	 */
+	bool save(FILE *f);
+
+	/**
+	 * Replace the model by the one in the file, including its modalities (a file of version 1
+	 * keeps the ones that are set). The prefilter and lazy mode are not stored, they have to be
+	 * set before loading. The prototypes are stored dense, so a model that was trained with sparse
+	 * inputs is loaded as a dense model. Returns false if the file can not be read.
+	 */
+	bool load(FILE *f);
+
+	//! Number of bytes save() writes
+	size_t getSaveSize();
+
+	/**
+	 * Memory used by the model, by structure. The allocator overhead is that of glibc malloc (on
+	 * 64 bits: 8 bytes header, 16 bytes alignment, at least 32 bytes), the container nodes those of
+	 * libstdc++. The free memory in the heap is obtained from malloc itself.
+	 */
+	ILVQ_XSZ_MEMORY memoryUsage();
+
+	/**
+	 * Estimate of memoryUsage() for the given number of prototypes and dimension, with the same
+	 * modes and the same number of connections and extras per prototype as the current model.
+	 */
+	ILVQ_XSZ_MEMORY projectMemory(int prototypes, int dimension);
+
+	/**
+	 * Write the current positions of the prototypes (row by row, getDimension() values each), their
+	 * norms and their classes to the given arrays, which have room for getPrototypeCount() entries.
+	 * This is the read-only part of the model that is needed to classify. For multi-modal views
+	 * the prototypes are packed as given by setModalities, and if modality_norms is given, the norm
+	 * of every modality is written there as well (getModalities().size() values per prototype).
+	 */
+	void exportPrototypes(ILVQ_TYPE *positions, ILVQ_TYPE *norms, ILVQ_CLASS_REPRESENTATION *classes,
+			ILVQ_TYPE *modality_norms = NULL);
+
+	//! The modalities as set by setModalities, with their offsets, empty for a single metric
+	inline const std::vector<ILVQ_MODALITY> & getModalities() { return modalities; }
+
+	//! The metric used for this model, only change it before adding data
+	inline void setMetric(DistanceMetric metric) { this->metric = metric; }
+
+	inline DistanceMetric getMetric() { return metric; }
+
+	/**
+	 * In lazy mode the small (mu2) updates of the neighbours of a winner are not written to the
+	 * neighbour prototypes. They are stored as (mu, input) pairs, where the input is stored once in
+	 * a log of "window" inputs. The updates are written to the prototype, all at once, the first
+	 * time its position is needed while learning or classifying a single input, when the log is
+	 * full, or on flush(). The batch classification (which can run in several threads), save and
+	 * exportPrototypes calculate the position in a scratch buffer instead. The results are exactly
+	 * the same as without lazy mode. It saves time only if prototypes are not read after every
+	 * input, that is, with the prefilter.
+	 */
+	void setLazy(bool lazy, int window = 16);
+
+	//! Apply all pending lazy updates to the prototypes
+	void flush();
+
+	/**
+	 * Two-stage search for the winners: the prototypes are compared with the input on a random
+	 * projection to "dimension" dimensions first, and only the "shortlist" closest of them are
+	 * compared with the exact metric. The projections of the prototypes are kept up to date while
+	 * learning. A dimension of 0 switches it off. The shortlist needs to contain at least the
+	 * winner and the runner-up. The batch and top-k classification use it as well, with a
+	 * shortlist of at least k. Not available in sparse mode.
+	 */
+	void setPrefilter(int dimension, int shortlist = 16);
+
+	/**
+	 * Hard maximum on the number of prototypes, 0 is unbounded. When a new prototype is needed and
+	 * the budget is full, another one is evicted first, chosen by the policy. The candidates are
+	 * kept in a heap ordered by the policy, so an eviction and a key update cost O(log n). With
+	 * EV_REDUNDANT, a prototype that has a neighbour of the same class within its threshold goes
+	 * first, as that neighbour covers its inputs. The policies that count wins do not consider a
+	 * prototype until the clock of wins advanced by max_prototypes since it was created, the time
+	 * in which every prototype could have won once, so a newcomer is not evicted for having no
+	 * wins yet (unless all prototypes are that young, then the oldest goes). If there are more
+	 * prototypes already, the surplus is evicted right away.
+	 */
+	void setBudget(int max_prototypes, ILVQ_EVICTION policy = EV_LEAST_RECENT);
+
 protected: // everything that is protected can use ILVQ_XSZ_PROTOTYPE instead of ILVQ_PROTOTYPE
+	using ILVQ::distance;
+
+	/**
+	 * The current position of the prototype: the prototype itself, or, if it has pending lazy
+	 * updates, a copy in "scratch" with the updates applied. The norm is set accordingly.
+	 */
+	const ILVQ_PROTOTYPE & position(const ILVQ_XSZ_PROTOTYPE & p, ILVQ_PROTOTYPE & scratch, ILVQ_TYPE & norm);
+
+	//! Distance with the metric of this model, pending lazy updates are written to the prototype first
+	inline ILVQ_TYPE distance(const ILVQ_ASPECT & input, ILVQ_TYPE input_norm, ILVQ_XSZ_PROTOTYPE & p) {
+		flush(p);
+		return distance(input, *p.prototype, metric, input_norm, p.norm);
+	}
+
+	//! Idem, but the model is not changed, pending lazy updates are applied in scratch
+	inline ILVQ_TYPE distance(const ILVQ_ASPECT & input, ILVQ_TYPE input_norm, const ILVQ_XSZ_PROTOTYPE & p,
+			ILVQ_PROTOTYPE & scratch) {
+		if (p.pending.empty()) return distance(input, *p.prototype, metric, input_norm, p.norm);
+		ILVQ_TYPE p_norm;
+		const ILVQ_PROTOTYPE & v = position(p, scratch, p_norm);
+		return distance(input, v, metric, input_norm, p_norm);
+	}
+
+	//! Write pending lazy updates to the prototype
+	inline void flush(ILVQ_XSZ_PROTOTYPE & p) {
+		if (p.pending.empty()) return;
+		position(p, *p.prototype, p.norm);
+		p.pending.clear();
+	}
+
+	/**
+	 * The steps of add() that are the same for every kind of input. Besides the input, each kind
+	 * needs something that is calculated once per input, which is passed to its overloads below
+	 * as "extra": the projection of a dense input, the norm of a sparse input, or the prepared
+	 * modalities of a multi-modal input.
+	 */
+	template <typename INPUT, typename EXTRA>
+	void learn(const INPUT & input, const EXTRA & extra, ILVQ_CLASS_REPRESENTATION & class_rep);
+
 	/**
-	 * Obtain the winner and runner-up given a new input vector.
+	 * Obtain the winner and runner-up given a new input vector and its projection by project()
+	 * (empty if the prefilter is off).
 	 */
-	void getClosePrototypes(const ILVQ_ASPECT & input, ILVQ_XSZ_PROTOTYPE_PAIR & winners);
+	void getClosePrototypes(const ILVQ_ASPECT & input, const std::vector<ILVQ_TYPE> & sketch,
+			ILVQ_XSZ_PROTOTYPE_PAIR & winners, TraceEventType event = TE_WINNERS);
+
+	//! Idem for a sparse input, of which the norm is known (sparse mode)
+	void getClosePrototypes(const ILVQ_SPARSE_ASPECT & input, ILVQ_TYPE input_norm,
+			ILVQ_XSZ_PROTOTYPE_PAIR & winners, TraceEventType event = TE_WINNERS);
+
+	//! Distance between sparse input and prototype (sparse mode)
+	inline ILVQ_TYPE distance(const ILVQ_SPARSE_ASPECT & input, ILVQ_TYPE input_norm, const ILVQ_XSZ_PROTOTYPE & p) {
+		return distance(input, *p.prototype, metric, input_norm, p.norm, p.scale);
+	}
+
+	//! Prepare a multi-modal input for the functions below
+	void prepareView(const ILVQ_VIEW & input, ILVQ_XSZ_VIEW & view);
+
+	//! The view with its absent modalities taken from prototype p
+	void fillView(const ILVQ_XSZ_VIEW & view, const ILVQ_XSZ_PROTOTYPE & p, ILVQ_XSZ_VIEW & out);
+
+	//! Weighted distance over all modalities present in x, with x and w packed as in the prototypes
+	ILVQ_TYPE distance(const ILVQ_TYPE * const * x, const ILVQ_TYPE *x_norms, const ILVQ_TYPE *w,
+			const ILVQ_TYPE *w_norms);
+
+	//! Winner and runner-up for the prepared multi-modal input, over the present modalities (view mode)
+	void getClosePrototypes(const ILVQ_VIEW & input, const ILVQ_XSZ_VIEW & view,
+			ILVQ_XSZ_PROTOTYPE_PAIR & winners, TraceEventType event = TE_WINNERS);
+
+	//! Idem as for a dense input, with the absent modalities taken from the winner (view mode)
+	bool isNewPrototype(const ILVQ_VIEW & input, const ILVQ_XSZ_VIEW & view,
+			ILVQ_CLASS_REPRESENTATION & class_rep, const ILVQ_XSZ_PROTOTYPE_PAIR & winners);
+
+	//! Move the present modalities of prototype and neighbours (view mode)
+	void updatePrototype(ILVQ_XSZ_PROTOTYPE &winner, const ILVQ_VIEW & input, const ILVQ_XSZ_VIEW & view,
+			ILVQ_CLASS_REPRESENTATION & class_rep);
+
+	//! New prototype at the input, with the absent modalities of the winner (view mode)
+	void createPrototype(const ILVQ_VIEW & input, const ILVQ_XSZ_VIEW & view,
+			ILVQ_CLASS_REPRESENTATION & class_rep, const ILVQ_XSZ_PROTOTYPE_PAIR & winners);
+
+	//! New prototype at the input (the projection is not needed)
+	void createPrototype(const ILVQ_ASPECT & input, const std::vector<ILVQ_TYPE> & sketch,
+			ILVQ_CLASS_REPRESENTATION & class_rep, const ILVQ_XSZ_PROTOTYPE_PAIR & winners);
+
+	//! New prototype at a dense copy of the input, which keeps track of its support (sparse mode)
+	void createPrototype(const ILVQ_SPARSE_ASPECT & input, ILVQ_TYPE input_norm,
+			ILVQ_CLASS_REPRESENTATION & class_rep, const ILVQ_XSZ_PROTOTYPE_PAIR & winners);
+
+	//! Random projection of the input to sketch_dimension dimensions
+	void project(const ILVQ_ASPECT & input, std::vector<ILVQ_TYPE> & out);
+
+	//! The projection is linear, so moving a prototype with mu costs only sketch_dimension operations
+	void updateSketch(ILVQ_XSZ_PROTOTYPE &p, const std::vector<ILVQ_TYPE> & sketch, ILVQ_TYPE mu);
+
+	//! Create a new prototype at the position of the input, with the projection of the input (prefilter)
+	ILVQ_XSZ_PROTOTYPE *addPrototype(const ILVQ_ASPECT & input, ILVQ_CLASS_REPRESENTATION & class_rep,
+			const std::vector<ILVQ_TYPE> & sketch = std::vector<ILVQ_TYPE>());
+
+	//! Idem, without setting its threshold (used by addPrototype and load)
+	ILVQ_XSZ_PROTOTYPE *newPrototype(const ILVQ_ASPECT & input, ILVQ_CLASS_REPRESENTATION class_rep,
+			const std::vector<ILVQ_TYPE> & sketch = std::vector<ILVQ_TYPE>());
 
 	/**
-	 * Calculate
+	 * Calculate (the projection is not needed)
 	 */
-	bool isNewPrototype(const ILVQ_ASPECT & input, ILVQ_CLASS_REPRESENTATION & class_rep,
+	bool isNewPrototype(const ILVQ_ASPECT & input, const std::vector<ILVQ_TYPE> & sketch,
+			ILVQ_CLASS_REPRESENTATION & class_rep, const ILVQ_XSZ_PROTOTYPE_PAIR & winners);
+
+	//! Idem for a sparse input (sparse mode)
+	bool isNewPrototype(const ILVQ_SPARSE_ASPECT & input, ILVQ_TYPE input_norm, ILVQ_CLASS_REPRESENTATION & class_rep,
 			const ILVQ_XSZ_PROTOTYPE_PAIR & winners);
 
 	//! Slow searching for class id through prototype set
@@ -102,10 +466,34 @@ protected: // everything that is protected can use ILVQ_XSZ_PROTOTYPE instead of
 	//! Add edge (plus update ages and winner count)
 	void addEdge(ILVQ_XSZ_PROTOTYPE *s1, ILVQ_XSZ_PROTOTYPE *s2);
 
-	//! Move prototype toward or from input
+	//! Distance between the prototypes of an edge, recalculated only if one of them moved
+	ILVQ_TYPE edgeLength(ILVQ_XSZ_CONNECTION & c);
+
+	//! Move prototype toward or from input, its neighbours the other way, all in one pass
 	void updatePrototype(ILVQ_XSZ_PROTOTYPE &winner, const ILVQ_ASPECT & input,
+			const std::vector<ILVQ_TYPE> & sketch, ILVQ_CLASS_REPRESENTATION & class_rep);
+
+	//! Move prototype toward or from sparse input, its neighbours the other way (sparse mode)
+	void updatePrototype(ILVQ_XSZ_PROTOTYPE &winner, const ILVQ_SPARSE_ASPECT & input, ILVQ_TYPE input_norm,
 			ILVQ_CLASS_REPRESENTATION & class_rep);
 
+	/**
+	 * Move a single prototype in sparse mode: only the entries that are non-zero in the input and
+	 * the scale change, and the norm and the dot products of the edges are updated accordingly.
+	 */
+	void adjustSparse(ILVQ_XSZ_PROTOTYPE &p, const ILVQ_SPARSE_ASPECT & input, ILVQ_TYPE mu);
+
+	/**
+	 * Multiply the prototype with its scale, and its norm and dot products accordingly. With
+	 * refresh they are recalculated instead, to get rid of rounding errors. Only the entries in the
+	 * supports are visited (sparse mode).
+	 */
+	void rescale(ILVQ_XSZ_PROTOTYPE &p, bool refresh);
+
+	//! Move prototype toward or from input, only record the move of its neighbours (lazy mode)
+	void updatePrototypeLazy(ILVQ_XSZ_PROTOTYPE &winner, const ILVQ_ASPECT & input, ILVQ_TYPE mu_w,
+			ILVQ_TYPE mu_v);
+
 	//! Dynamic update of learning rates to most recent winner
 	//! I guess it makes only sense to call before updatePrototype
 	void updateLearningRates(ILVQ_XSZ_PROTOTYPE &winner);
@@ -117,13 +505,63 @@ protected: // everything that is protected can use ILVQ_XSZ_PROTOTYPE instead of
 	 */
 	void deleteEdges();
 
-	//! Delete the unconnected and sparse connected
+	/**
+	 * Delete the unconnected and sparse connected. Only the prototypes in the buckets for zero
+	 * and one outgoing connections are visited.
+	 */
 	void deleteNodes();
 
+	/**
+	 * The k nearest prototypes for "count" inputs at once. The prototypes are the outer loop, so
+	 * each prototype is read once per block of inputs. The output arrays are of size count*k. The
+	 * model is only read, so this can be called from several threads at the same time. With the
+	 * prefilter every input gets its own shortlist of at least k prototypes instead.
+	 */
+	void getTopK(const ILVQ_ASPECT * const * inputs, int count, int k, ILVQ_XSZ_PROTOTYPE **out_protos,
+			ILVQ_TYPE *out_dists);
+
+	//! Idem with the prefilter: exact distances to the "candidates" prototypes with the closest sketches
+	void getTopKPrefiltered(const ILVQ_ASPECT * const * inputs, int count, int k, int candidates,
+			ILVQ_XSZ_PROTOTYPE **out_protos, ILVQ_TYPE *out_dists);
+
+	//! Weighted vote given the result of getTopK for a single input
+	ILVQ_CLASS_REPRESENTATION vote(ILVQ_XSZ_PROTOTYPE * const * protos, const ILVQ_TYPE *dists, int k,
+			ILVQ_TYPE *confidence);
+
 protected:
-	//! Delete edges leading to given node (used by deleteNodes)
-	void deleteEdges(ILVQ_XSZ_PROTOTYPE* target);
+	//! Delete node together with its incoming and outgoing edges (used by deleteNodes)
+	void deleteNode(ILVQ_XSZ_PROTOTYPE *p);
+
+	//! Delete all prototypes and connections
+	void clear();
+
+	//! Move prototype to the bucket that matches its number of outgoing connections (or remove it)
+	void updateBucket(ILVQ_XSZ_PROTOTYPE &p, bool remove = false);
+
+	//! Priority of the prototype for eviction under the current policy
+	long budgetKey(const ILVQ_XSZ_PROTOTYPE &p);
+
+	//! Insert the prototype in the eviction heap, or move it after its key changed
+	void budgetUpdate(ILVQ_XSZ_PROTOTYPE &p);
+
+	//! Collect the prototype and its neighbours (incoming and outgoing) in temp_refresh
+	void collectAround(ILVQ_XSZ_PROTOTYPE &p);
+
+	//! Update the keys that depend on the positions and threshold changed by a learning step
+	void budgetRefresh(ILVQ_XSZ_PROTOTYPE &winner);
+
+	//! Remove the prototype from the eviction heap
+	void budgetRemove(ILVQ_XSZ_PROTOTYPE &p);
+
+	//! Restore the heap property from position i on, up or down
+	void budgetSift(int i);
+
+	//! Delete the prototype at the top of the eviction heap
+	void evict();
 private:
+	//! Job for (multi-threaded) batch classification
+	struct TopKJob;
+
 	//! Global variable that removes old edges
 	int ageOld;
 
@@ -136,14 +574,79 @@ private:
 	//! Iterate step index
 	int lambda_i;
 
-	//! Debug setting
-	char debug;
+	//! Distance metric
+	DistanceMetric metric;
+
+	//! Trained with sparse inputs
+	bool sparse;
+
+	//! Modalities of multi-modal input (view mode if not empty)
+	std::vector<ILVQ_MODALITY> modalities;
+
+	//! Prefilter, and its projection matrix (sketch_dimension rows of the input dimension)
+	int sketch_dimension;
+	int shortlist;
+	std::vector<ILVQ_TYPE> projection;
+
+	//! Lazy mode, and the log of inputs that lazy updates refer to (window slots)
+	bool lazy;
+	int lazy_window;
+	int lazy_slot;
+	std::vector<ILVQ_TYPE> lazy_inputs;
+
+	//! Debug setting, a compile-time constant so disabled logging costs nothing
+	static const int debug = ILVQ_LOG_LEVEL;
+
+	//! Index that will be given to the next new prototype
+	ILVQ_PROTOTYPE_INDEX next_index;
 
 	//! Contains all prototypes (G)
 	std::set<ILVQ_XSZ_PROTOTYPE*> prototypes;
 
+	//! Heads of the lists of prototypes with zero and one outgoing connections
+	ILVQ_XSZ_PROTOTYPE *buckets[2];
+
+	//! Sum of winner_count over all prototypes
+	long winner_count_sum;
+
+	//! Prototype budget (0 is unbounded), policy, the heap of candidates, the prototypes in their
+	//! grace period in order of creation and a clock of wins
+	int max_prototypes;
+	ILVQ_EVICTION eviction;
+	std::vector<ILVQ_XSZ_PROTOTYPE*> budget_heap;
+	std::list<ILVQ_XSZ_PROTOTYPE*> budget_young;
+	long budget_clock;
+
 	//! Temporary field, not meant to be accessed directly, just memory allocations
 	ILVQ_XSZ_PROTOTYPE_PAIR temp_winners;
+
+	//! Temporary fields for updatePrototype
+	std::vector<ILVQ_TYPE*> temp_neighbours;
+	std::vector<ILVQ_VEC> temp_scratch;
+	std::vector<ILVQ_TYPE> temp_norms, temp_edges;
+	ILVQ_PROTOTYPE temp_position;
+
+	//! Temporary fields for view mode
+	ILVQ_XSZ_VIEW temp_view, temp_filled_view;
+	std::vector<const ILVQ_TYPE*> temp_edge_view;
+
+	//! Temporary fields for the prefilter
+	std::vector<ILVQ_TYPE> temp_projection;
+	std::vector<std::pair<ILVQ_TYPE,ILVQ_XSZ_PROTOTYPE*> > temp_shortlist;
+
+	//! Temporary fields for sparse mode
+	ILVQ_ASPECT temp_dense;
+	std::vector<ILVQ_TYPE> temp_delta;
+
+	//! Temporary field for deleteNodes
+	std::vector<ILVQ_XSZ_PROTOTYPE*> temp_victims;
+
+	//! Temporary field for budgetRefresh
+	std::vector<ILVQ_XSZ_PROTOTYPE*> temp_refresh;
+
+	//! Temporary fields for the single-input classifyTopK and classifyKNN
+	std::vector<ILVQ_XSZ_PROTOTYPE*> temp_topk_protos;
+	std::vector<ILVQ_TYPE> temp_topk_dists;
 };
 
 }
@@ -0,0 +1,294 @@
+/**
+ * @brief Vectorized inner loops
+ * @file Kernels.h
+ *
+ * This file is created at Almende B.V. It is open-source software and part of the Common
+ * Hybrid Agent Platform (CHAP). A toolbox with a lot of open-source tools, ranging from
+ * thread pools and TCP/IP components to control architectures and learning algorithms.
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless,
+ * we personally strongly object against this software used by the military, in the
+ * bio-industry, for animal experimentation, or anything that violates the Universal
+ * Declaration of Human Rights.
+ *
+ * Copyright © 2012 Anne van Rossum <anne@almende.com>
+ *
+ * @author     Anne C. van Rossum
+ * @date       Apr 22, 2012
+ * @project    Replicator FP7
+ * @company    Almende B.V.
+ * @case       Machine learning (fit for Surveyeor robots)
+ */
+
+
+#ifndef KERNELS_H_
+#define KERNELS_H_
+
+#include <ilvq/defs.h>
+
+#include <stdint.h>
+#include <string.h>
+
+/**
+ * The kernels use the vector extensions of gcc instead of intrinsics. On x86 this becomes SSE, on
+ * ARM NEON, and on targets without SIMD unit (e.g. blackfin) gcc splits them
+ * into scalar code, so the cross-compiled builds keep working. The vectors are 16 bytes, which is
+ * the width every SIMD unit we use has (and does not depend on AVX for its calling convention).
+ */
+namespace dobots {
+
+//! Vector of 16 bytes (4 floats)
+typedef ILVQ_TYPE ILVQ_VEC __attribute__ ((vector_size (16)));
+
+//! Number of ILVQ_TYPE values in one ILVQ_VEC
+const int ILVQ_LANES = sizeof(ILVQ_VEC) / sizeof(ILVQ_TYPE);
+
+//! Unaligned load (std::vector gives no alignment guarantees)
+inline ILVQ_VEC vec_load(const ILVQ_TYPE *p) {
+	ILVQ_VEC v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+//! Unaligned store
+inline void vec_store(ILVQ_TYPE *p, ILVQ_VEC v) {
+	memcpy(p, &v, sizeof(v));
+}
+
+inline ILVQ_VEC vec_set(ILVQ_TYPE a) {
+	ILVQ_VEC v = { 0 };
+	return v + a;
+}
+
+inline ILVQ_TYPE vec_sum(ILVQ_VEC v) {
+	ILVQ_TYPE sum = 0;
+	for (int i = 0; i < ILVQ_LANES; ++i) sum += v[i];
+	return sum;
+}
+
+/**
+ * Sum_i (x_i - w_i)^2, with two independent accumulators to hide the latency of the additions.
+ */
+inline ILVQ_TYPE squared_euclidean(const ILVQ_TYPE *x, const ILVQ_TYPE *w, int n) {
+	ILVQ_VEC acc0 = vec_set(0), acc1 = vec_set(0);
+	int i = 0;
+	for (; i + 2*ILVQ_LANES <= n; i += 2*ILVQ_LANES) {
+		ILVQ_VEC d0 = vec_load(x+i) - vec_load(w+i);
+		ILVQ_VEC d1 = vec_load(x+i+ILVQ_LANES) - vec_load(w+i+ILVQ_LANES);
+		acc0 += d0 * d0;
+		acc1 += d1 * d1;
+	}
+	ILVQ_TYPE sum = vec_sum(acc0 + acc1);
+	for (; i < n; ++i) sum += (x[i] - w[i]) * (x[i] - w[i]);
+	return sum;
+}
+
+/**
+ * Sum_i x_i * w_i
+ */
+inline ILVQ_TYPE dot_product(const ILVQ_TYPE *x, const ILVQ_TYPE *w, int n) {
+	ILVQ_VEC acc0 = vec_set(0), acc1 = vec_set(0);
+	int i = 0;
+	for (; i + 2*ILVQ_LANES <= n; i += 2*ILVQ_LANES) {
+		acc0 += vec_load(x+i) * vec_load(w+i);
+		acc1 += vec_load(x+i+ILVQ_LANES) * vec_load(w+i+ILVQ_LANES);
+	}
+	ILVQ_TYPE sum = vec_sum(acc0 + acc1);
+	for (; i < n; ++i) sum += x[i] * w[i];
+	return sum;
+}
+
+/**
+ * Sum_k value_k * w_{index_k}, the dot product of a sparse vector of nnz index/value pairs with a
+ * dense vector. The loads of w are scattered, so there are no vector instructions, but there are
+ * two accumulators to keep the additions independent.
+ */
+inline ILVQ_TYPE sparse_dot(const int *index, const ILVQ_TYPE *value, int nnz, const ILVQ_TYPE *w) {
+	ILVQ_TYPE acc0 = 0, acc1 = 0;
+	int k = 0;
+	for (; k + 2 <= nnz; k += 2) {
+		acc0 += value[k] * w[index[k]];
+		acc1 += value[k+1] * w[index[k+1]];
+	}
+	if (k < nnz) acc0 += value[k] * w[index[k]];
+	return acc0 + acc1;
+}
+
+/**
+ * Sum_i |x_i - w_i|
+ */
+inline ILVQ_TYPE manhattan(const ILVQ_TYPE *x, const ILVQ_TYPE *w, int n) {
+	ILVQ_VEC acc0 = vec_set(0), acc1 = vec_set(0);
+	int i = 0;
+	for (; i + 2*ILVQ_LANES <= n; i += 2*ILVQ_LANES) {
+		ILVQ_VEC d0 = vec_load(x+i) - vec_load(w+i);
+		ILVQ_VEC d1 = vec_load(x+i+ILVQ_LANES) - vec_load(w+i+ILVQ_LANES);
+		acc0 += (d0 < 0) ? -d0 : d0;
+		acc1 += (d1 < 0) ? -d1 : d1;
+	}
+	ILVQ_TYPE sum = vec_sum(acc0 + acc1);
+	for (; i < n; ++i) sum += (x[i] < w[i]) ? w[i] - x[i] : x[i] - w[i];
+	return sum;
+}
+
+/**
+ * Move w from (mu > 0) or towards (mu < 0) x: w_i = w_i + mu (w_i - x_i). Returns the squared norm
+ * of the new w, which comes for free because every w_i is in a register anyway. The sum is done
+ * in the same order as in dot_product(w, w), so the result is exactly the same.
+ */
+inline ILVQ_TYPE adjust(ILVQ_TYPE *w, const ILVQ_TYPE *x, ILVQ_TYPE mu, int n) {
+	ILVQ_VEC acc[2] = { vec_set(0), vec_set(0) };
+	int i = 0;
+	for (; i + 2*ILVQ_LANES <= n; i += 2*ILVQ_LANES) {
+		for (int h = 0; h < 2; ++h) {
+			ILVQ_VEC wi = vec_load(w+i+h*ILVQ_LANES);
+			wi += (wi - vec_load(x+i+h*ILVQ_LANES)) * mu;
+			vec_store(w+i+h*ILVQ_LANES, wi);
+			acc[h] += wi * wi;
+		}
+	}
+	ILVQ_TYPE sum = vec_sum(acc[0] + acc[1]);
+	for (; i < n; ++i) {
+		w[i] += (w[i] - x[i]) * mu;
+		sum += w[i] * w[i];
+	}
+	return sum;
+}
+
+/**
+ * Apply a series of adjustments v = v + mu_k (v - x_k), k = 0..count-1, in that order, and write
+ * the result to out (which may be v itself). This is done chunk by chunk, so v is read once and
+ * written once, and the result is exactly the same as calling adjust count times.
+ */
+inline void adjust_series(const ILVQ_TYPE *v, ILVQ_TYPE *out, const ILVQ_TYPE * const *x, const ILVQ_TYPE *mu,
+		int count, int n) {
+	int i = 0;
+	for (; i + ILVQ_LANES <= n; i += ILVQ_LANES) {
+		ILVQ_VEC vi = vec_load(v+i);
+		for (int k = 0; k < count; ++k) {
+			vi += (vi - vec_load(x[k]+i)) * mu[k];
+		}
+		vec_store(out+i, vi);
+	}
+	for (; i < n; ++i) {
+		ILVQ_TYPE vi = v[i];
+		for (int k = 0; k < count; ++k) {
+			vi += (vi - x[k][i]) * mu[k];
+		}
+		out[i] = vi;
+	}
+}
+
+//! What adjust_fused accumulates for the edge between winner and neighbour
+enum EdgeMeasure { EM_SQUARED, EM_ABSOLUTE, EM_DOT };
+
+/**
+ * Fused version of adjust for a winner and its neighbours: w = w + mu_w (w - x) and for every
+ * neighbour v_j = v_j + mu_v (v_j - x). Every chunk of x is loaded once and used for all of
+ * them. In the same pass the squared norms of the new vectors are calculated, as well as for each
+ * neighbour the sum over (w_i-v_i)^2, |w_i-v_i| or w_i*v_i (depending on the measure), which
+ * is what is needed to calculate the length of the edge between them. All sums are done in the
+ * same order as in the distance kernels, so the results are exactly equal to recalculating them.
+ * @param scratch		room for 4*count vectors
+ */
+template <EdgeMeasure measure>
+void adjust_fused(ILVQ_TYPE *w, ILVQ_TYPE mu_w, ILVQ_TYPE * const *v, int count, ILVQ_TYPE mu_v,
+		const ILVQ_TYPE *x, int n, ILVQ_VEC *scratch, ILVQ_TYPE & w_norm2, ILVQ_TYPE *v_norm2, ILVQ_TYPE *edge) {
+	ILVQ_VEC *v_acc = scratch, *e_acc = scratch + 2*count;
+	ILVQ_VEC w_acc[2] = { vec_set(0), vec_set(0) };
+	for (int j = 0; j < 2*count; ++j) v_acc[j] = e_acc[j] = vec_set(0);
+	int i = 0;
+	for (; i + 2*ILVQ_LANES <= n; i += 2*ILVQ_LANES) {
+		for (int h = 0; h < 2; ++h) {
+			const int o = i + h*ILVQ_LANES;
+			ILVQ_VEC xi = vec_load(x+o);
+			ILVQ_VEC wi = vec_load(w+o);
+			wi += (wi - xi) * mu_w;
+			vec_store(w+o, wi);
+			w_acc[h] += wi * wi;
+			for (int j = 0; j < count; ++j) {
+				ILVQ_VEC vi = vec_load(v[j]+o);
+				vi += (vi - xi) * mu_v;
+				vec_store(v[j]+o, vi);
+				v_acc[2*j+h] += vi * vi;
+				ILVQ_VEC d = wi - vi;
+				switch (measure) {
+				case EM_SQUARED: e_acc[2*j+h] += d * d; break;
+				case EM_ABSOLUTE: e_acc[2*j+h] += (d < 0) ? -d : d; break;
+				case EM_DOT: e_acc[2*j+h] += wi * vi; break;
+				}
+			}
+		}
+	}
+	w_norm2 = vec_sum(w_acc[0] + w_acc[1]);
+	for (int j = 0; j < count; ++j) {
+		v_norm2[j] = vec_sum(v_acc[2*j] + v_acc[2*j+1]);
+		edge[j] = vec_sum(e_acc[2*j] + e_acc[2*j+1]);
+	}
+	for (; i < n; ++i) {
+		ILVQ_TYPE wi = w[i] + (w[i] - x[i]) * mu_w;
+		w[i] = wi;
+		w_norm2 += wi * wi;
+		for (int j = 0; j < count; ++j) {
+			ILVQ_TYPE vi = v[j][i] + (v[j][i] - x[i]) * mu_v;
+			v[j][i] = vi;
+			v_norm2[j] += vi * vi;
+			ILVQ_TYPE d = wi - vi;
+			switch (measure) {
+			case EM_SQUARED: edge[j] += d * d; break;
+			case EM_ABSOLUTE: edge[j] += (d < 0) ? -d : d; break;
+			case EM_DOT: edge[j] += wi * vi; break;
+			}
+		}
+	}
+}
+
+typedef float v4sf __attribute__ ((vector_size (16)));
+typedef int32_t v4si __attribute__ ((vector_size (16)));
+
+/**
+ * Approximation of exp(x) for 4 floats at once: 2^(x log2 e) is split in an integer part, that goes
+ * into the exponent bits, and a fraction, for which a 5th order polynomial is used. The relative
+ * error is below 1e-5 and inputs are clamped to [-87,88] (so exp(-100) gives 1e-38 instead of 0).
+ */
+inline v4sf fast_exp(v4sf x) {
+	const v4sf lo = { -87.f, -87.f, -87.f, -87.f };
+	const v4sf hi = { 88.f, 88.f, 88.f, 88.f };
+	x = (x < lo) ? lo : x;
+	x = (x > hi) ? hi : x;
+	v4sf t = x * 1.44269504f;
+	v4si i = __builtin_convertvector(t, v4si);
+	v4sf fi = __builtin_convertvector(i, v4sf);
+	// convert truncates towards zero, we need floor
+	i += (v4si)(fi > t);
+	fi = __builtin_convertvector(i, v4sf);
+	v4sf f = t - fi;
+	v4sf p = f * 1.33335581e-3f + 9.61812910e-3f;
+	p = p * f + 5.55041087e-2f;
+	p = p * f + 2.40226507e-1f;
+	p = p * f + 6.93147182e-1f;
+	p = p * f + 1.0f;
+	return (v4sf)((v4si)p + (i << 23));
+}
+
+//! Exponential of an array (in and out may be the same array)
+inline void fast_exp(const float *in, float *out, int n) {
+	int i = 0;
+	for (; i + 4 <= n; i += 4) {
+		v4sf x;
+		memcpy(&x, in+i, sizeof(x));
+		x = fast_exp(x);
+		memcpy(out+i, &x, sizeof(x));
+	}
+	if (i < n) {
+		v4sf x = { 0 };
+		memcpy(&x, in+i, (n-i)*sizeof(float));
+		x = fast_exp(x);
+		memcpy(out+i, &x, (n-i)*sizeof(float));
+	}
+}
+
+}
+
+#endif /* KERNELS_H_ */
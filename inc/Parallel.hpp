@@ -0,0 +1,87 @@
+/**
+ * @brief Minimal parallel-for on top of POSIX threads
+ * @file Parallel.hpp
+ *
+ * This file is created at Almende B.V. It is open-source software and part of the Common
+ * Hybrid Agent Platform (CHAP). A toolbox with a lot of open-source tools, ranging from
+ * thread pools and TCP/IP components to control architectures and learning algorithms.
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless,
+ * we personally strongly object against this software used by the military, in the
+ * bio-industry, for animal experimentation, or anything that violates the Universal
+ * Declaration of Human Rights.
+ *
+ * Copyright © 2012 Anne van Rossum <anne@almende.com>
+ *
+ * @author     Anne C. van Rossum
+ * @date       Apr 22, 2012
+ * @project    Replicator FP7
+ * @company    Almende B.V.
+ * @case       Machine learning (fit for Surveyeor robots)
+ */
+
+
+#ifndef PARALLEL_HPP_
+#define PARALLEL_HPP_
+
+#include <pthread.h>
+#include <unistd.h>
+#include <vector>
+
+namespace dobots {
+
+//! Number of online processors, at least 1
+inline int hardware_threads() {
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+	return (n < 1) ? 1 : (int)n;
+}
+
+template <typename F>
+struct parallel_range {
+	F *f;
+	int begin;
+	int end;
+	int thread;
+};
+
+template <typename F>
+void *parallel_trampoline(void *arg) {
+	parallel_range<F> *r = (parallel_range<F>*)arg;
+	(*r->f)(r->begin, r->end, r->thread);
+	return NULL;
+}
+
+/**
+ * Split the range [0,n) in "threads" contiguous parts and call f(begin, end, thread) for each
+ * of them. The calling thread handles the first part itself. With threads <= 0 the number of
+ * processors is used. The functor has to take care of its own synchronisation.
+ */
+template <typename F>
+void parallel_for(int n, int threads, F & f) {
+	if (threads <= 0) threads = hardware_threads();
+	if (threads > n) threads = n;
+	if (threads <= 1) {
+		if (n > 0) f(0, n, 0);
+		return;
+	}
+	std::vector<parallel_range<F> > ranges(threads);
+	std::vector<pthread_t> ids(threads);
+	for (int t = 0; t < threads; ++t) {
+		ranges[t].f = &f;
+		ranges[t].begin = (int)(((long long)n * t) / threads);
+		ranges[t].end = (int)(((long long)n * (t + 1)) / threads);
+		ranges[t].thread = t;
+	}
+	for (int t = 1; t < threads; ++t) {
+		pthread_create(&ids[t], NULL, parallel_trampoline<F>, &ranges[t]);
+	}
+	f(ranges[0].begin, ranges[0].end, 0);
+	for (int t = 1; t < threads; ++t) {
+		pthread_join(ids[t], NULL);
+	}
+}
+
+}
+
+#endif /* PARALLEL_HPP_ */
@@ -42,6 +42,9 @@ enum OutputType { PLPLOT, PPM };
 
 enum PlotType { PT_DEFAULT, PT_DENSITY, PT_CUMULATIVE_DENSITY };
 
+//! How long series are reduced before drawing, see Downsample.hpp
+enum PlotSampling { PS_NONE, PS_MINMAX, PS_LTTB };
+
 struct PLData {
 	PLFLT *x_axis;
 	PLFLT *y_axis;
@@ -88,6 +91,9 @@ public:
 	//! Get the data
 	DataContainer & GetData(int id = -1);
 
+	//! Downsampling of long series, columns <= 0 takes one column per pixel of the plot area
+	inline void SetSampling(PlotSampling ps, int columns = 0) { sampling = ps; sample_columns = columns; }
+
 	//! Set filename (use also SetPath)
 	void SetFileName(std::string filename, OutputType outputType);
 
@@ -111,8 +117,11 @@ protected:
 	//! Scale depending on the mode
 	PLFLT Scale(const PLFLT input, bool x_axis=true);
 
-	//! Get data from container into arrays
-	void GetData(DataContainer &cont, PLData & pld);
+	//! Get data from container into arrays, downsampled to the given number of columns
+	void GetData(DataContainer &cont, PLData & pld, int columns = 0);
+
+	//! Points of a container, read in place and scaled on the fly
+	struct Series;
 
 private:
 	//! Multiple data containers
@@ -127,6 +136,12 @@ private:
 	//! Plot type
 	PlotType plot_type;
 
+	//! Downsampling of long series
+	PlotSampling sampling;
+
+	//! Columns to downsample to (<= 0 is the width of the plot area)
+	int sample_columns;
+
 	//! File name for .ppm file
 	std::string ppm_file;
 
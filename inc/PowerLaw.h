@@ -0,0 +1,91 @@
+/**
+ * @brief Maximum likelihood estimation of power laws with a scan over x_min
+ * @file PowerLaw.h
+ *
+ * This file is created at Almende B.V. It is open-source software and part of the Common
+ * Hybrid Agent Platform (CHAP). A toolbox with a lot of open-source tools, ranging from
+ * thread pools and TCP/IP components to control architectures and learning algorithms.
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless,
+ * we personally strongly object against this software used by the military, in the
+ * bio-industry, for animal experimentation, or anything that violates the Universal
+ * Declaration of Human Rights.
+ *
+ * Copyright © 2012 Anne van Rossum <anne@almende.com>
+ *
+ * @author     Anne C. van Rossum
+ * @date       Apr 22, 2012
+ * @project    Replicator FP7
+ * @company    Almende B.V.
+ * @case       Machine learning (fit for Surveyeor robots)
+ */
+
+
+
+#ifndef POWERLAW_H_
+#define POWERLAW_H_
+
+#include <map>
+#include <vector>
+
+namespace dobots {
+
+struct PowerLawFit {
+	double alpha; // exponent, the density goes as x^-alpha
+	double x_min; // start of the tail that follows the power law
+	double ks; // Kolmogorov-Smirnov distance between the tail and the fitted power law
+	long n; // number of events in the tail
+};
+
+/**
+ * Estimates the exponent of a power law tail, following Clauset, Shalizi and Newman, Power-law
+ * Distributions in Empirical Data (2009). For a given x_min the maximum likelihood estimate is
+ *   alpha = 1 + n [ sum_i ln (x_i / (x_min - 1/2)) ]^-1
+ * over the n events with x_i >= x_min (discrete, without the 1/2 for continuous data). The sums
+ * for the current x_min are updated with every event, so getAlpha is O(1).
+ *
+ * fit chooses x_min as the candidate with the smallest KS distance between the tail and its fitted
+ * power law. With suffix sums of the counts and of the logarithms over the sorted values, the
+ * estimate for a candidate is O(1) and its KS distance a pass over the tail. The candidates are
+ * divided over threads.
+ */
+class PowerLawEstimator {
+public:
+	PowerLawEstimator(double x_min = 1, bool discrete = true);
+
+	//! Add "count" events with value x
+	void addEvent(double x, long count = 1);
+
+	//! Exponent for the current x_min, 0 if there are no events in the tail
+	double getAlpha() const;
+
+	//! Scan at most max_candidates values of x_min with a tail of at least min_tail events, sets x_min
+	PowerLawFit fit(int threads = 0, int max_candidates = 1000, long min_tail = 10);
+
+	//! Use the given x_min from now on
+	void setXMin(double x_min);
+
+	inline double getXMin() const { return x_min; }
+
+	inline long getTail() const { return tail_n; }
+
+	inline long getCount() const { return total_n; }
+
+	inline void clear() { counts.clear(); total_n = tail_n = 0; tail_log = 0; }
+private:
+	double x_min;
+
+	bool discrete;
+
+	//! Events per value, sorted
+	std::map<double,long> counts;
+
+	//! Number of events, number in the tail and sum of their ln x
+	long total_n, tail_n;
+	double tail_log;
+};
+
+}
+
+#endif /* POWERLAW_H_ */
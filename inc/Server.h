@@ -0,0 +1,144 @@
+/**
+ * @brief Local classification server over a Unix domain socket
+ * @file Server.h
+ *
+ * This file is created at Almende B.V. It is open-source software and part of the Common
+ * Hybrid Agent Platform (CHAP). A toolbox with a lot of open-source tools, ranging from
+ * thread pools and TCP/IP components to control architectures and learning algorithms.
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless,
+ * we personally strongly object against this software used by the military, in the
+ * bio-industry, for animal experimentation, or anything that violates the Universal
+ * Declaration of Human Rights.
+ *
+ * Copyright © 2012 Anne van Rossum <anne@almende.com>
+ *
+ * @author     Anne C. van Rossum
+ * @date       Apr 22, 2012
+ * @project    Replicator FP7
+ * @company    Almende B.V.
+ * @case       Machine learning (fit for Surveyeor robots)
+ */
+
+#ifndef SERVER_H_
+#define SERVER_H_
+
+#include <ilvq/ILVQ_XSZ.h>
+
+#include <pthread.h>
+#include <stdint.h>
+#include <deque>
+#include <set>
+
+namespace dobots {
+
+/**
+ * The protocol is binary, in host byte order (the socket is local anyway). A client sends a
+ * ServerRequest, followed by "dimension" floats for SR_CLASSIFY and SR_TOPK. The server answers
+ * every request with a ServerResponse with the same id, followed by "count" ServerResults.
+ * Requests on one connection may be answered out of order. SR_INFO returns no results, only the
+ * dimension of the model.
+ */
+enum ServerRequestType { SR_INFO, SR_CLASSIFY, SR_TOPK, SR_TYPES };
+
+enum ServerStatus { SS_OK = 0, SS_BAD_REQUEST = -1 };
+
+struct ServerRequest {
+	uint32_t type;
+	uint32_t id;
+	uint32_t k; // number of results for SR_TOPK, at most SERVER_MAX_K
+	uint32_t dimension;
+};
+
+struct ServerResponse {
+	uint32_t id;
+	int32_t status;
+	uint32_t count;
+	uint32_t dimension; // of the model
+};
+
+struct ServerResult {
+	int32_t class_id;
+	float distance;
+};
+
+//! Largest k of a top-k request
+#define SERVER_MAX_K 64
+
+//! Largest dimension that is read from a request, larger ones close the connection
+#define SERVER_MAX_DIMENSION (1 << 20)
+
+struct ServerConfig {
+	int workers; // threads that classify
+	int max_batch; // maximum number of requests in a micro-batch
+	int window_us; // how long a worker waits for a micro-batch to fill
+	int max_queue; // maximum number of waiting requests, after that connections are not read
+	int max_connections; // maximum number of connections (and reader threads), others wait to be accepted
+};
+
+struct ServerConnection;
+struct ServerJob;
+
+/**
+ * Every connection has a thread that reads requests and puts them in a queue. The number of
+ * connections is bounded: while it is at the maximum, new ones wait in the backlog of the
+ * listening socket until another connection is closed. Worker threads
+ * take micro-batches from that queue: as soon as a request arrives a worker waits at most the
+ * batching window for more, then classifies them all in one go with the batched (top-k) path of
+ * the model. The queue is bounded: if it is full the readers stop reading, so clients that send
+ * too much are slowed down by their socket buffers (back-pressure). The model is only read, it is
+ * not trained while serving.
+ */
+class ClassifyServer {
+public:
+	ClassifyServer(ILVQ_XSZ & model, const ServerConfig & config);
+
+	~ClassifyServer();
+
+	//! Listen at the given path and serve until stop(), false if it can not listen
+	bool run(const char *path);
+
+	//! Stop serving, can be called from a signal handler
+	void stop();
+
+	//! Thread functions, not to be called directly
+	void read(ServerConnection *c);
+	void work();
+protected:
+	//! Send a response, serialized with other responses on the same connection
+	void respond(ServerConnection *c, const ServerResponse & response, const ServerResult *results);
+
+	//! Request has been answered, the last one lets a closing connection go
+	void done(ServerConnection *c);
+
+	//! Classify a micro-batch and answer all requests in it
+	void process(std::vector<ServerJob*> & jobs);
+private:
+	ILVQ_XSZ & model;
+
+	ServerConfig config;
+
+	int dimension;
+
+	int stopping;
+
+	//! Queue of requests and the connections, protected by the lock
+	pthread_mutex_t lock;
+	pthread_cond_t not_empty, not_full, no_connections, fewer_connections;
+	std::deque<ServerJob*> queue;
+	std::set<ServerConnection*> connections;
+};
+
+//! Read exactly n bytes, false on error or end of file
+bool read_fully(int fd, void *buf, size_t n);
+
+//! Write exactly n bytes, false on error
+bool write_fully(int fd, const void *buf, size_t n);
+
+//! Monotonic time in microseconds
+int64_t now_us();
+
+}
+
+#endif /* SERVER_H_ */
@@ -0,0 +1,320 @@
+/**
+ * @brief Event counter that many threads can add to at the same time
+ * @file ShardedEventCounter.hpp
+ *
+ * This file is created at Almende B.V. It is open-source software and part of the Common
+ * Hybrid Agent Platform (CHAP). A toolbox with a lot of open-source tools, ranging from
+ * thread pools and TCP/IP components to control architectures and learning algorithms.
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless,
+ * we personally strongly object against this software used by the military, in the
+ * bio-industry, for animal experimentation, or anything that violates the Universal
+ * Declaration of Human Rights.
+ *
+ * Copyright © 2012 Anne van Rossum <anne@almende.com>
+ *
+ * @author     Anne C. van Rossum
+ * @date       Apr 22, 2012
+ * @project    Replicator FP7
+ * @company    Almende B.V.
+ * @case       Machine learning (fit for Surveyeor robots)
+ */
+
+
+
+#ifndef SHARDEDEVENTCOUNTER_HPP_
+#define SHARDEDEVENTCOUNTER_HPP_
+
+#include <ilvq/EventCounter.hpp>
+
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+#include <errno.h>
+#include <map>
+#include <vector>
+
+/**
+ * Counts events of a given type from many threads. Every thread gets a shard of its own on its
+ * first event: a dense array for the types [0,dense_size) and an open addressing hash table for
+ * the rest. Only the owning thread writes a shard, so an event is a plain (relaxed atomic) store
+ * without a lock or a read-modify-write instruction, and there is no cache line that is written
+ * by two threads.
+ *
+ * Readers merge the shards while the threads go on counting (merge-on-read), the result is a
+ * consistent count for every type, but not a snapshot of all of them at one moment. A new slot in
+ * a hash table is published with release semantics after its type is written. If a table grows,
+ * the old one is kept until the counter is deleted, because a reader may still be in it.
+ *
+ * Shards are kept after their thread ends, so no counts are lost, and handed to the next thread
+ * that starts counting. So there are never more shards than threads that counted at the same
+ * time, also if threads are started for every batch (like parallel_for does). Shards of the
+ * calling thread are found with pthread_getspecific, use getShard() in a hot loop to skip that.
+ */
+template <typename T>
+class ShardedEventCounter {
+public:
+	struct Slot {
+		T type;
+		int count;
+		int used;
+	};
+
+	struct Table {
+		uint64_t mask;
+		Slot *slots;
+	};
+
+	class Shard {
+	public:
+		//! Add "freq" events of a given type, only from the thread that owns the shard
+		inline void AddEvent(const T type, int freq = 1) {
+			if (type >= T(0) && type < (T)dense_size) {
+				long index = (long)type;
+				if ((T)index == type) {
+					__atomic_store_n(&dense[index], dense[index] + freq, __ATOMIC_RELAXED);
+					return;
+				}
+			}
+			Slot & s = slot(type);
+			__atomic_store_n(&s.count, s.count + freq, __ATOMIC_RELAXED);
+		}
+	protected:
+		friend class ShardedEventCounter;
+
+		Slot & slot(T type) {
+			Table *t = table;
+			uint64_t i = event_hash(type) & t->mask;
+			for (; t->slots[i].used; i = (i + 1) & t->mask) {
+				if (t->slots[i].type == type) return t->slots[i];
+			}
+			if (2 * (used + 1) > (long)t->mask + 1) {
+				grow();
+				return slot(type);
+			}
+			Slot & s = t->slots[i];
+			s.type = type;
+			s.count = 0;
+			__atomic_store_n(&s.used, 1, __ATOMIC_RELEASE);
+			used++;
+			return s;
+		}
+
+		void grow() {
+			Table *old = table;
+			Table *t = newTable((old->mask + 1) * 2);
+			for (uint64_t j = 0; j <= old->mask; ++j) {
+				if (!old->slots[j].used) continue;
+				uint64_t i = event_hash(old->slots[j].type) & t->mask;
+				while (t->slots[i].used) i = (i + 1) & t->mask;
+				t->slots[i] = old->slots[j];
+			}
+			retired.push_back(old);
+			__atomic_store_n(&table, t, __ATOMIC_RELEASE);
+		}
+
+		int *dense;
+		long dense_size;
+		Table *table;
+		long used;
+		std::vector<Table*> retired;
+		ShardedEventCounter *owner;
+		Shard *next;
+		// keep the next shard off the cache line of this one
+		char padding[64];
+	};
+
+	//! Types in [0,dense_size) are counted in an array per thread, capacity is the initial size of the hash tables
+	ShardedEventCounter(long dense_size = 0, long capacity = 1024): dense_size(dense_size),
+			capacity(16), shards(NULL), flushing(false), flush_ms(0) {
+		while (this->capacity < capacity) this->capacity <<= 1;
+		pthread_key_create(&key, release_shard);
+		pthread_mutex_init(&free_lock, NULL);
+		pthread_mutex_init(&view_lock, NULL);
+		pthread_cond_init(&flush_cond, NULL);
+	}
+
+	~ShardedEventCounter() {
+		StopFlush();
+		pthread_key_delete(key);
+		Shard *s = shards;
+		while (s != NULL) {
+			Shard *next = s->next;
+			for (unsigned int i = 0; i < s->retired.size(); ++i) deleteTable(s->retired[i]);
+			deleteTable(s->table);
+			delete [] s->dense;
+			delete s;
+			s = next;
+		}
+		pthread_cond_destroy(&flush_cond);
+		pthread_mutex_destroy(&view_lock);
+		pthread_mutex_destroy(&free_lock);
+	}
+
+	//! Add "freq" events of a given type from the calling thread
+	inline void AddEvent(const T type, int freq = 1) {
+		getShard()->AddEvent(type, freq);
+	}
+
+	/**
+	 * The shard of the calling thread. On the first call it is one that a thread that ended left
+	 * behind, else one that is created and pushed on the (lock-free) list of shards. That is once
+	 * per thread, so it is not part of the hot path.
+	 */
+	Shard *getShard() {
+		Shard *s = (Shard*)pthread_getspecific(key);
+		if (s != NULL) return s;
+		pthread_mutex_lock(&free_lock);
+		if (!free_shards.empty()) {
+			s = free_shards.back();
+			free_shards.pop_back();
+		}
+		pthread_mutex_unlock(&free_lock);
+		if (s != NULL) {
+			pthread_setspecific(key, s);
+			return s;
+		}
+		s = new Shard();
+		s->owner = this;
+		s->dense_size = dense_size;
+		s->dense = new int[dense_size > 0 ? dense_size : 1]();
+		s->table = newTable(capacity);
+		s->used = 0;
+		s->next = __atomic_load_n(&shards, __ATOMIC_RELAXED);
+		while (!__atomic_compare_exchange_n(&shards, &s->next, s, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+		pthread_setspecific(key, s);
+		return s;
+	}
+
+	//! Add the counts of all shards to "out", while the other threads go on
+	void Merge(EventCounter<T> & out) {
+		for (Shard *s = __atomic_load_n(&shards, __ATOMIC_ACQUIRE); s != NULL; s = s->next) {
+			for (long i = 0; i < s->dense_size; ++i) {
+				int c = __atomic_load_n(&s->dense[i], __ATOMIC_RELAXED);
+				if (c != 0) out.AddEvent((T)i, c);
+			}
+			Table *t = __atomic_load_n(&s->table, __ATOMIC_ACQUIRE);
+			for (uint64_t i = 0; i <= t->mask; ++i) {
+				if (!__atomic_load_n(&t->slots[i].used, __ATOMIC_ACQUIRE)) continue;
+				out.AddEvent(t->slots[i].type, __atomic_load_n(&t->slots[i].count, __ATOMIC_RELAXED));
+			}
+		}
+	}
+
+	//! Merged counts of all shards, sorted on type
+	std::map<T,int> getEvents() {
+		EventCounter<T> merged(EC_HASHED);
+		Merge(merged);
+		return merged.getEvents();
+	}
+
+	//! Number of shards, at most the number of threads that added events at the same time
+	int getShardCount() {
+		int n = 0;
+		for (Shard *s = __atomic_load_n(&shards, __ATOMIC_ACQUIRE); s != NULL; s = s->next) n++;
+		return n;
+	}
+
+	/**
+	 * Merge into a global view every interval_ms in a thread of its own, so readers that are happy
+	 * with a slightly older view (see getView) do not need to go over all shards.
+	 */
+	void StartFlush(int interval_ms) {
+		if (flushing) return;
+		flush_ms = interval_ms;
+		flushing = true;
+		pthread_create(&flusher, NULL, flush_trampoline, this);
+	}
+
+	//! Stop the flushing thread, after a last flush
+	void StopFlush() {
+		if (!flushing) return;
+		pthread_mutex_lock(&view_lock);
+		flushing = false;
+		pthread_cond_signal(&flush_cond);
+		pthread_mutex_unlock(&view_lock);
+		pthread_join(flusher, NULL);
+	}
+
+	//! Merge into the global view now
+	void Flush() {
+		std::map<T,int> events = getEvents();
+		pthread_mutex_lock(&view_lock);
+		view.swap(events);
+		pthread_mutex_unlock(&view_lock);
+	}
+
+	//! The global view of the last flush
+	std::map<T,int> getView() {
+		pthread_mutex_lock(&view_lock);
+		std::map<T,int> result(view);
+		pthread_mutex_unlock(&view_lock);
+		return result;
+	}
+protected:
+	//! Destructor of the key, the shard of a thread that ends goes to the free list with its counts
+	static void release_shard(void *arg) {
+		Shard *s = (Shard*)arg;
+		ShardedEventCounter *c = s->owner;
+		pthread_mutex_lock(&c->free_lock);
+		c->free_shards.push_back(s);
+		pthread_mutex_unlock(&c->free_lock);
+	}
+
+	static void *flush_trampoline(void *arg) {
+		ShardedEventCounter *c = (ShardedEventCounter*)arg;
+		pthread_mutex_lock(&c->view_lock);
+		while (c->flushing) {
+			struct timespec ts;
+			clock_gettime(CLOCK_REALTIME, &ts);
+			ts.tv_sec += c->flush_ms / 1000;
+			ts.tv_nsec += (c->flush_ms % 1000) * 1000000L;
+			if (ts.tv_nsec >= 1000000000L) {
+				ts.tv_sec++;
+				ts.tv_nsec -= 1000000000L;
+			}
+			pthread_cond_timedwait(&c->flush_cond, &c->view_lock, &ts);
+			pthread_mutex_unlock(&c->view_lock);
+			c->Flush();
+			pthread_mutex_lock(&c->view_lock);
+		}
+		pthread_mutex_unlock(&c->view_lock);
+		return NULL;
+	}
+
+	static Table *newTable(long size) {
+		Table *t = new Table();
+		t->mask = size - 1;
+		t->slots = new Slot[size]();
+		return t;
+	}
+
+	static void deleteTable(Table *t) {
+		delete [] t->slots;
+		delete t;
+	}
+private:
+	long dense_size;
+
+	long capacity;
+
+	//! Lock-free list of the shards, only ever pushed to
+	Shard *shards;
+
+	pthread_key_t key;
+
+	//! Shards of threads that ended, the lock also orders their counts before the next owner
+	std::vector<Shard*> free_shards;
+	pthread_mutex_t free_lock;
+
+	//! Global view, its lock also protects the state of the flushing thread
+	std::map<T,int> view;
+	pthread_mutex_t view_lock;
+	pthread_cond_t flush_cond;
+	pthread_t flusher;
+	bool flushing;
+	int flush_ms;
+};
+
+#endif /* SHARDEDEVENTCOUNTER_HPP_ */
@@ -0,0 +1,145 @@
+/**
+ * @brief Read-only snapshots of a model in POSIX shared memory, for many reader processes
+ * @file SharedModel.h
+ *
+ * This file is created at Almende B.V. It is open-source software and part of the Common
+ * Hybrid Agent Platform (CHAP). A toolbox with a lot of open-source tools, ranging from
+ * thread pools and TCP/IP components to control architectures and learning algorithms.
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless,
+ * we personally strongly object against this software used by the military, in the
+ * bio-industry, for animal experimentation, or anything that violates the Universal
+ * Declaration of Human Rights.
+ *
+ * Copyright © 2012 Anne van Rossum <anne@almende.com>
+ *
+ * @author     Anne C. van Rossum
+ * @date       Apr 22, 2012
+ * @project    Replicator FP7
+ * @company    Almende B.V.
+ * @case       Machine learning (fit for Surveyeor robots)
+ */
+
+
+#ifndef SHAREDMODEL_H_
+#define SHAREDMODEL_H_
+
+#include <ilvq/ILVQ_XSZ.h>
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace dobots {
+
+/**
+ * A model is published under a name, for example "/ilvq". The segment with that name only holds
+ * the generation that is current. Every generation is a separate segment, "/ilvq.<generation>",
+ * that is written once and never changed. Publishing writes the new generation completely and then
+ * swaps the current generation atomically, so readers never see a half written model. The segment
+ * of the previous generation is unlinked directly: readers that still have it mapped keep using it,
+ * and the kernel frees it when the last of them unmaps it. So old generations are reclaimed after
+ * their readers release them, also if a reader crashes, without reference counts in shared memory.
+ */
+struct SharedModelControl {
+	char magic[8]; // "ILVQSHM1"
+	uint64_t generation; // current generation, 0 if nothing is published yet
+};
+
+/**
+ * Header of a generation, followed by the modality records (see ILVQ_XSZ_FILE_MODALITY, padded to a
+ * multiple of 8 bytes), positions[prototypes*dimension], norms[prototypes], the norms per modality
+ * [prototypes*modalities] and classes[prototypes].
+ */
+struct SharedModelHeader {
+	char magic[8]; // "ILVQGEN2"
+	uint64_t generation;
+	int32_t dimension;
+	int32_t prototypes;
+	int32_t metric; // used if there are no modalities
+	int32_t modalities; // number of modalities, 0 for one metric over the whole input
+};
+
+/**
+ * Publishes snapshots of a trained model. There should be only one publisher per name. A publisher
+ * that is restarted goes on with the generation that is current, so readers need no restart.
+ */
+class SharedModelWriter {
+public:
+	SharedModelWriter(const std::string & name);
+
+	~SharedModelWriter();
+
+	//! Publish the current state of the model as a new generation, false on failure
+	bool publish(ILVQ_XSZ & model);
+
+	//! Remove the name and the current generation, readers that have it mapped keep it
+	void unpublish();
+
+	inline uint64_t getGeneration() { return generation; }
+private:
+	std::string name;
+
+	SharedModelControl *control;
+
+	uint64_t generation;
+};
+
+/**
+ * Classifies directly from the mapped snapshot, without copying it. The reader sticks to the
+ * generation it has mapped until refresh() is called, so a batch of classifications is done with
+ * one and the same model. refresh() is cheap if there is no new generation: one atomic read.
+ */
+class SharedModelReader {
+public:
+	SharedModelReader(const std::string & name);
+
+	~SharedModelReader();
+
+	//! Map the current generation if it is newer than the mapped one, true if it changed
+	bool refresh();
+
+	//! Class of the closest prototype, -1 if nothing is mapped, the modalities are packed in the input
+	ILVQ_CLASS_REPRESENTATION classify(const ILVQ_ASPECT & input);
+
+	//! The same for a multi-modal view of which modalities can be absent, see ILVQ_XSZ::classify
+	ILVQ_CLASS_REPRESENTATION classify(const ILVQ_VIEW & input);
+
+	inline uint64_t getGeneration() { return (header == NULL) ? 0 : header->generation; }
+
+	inline int getPrototypeCount() { return (header == NULL) ? 0 : header->prototypes; }
+
+	inline int getDimension() { return (header == NULL) ? 0 : header->dimension; }
+protected:
+	//! Unmap the current generation
+	void release();
+
+	//! Class of the closest prototype for the modalities in x (NULL if absent) with their norms
+	ILVQ_CLASS_REPRESENTATION classify(const ILVQ_TYPE * const * x, const ILVQ_TYPE *x_norms);
+private:
+	std::string name;
+
+	SharedModelControl *control;
+
+	const SharedModelHeader *header;
+
+	size_t size;
+
+	const ILVQ_XSZ_FILE_MODALITY *modalities;
+	const ILVQ_TYPE *positions;
+	const ILVQ_TYPE *norms;
+	const ILVQ_TYPE *modality_norms;
+	const ILVQ_CLASS_REPRESENTATION *classes;
+
+	//! Offset of every modality in a prototype
+	std::vector<int> offsets;
+
+	//! Temporary fields for classify
+	std::vector<const ILVQ_TYPE*> temp_x;
+	std::vector<ILVQ_TYPE> temp_norms;
+};
+
+}
+
+#endif /* SHAREDMODEL_H_ */
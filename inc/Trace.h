@@ -0,0 +1,131 @@
+/**
+ * @brief Compile-time log levels and binary event tracing
+ * @file Trace.h
+ *
+ * This file is created at Almende B.V. It is open-source software and part of the Common
+ * Hybrid Agent Platform (CHAP). A toolbox with a lot of open-source tools, ranging from
+ * thread pools and TCP/IP components to control architectures and learning algorithms.
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless,
+ * we personally strongly object against this software used by the military, in the
+ * bio-industry, for animal experimentation, or anything that violates the Universal
+ * Declaration of Human Rights.
+ *
+ * Copyright © 2012 Anne van Rossum <anne@almende.com>
+ *
+ * @author     Anne C. van Rossum
+ * @date       Apr 22, 2012
+ * @project    Replicator FP7
+ * @company    Almende B.V.
+ * @case       Machine learning (fit for Surveyeor robots)
+ */
+
+
+#ifndef TRACE_H_
+#define TRACE_H_
+
+#include <sys/syslog.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/**
+ * The log level is a compile-time constant, so every "if (debug >= LOG_DEBUG)" in the hot
+ * loops is removed by the compiler when it is not needed. Override it with for example
+ * -DILVQ_LOG_LEVEL=LOG_DEBUG in CXXFLAGS (see local.mk).
+ */
+#ifndef ILVQ_LOG_LEVEL
+#define ILVQ_LOG_LEVEL LOG_ERR
+#endif
+
+/**
+ * Binary tracing is switched on with -DILVQ_TRACE. When it is off, the ILVQ_TRACE_EVENT macro
+ * expands to nothing and the arguments are not even evaluated.
+ */
+#ifdef ILVQ_TRACE
+#define ILVQ_TRACE_EVENT(type, id1, id2, class_id, d1, d2) \
+	dobots::Trace::record(type, id1, id2, class_id, d1, d2)
+#else
+#define ILVQ_TRACE_EVENT(type, id1, id2, class_id, d1, d2) ((void)0)
+#endif
+
+namespace dobots {
+
+enum TraceEventType { TE_NONE, TE_WINNERS, TE_CLASSIFY, TE_CREATE, TE_DELETE, TE_EVICT, TE_TYPES };
+
+/**
+ * A fixed-size (32 bytes) binary event. The meaning of the fields depends on the type:
+ *   TE_WINNERS:	id1=winner, id2=runner-up, d1/d2 their distances (training)
+ *   TE_CLASSIFY:	id1=winner, id2=runner-up, d1/d2 their distances (classification)
+ *   TE_CREATE:		id1=new prototype
+ *   TE_DELETE:		id1=removed prototype, id2=number of outgoing connections
+ *   TE_EVICT:		id1=evicted prototype (prototype budget), id2=eviction policy
+ * An id of -1 means "no prototype".
+ */
+struct TraceEvent {
+	uint64_t timestamp; // nanoseconds, CLOCK_MONOTONIC
+	uint16_t type;
+	uint16_t thread;
+	int32_t id1;
+	int32_t id2;
+	int32_t class_id;
+	float d1;
+	float d2;
+};
+
+//! The file header written by Trace::dump, so the decoder can check what it reads
+struct TraceFileHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t event_size;
+};
+
+/**
+ * Single-producer single-consumer ring. The owning thread is the only writer of "head", the
+ * thread that drains the ring (Trace::dump) is the only writer of "tail". There are no locks,
+ * and the producer never waits: if the ring is full the event is counted as dropped.
+ */
+struct TraceRing {
+	TraceEvent *events;
+	uint32_t mask;
+	uint32_t thread;
+	uint64_t head;
+	uint64_t tail;
+	uint64_t dropped;
+	TraceRing *next;
+};
+
+/**
+ * Every thread that records events gets its own ring buffer, allocated the first time it records
+ * something. The rings are kept in a list so they can be drained to a file by any thread.
+ */
+class Trace {
+public:
+	//! Set capacity of rings allocated from now on (rounded to power of two)
+	static void setCapacity(uint32_t events);
+
+	//! Record an event in the ring buffer of the calling thread
+	static void record(uint16_t type, int32_t id1, int32_t id2, int32_t class_id, float d1, float d2);
+
+	//! Write all pending events of all threads to the given file, returns number of events written
+	static uint64_t dump(FILE *file);
+
+	//! Number of events that have been dropped because a ring was full
+	static uint64_t dropped();
+
+	//! Human-readable name of event type (used by the decoder)
+	static const char *name(uint16_t type);
+
+	//! Read the header of a trace file, returns false on mismatch
+	static bool readHeader(FILE *file);
+private:
+	static TraceRing *ring();
+
+	static TraceRing *rings;
+
+	static uint32_t capacity;
+};
+
+}
+
+#endif /* TRACE_H_ */
@@ -0,0 +1,186 @@
+/**
+ * @brief Write-ahead log of training operations, for recovery after a crash
+ * @file WriteAheadLog.h
+ *
+ * This file is created at Almende B.V. It is open-source software and part of the Common
+ * Hybrid Agent Platform (CHAP). A toolbox with a lot of open-source tools, ranging from
+ * thread pools and TCP/IP components to control architectures and learning algorithms.
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless,
+ * we personally strongly object against this software used by the military, in the
+ * bio-industry, for animal experimentation, or anything that violates the Universal
+ * Declaration of Human Rights.
+ *
+ * Copyright © 2012 Anne van Rossum <anne@almende.com>
+ *
+ * @author     Anne C. van Rossum
+ * @date       Apr 22, 2012
+ * @project    Replicator FP7
+ * @company    Almende B.V.
+ * @case       Machine learning (fit for Surveyeor robots)
+ */
+
+
+#ifndef WRITEAHEADLOG_H_
+#define WRITEAHEADLOG_H_
+
+#include <ilvq/ILVQ_XSZ.h>
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <string>
+#include <vector>
+
+namespace dobots {
+
+/**
+ * Both the log (<path>.log) and the snapshot (<path>.snapshot) start with this header. Every
+ * compaction increases the epoch. The log is only replayed on top of a snapshot of the same epoch,
+ * so a crash in the middle of a compaction never applies records twice.
+ */
+struct WalHeader {
+	char magic[8]; // "ILVQWAL1" for the log, "ILVQSNP1" for the snapshot
+	uint64_t epoch;
+};
+
+//! A record in the log, followed by "dimension" values of the input
+struct WalRecord {
+	uint32_t dimension;
+	int32_t class_id;
+	uint32_t checksum; // crc32 over dimension, class_id and the values
+};
+
+struct WalConfig {
+	int group; // records that are collected before they are written to the log in one go
+	int sync_every; // records after which the log is synced to disk, 0 is never (left to the OS)
+	int sync_ms; // maximum time in ms between syncs while adding, 0 is no limit
+	int compact_every; // records in the log after which it is compacted into a snapshot, 0 is never
+	bool background; // compact with compactBackground() instead of compact()
+};
+
+enum WalSnapshotState { WS_NONE, WS_RUNNING, WS_DONE, WS_FAILED };
+
+//! Shared between the process and the child that writes a background snapshot
+struct WalProgress {
+	size_t written;
+	size_t total;
+};
+
+/**
+ * Makes an ILVQ_XSZ model durable. Every add() is appended to the log before the model learns from
+ * it. Records are written in groups and synced to disk in batches (group commit): at most the
+ * records since the last sync are lost in a crash of the machine, and at most the records since the
+ * last write in a crash of the process. Compaction writes a snapshot of the model and starts an
+ * empty log, so recovery loads the snapshot and replays only the records after it. Compaction can
+ * be done in a forked child (background), so add() only waits for the fork.
+ *
+ * Call recover() once before adding, also if there is nothing to recover yet.
+ */
+class WriteAheadLog {
+public:
+	WriteAheadLog(ILVQ_XSZ & model, const std::string & path, const WalConfig & config);
+
+	//! Writes and syncs what is left
+	~WriteAheadLog();
+
+	/**
+	 * Load the last snapshot, replay the log after it directly on the model (without logging it
+	 * again), and open the log for appending. A torn record at the end of the log (a crash while
+	 * writing) is cut off. Returns false if the snapshot or the log can not be read or written.
+	 */
+	bool recover();
+
+	/**
+	 * Log the input, then add it to the model. Returns false, without adding it to the model, if
+	 * the record can not be written or synced (when it is its turn to be). After a failed sync it
+	 * always returns false, start again with recover().
+	 */
+	bool add(ILVQ_ASPECT & input, ILVQ_CLASS_REPRESENTATION & class_rep);
+
+	//! Write the collected records and sync the log to disk
+	bool sync();
+
+	//! Write a snapshot of the model and start a new, empty log
+	bool compact();
+
+	/**
+	 * The same, but the snapshot is written by a forked child, so the model can be trained on
+	 * while the snapshot is written. The child sees the model as it was at the fork, copy-on-write.
+	 * The log is rotated at the fork: the old one is kept as <path>.log.old until the snapshot is
+	 * complete, and new records go to a new log. If a background snapshot is still running, nothing
+	 * is done and false is returned. If the previous one failed, a normal compact() is done instead.
+	 */
+	bool compactBackground();
+
+	//! State of the background snapshot, reaps the child when it is done
+	WalSnapshotState pollSnapshot();
+
+	//! Share of the background snapshot that is written, between 0 and 1
+	float getSnapshotProgress();
+
+	//! Time in us that the last compactBackground() took, during which add() had to wait
+	inline int64_t getStall() { return stall; }
+
+	//! Number of records that were replayed by recover()
+	inline long getReplayed() { return replayed; }
+
+	//! Number of records in the log since the last compaction
+	inline long getRecords() { return records; }
+protected:
+	//! Write the collected records to the log, without syncing
+	bool write();
+
+	//! Create an empty log for the current epoch, atomically replacing the old one
+	bool createLog();
+
+	//! Header of a log or snapshot, false if the file does not exist or has another magic
+	bool readHeader(const std::string & file, const char *magic, WalHeader & h);
+
+	//! Replay the records of a log on the model, cut off a torn record at the end
+	bool replay(const std::string & log);
+
+	//! Write the snapshot of the given epoch, atomically replacing the old one
+	bool writeSnapshot(uint64_t epoch, FILE *f = NULL, int f_fd = -1);
+private:
+	ILVQ_XSZ & model;
+
+	std::string path;
+
+	WalConfig config;
+
+	int fd;
+
+	uint64_t epoch;
+
+	long records;
+
+	long replayed;
+
+	//! Records collected for the next write
+	std::vector<char> buffer;
+	int buffered;
+
+	//! Records written but not yet synced, and time of the last sync in ms
+	int unsynced;
+	int64_t last_sync;
+
+	//! The directory needs to be synced as well, after a rotation
+	bool dir_unsynced;
+
+	//! A sync failed, nothing is logged anymore
+	bool failed;
+
+	//! After a failed compaction, the number of records at which it is tried again
+	long compact_after;
+
+	//! Child that writes a background snapshot, or -1
+	pid_t child;
+	WalSnapshotState state;
+	WalProgress *progress;
+	int64_t stall;
+};
+
+}
+
+#endif /* WRITEAHEADLOG_H_ */
@@ -35,6 +35,16 @@ typedef float ILVQ_TYPE;
 //! One "aspect" is an input vector
 typedef std::vector<ILVQ_TYPE> ILVQ_ASPECT;
 
+/**
+ * A sparse "aspect", only the non-zero entries are stored, as pairs of index (sorted, each index
+ * once) and value, in a vector space of the given dimension.
+ */
+struct ILVQ_SPARSE_ASPECT {
+	int dimension;
+	std::vector<int> index;
+	std::vector<ILVQ_TYPE> value;
+};
+
 //! A (multi-modal) vector of multiple(!) aspects
 typedef std::vector<ILVQ_ASPECT*> ILVQ_VIEW;
 
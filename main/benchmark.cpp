@@ -0,0 +1,396 @@
+/**
+ * @file benchmark.cpp
+ * @brief Throughput of training and classification for the different ILVQ engines
+ *
+ * This file is created at Almende B.V. It is open-source software and part of the Common
+ * Hybrid Agent Platform (CHAP). A toolbox with a lot of open-source tools, ranging from
+ * thread pools and TCP/IP components to control architectures and learning algorithms.
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless,
+ * we personally strongly object against this software used by the military, in the
+ * bio-industry, for animal experimentation, or anything that violates the Universal
+ * Declaration of Human Rights.
+ *
+ * Copyright © 2012 Anne van Rossum <anne@almende.com>
+ *
+ * @author     Anne C. van Rossum
+ * @date       Apr 22, 2012
+ * @project    Replicator FP7
+ * @company    Almende B.V.
+ * @case       Machine learning (fit for Surveyeor robots)
+ */
+
+#include <stdlib.h>
+#include <iostream>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <time.h>
+#include <cmath>
+#include <map>
+
+#include <ilvq/ILVQ_XSZ.h>
+#include <ilvq/ILVQ_KWK.h>
+#include <ilvq/Generator.h>
+#include <ilvq/EventCounter.hpp>
+#include <ilvq/ShardedEventCounter.hpp>
+#include <ilvq/Parallel.hpp>
+#include <ilvq/PowerLaw.h>
+#include <ilvq/defs.h>
+
+using namespace std;
+using namespace dobots;
+
+double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/**
+ * Throughput of the generator for every type, in blocks into an aligned buffer.
+ */
+int generator(int dimension, int N, int threads) {
+	const char *names[GT_TYPES] = { "halves", "circle", "xor", "mixture", "manifold" };
+	const int block = 1 << 16;
+	for (int type = 0; type < GT_TYPES; ++type) {
+		Generator g(generator_config((GeneratorType)type, dimension, 2, 1));
+		ILVQ_TYPE *buffer = g.allocate(block);
+		std::vector<ILVQ_CLASS_REPRESENTATION> classes(block);
+		long ones = 0;
+		double t0 = now();
+		for (int first = 0; first < N; first += block) {
+			int count = std::min(block, N - first);
+			g.generate(first, count, buffer, &classes[0], threads);
+			for (int t = 0; t < count; ++t) ones += classes[t];
+		}
+		double t1 = now();
+		cout << names[type] << ":\t" << (N / (t1 - t0)) << " samples/s, " << (N / (t1 - t0)) * dimension
+				<< " values/s, share of class 1 " << (ones / (double)N) << endl;
+		free(buffer);
+	}
+	return EXIT_SUCCESS;
+}
+
+/**
+ * Throughput of EventCounter in every mode, for N small integer types (sizes up to "range") and
+ * for N distances (rounded to 1e-3) binned in 100 bins afterwards. All modes should agree.
+ */
+int counter(int range, int N) {
+	const char *names[3] = { "map", "dense", "hashed" };
+	std::vector<int> sizes(N);
+	std::vector<double> distances(N);
+	CounterRNG rng(1, 0);
+	for (int t = 0; t < N; ++t) {
+		sizes[t] = (int)(range * rng.uniform() * rng.uniform());
+		distances[t] = (int)(1000 * -std::log(1 - rng.uniform())) / 1000.0;
+	}
+	std::map<int,int> reference;
+	std::map<double,int> binned;
+	for (int mode = EC_MAP; mode <= EC_HASHED; ++mode) {
+		EventCounter<int> ec((EventCounterMode)mode, range);
+		double t0 = now();
+		for (int t = 0; t < N; ++t) ec.AddEvent(sizes[t]);
+		double t1 = now();
+		EventCounter<double> ed((EventCounterMode)(mode == EC_DENSE ? EC_HASHED : mode));
+		for (int t = 0; t < N; ++t) ed.AddEvent(distances[t]);
+		double t2 = now();
+		ed.Bin(100, 0, 10);
+		double t3 = now();
+		if (mode == EC_MAP) {
+			reference = ec.getEvents();
+			binned = ed.getEvents();
+		}
+		cout << names[mode] << ":\t" << (t1 - t0) * 1e9 / N << " ns per size, " << (t2 - t1) * 1e9 / N
+				<< " ns per distance, bin " << (t3 - t2) * 1e3 << " ms, same "
+				<< (ec.getEvents() == reference && ed.getEvents() == binned) << endl;
+	}
+	return EXIT_SUCCESS;
+}
+
+struct ShardedJob {
+	ShardedEventCounter<int> *counter;
+	const std::vector<int> *sizes;
+	int offset; // of the batch in sizes
+
+	void operator()(int begin, int end, int thread) {
+		ShardedEventCounter<int>::Shard *shard = counter->getShard();
+		for (int t = begin; t < end; ++t) shard->AddEvent((*sizes)[offset + t]);
+	}
+};
+
+/**
+ * Every thread counts its part of N small integer types (up to "range") in a ShardedEventCounter,
+ * types from range on go to the hash tables. Meanwhile the counts are flushed every 10 ms. The
+ * events come in batches, with new threads for every batch, which should reuse the shards.
+ */
+int sharded(int range, int N, int threads) {
+	if (threads <= 0) threads = hardware_threads();
+	std::vector<int> sizes(N);
+	CounterRNG rng(1, 0);
+	for (int t = 0; t < N; ++t) sizes[t] = (int)(2 * range * rng.uniform() * rng.uniform());
+	ShardedEventCounter<int> counter(range);
+	counter.StartFlush(10);
+	ShardedJob job;
+	job.counter = &counter;
+	job.sizes = &sizes;
+	const int batches = 4;
+	double t0 = now();
+	for (int b = 0; b < batches; ++b) {
+		job.offset = (long)N * b / batches;
+		parallel_for((long)N * (b + 1) / batches - job.offset, threads, job);
+	}
+	double t1 = now();
+	counter.StopFlush();
+	// with more threads than processors the threads also wait for each other
+	double cores = std::min(threads, hardware_threads());
+	EventCounter<int> reference(EC_DENSE, 2 * range);
+	for (int t = 0; t < N; ++t) reference.AddEvent(sizes[t]);
+	cout << threads << " threads:\t" << ((t1 - t0) * cores * 1e9 / N) << " ns per event per processor, " << (N / (t1 - t0))
+			<< " events/s, " << counter.getShardCount() << " shards, same " << (counter.getEvents() == reference.getEvents())
+			<< ", flushed view same " << (counter.getView() == reference.getEvents()) << endl;
+	if (counter.getShardCount() > threads) {
+		cerr << "Check failed: shards of threads that ended are not reused" << endl;
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
+
+/**
+ * N event sizes, 80% from a discrete power law with exponent 2.5 from 20 on and 20% uniform
+ * below that. The events are streamed into a PowerLawEstimator, which is fitted ten times.
+ */
+int powerlaw(int N, int threads) {
+	PowerLawEstimator estimator;
+	CounterRNG rng(1, 0);
+	double fitting = 0;
+	for (int t = 1; t <= N; ++t) {
+		double x;
+		if (rng.uniform() < 0.8) x = std::floor(19.5 * std::pow(1 - rng.uniform(), -1 / 1.5) + 0.5);
+		else x = 1 + (int)(19 * rng.uniform());
+		estimator.addEvent(x);
+		if (t % (N / 10) != 0) continue;
+		double t0 = now();
+		PowerLawFit f = estimator.fit(threads);
+		double t1 = now();
+		fitting += t1 - t0;
+		cout << t << " events:\talpha " << f.alpha << ", x_min " << f.x_min << ", KS " << f.ks << ", tail "
+				<< f.n << ", fit in " << (t1 - t0) * 1e3 << " ms" << endl;
+	}
+	cout << "Fitting took " << fitting << " s in total, alpha at x_min 1 is " << (estimator.setXMin(1), estimator.getAlpha())
+			<< endl;
+	return EXIT_SUCCESS;
+}
+
+/**
+ * Sparse samples with 1% non-zero entries (at least one) with values in [0,1]. The class is
+ * determined by the half of the dimensions with the largest sum.
+ */
+void getSparseSamples(int count, int dimension, std::vector<ILVQ_SPARSE_ASPECT> & samples,
+		std::vector<ILVQ_CLASS_REPRESENTATION> & classes) {
+	int nnz = std::max(1, dimension / 100);
+	samples.resize(count);
+	classes.resize(count);
+	std::vector<bool> used(dimension);
+	for (int t = 0; t < count; ++t) {
+		ILVQ_SPARSE_ASPECT & a = samples[t];
+		a.dimension = dimension;
+		a.index.clear();
+		a.value.clear();
+		for (int k = 0; k < nnz; ++k) {
+			int i = lrand48() % dimension;
+			if (used[i]) continue;
+			used[i] = true;
+			a.index.push_back(i);
+		}
+		std::sort(a.index.begin(), a.index.end());
+		float balance = 0;
+		for (unsigned int k = 0; k < a.index.size(); ++k) {
+			used[a.index[k]] = false;
+			a.value.push_back((float)drand48());
+			balance += (a.index[k] < dimension / 2) ? a.value[k] : -a.value[k];
+		}
+		classes[t] = (balance > 0) ? 1 : 0;
+	}
+}
+
+//! Dense copy of a sparse sample
+void densify(const ILVQ_SPARSE_ASPECT & a, ILVQ_ASPECT & out) {
+	out.assign(a.dimension, 0);
+	for (unsigned int k = 0; k < a.index.size(); ++k) out[a.index[k]] = a.value[k];
+}
+
+/**
+ * The largest euclidean distance from a prototype of model a to the closest prototype of the same
+ * class in model b.
+ */
+float largestDistance(ILVQ_XSZ & a, ILVQ_XSZ & b) {
+	int dim = a.getDimension();
+	int na = a.getPrototypeCount(), nb = b.getPrototypeCount();
+	std::vector<ILVQ_TYPE> pa(na * dim), pb(nb * dim), norms(std::max(na, nb));
+	std::vector<ILVQ_CLASS_REPRESENTATION> ca(na), cb(nb);
+	a.exportPrototypes(&pa[0], &norms[0], &ca[0]);
+	b.exportPrototypes(&pb[0], &norms[0], &cb[0]);
+	float largest = 0;
+	for (int i = 0; i < na; ++i) {
+		float closest = -1;
+		for (int j = 0; j < nb; ++j) {
+			if (ca[i] != cb[j]) continue;
+			float d = std::sqrt(squared_euclidean(&pa[i*dim], &pb[j*dim], dim));
+			if (closest < 0 || d < closest) closest = d;
+		}
+		largest = std::max(largest, closest);
+	}
+	return largest;
+}
+
+/**
+ * Trains with sparse samples, so there is no batch classification. The same samples, made dense,
+ * train a second model, which should end up with the same prototypes (up to rounding).
+ */
+int sparse(int dimension, int N_train, int N_test, DistanceMetric dm) {
+	ILVQ_XSZ ilvq(100, 0.1, 0.001, 16, dm);
+	std::vector<ILVQ_SPARSE_ASPECT> train, test;
+	std::vector<ILVQ_CLASS_REPRESENTATION> train_classes, test_classes;
+	getSparseSamples(N_train, dimension, train, train_classes);
+	getSparseSamples(N_test, dimension, test, test_classes);
+
+	double t0 = now();
+	for (int t = 0; t < N_train; ++t) {
+		ilvq.add(train[t], train_classes[t]);
+	}
+	double t1 = now();
+	cout << "Train:          " << (t1 - t0) << " s, " << (N_train / (t1 - t0)) << " samples/s" << endl;
+
+	int correct = 0;
+	t0 = now();
+	for (int t = 0; t < N_test; ++t) {
+		if (ilvq.classify(test[t]) == test_classes[t]) correct++;
+	}
+	t1 = now();
+	cout << "Classify:       " << (t1 - t0) << " s, " << (N_test / (t1 - t0)) << " samples/s" << endl;
+	cout << "Prototypes:     " << ilvq.getPrototypeCount() << endl;
+	cout << "Accuracy:       " << (correct / (double)N_test) << endl;
+
+	ILVQ_XSZ dense(100, 0.1, 0.001, 16, dm);
+	ILVQ_ASPECT x;
+	t0 = now();
+	for (int t = 0; t < N_train; ++t) {
+		densify(train[t], x);
+		dense.add(x, train_classes[t]);
+	}
+	t1 = now();
+	int same = 0;
+	for (int t = 0; t < N_test; ++t) {
+		densify(test[t], x);
+		if (dense.classify(x) == ilvq.classify(test[t])) same++;
+	}
+	cout << "Train dense:    " << (t1 - t0) << " s, " << (N_train / (t1 - t0)) << " samples/s" << endl;
+	cout << "Dense model:    " << dense.getPrototypeCount() << " prototypes, same class for "
+			<< (same / (double)N_test) << " of the test samples, prototypes at most "
+			<< std::max(largestDistance(ilvq, dense), largestDistance(dense, ilvq)) << " apart" << endl;
+	return EXIT_SUCCESS;
+}
+
+/**
+ * Usage: benchmark [xsz|kwk|sparse|generator|counter|sharded|powerlaw] [dimension] [train samples] [test samples] [threads] [metric] [lazy]
+ *   [sketch] [shortlist] [budget] [policy]
+ * The metric (euclidean, cosine, manhattan), lazy (window of lazy neighbour updates, 0 is off) and
+ * sketch/shortlist (dimension of the prefilter, 0 is off, and number of prototypes it passes) are
+ * only used by xsz, as well as budget (maximum number of prototypes, 0 is unbounded) and policy
+ * (recent, wins or redundant, see ILVQ_EVICTION) with the peak number of prototypes while
+ * training. The sparse engine is xsz trained with sparse samples, and compared with a model trained
+ * with the same samples made dense. The dense samples are a
+ * circle in the first two dimensions (see Generator.h), with seed 1. The generator engine measures
+ * the generator itself, for the training samples. The counter engine measures the EventCounter
+ * modes with the training samples as events, and the dimension as range of the types. The
+ * sharded engine does the same for ShardedEventCounter with the given number of threads. The
+ * powerlaw engine fits the exponent and x_min of a stream of training samples as event sizes. With the prefilter the
+ * recall is reported: the share of test samples of which the closest prototype is the same as
+ * with exact search.
+ */
+int main(int argc, char *argv[]) {
+	string engine = (argc > 1) ? argv[1] : "xsz";
+	int dimension = (argc > 2) ? atoi(argv[2]) : 2;
+	int N_train = (argc > 3) ? atoi(argv[3]) : 100000;
+	int N_test = (argc > 4) ? atoi(argv[4]) : 10000;
+	int threads = (argc > 5) ? atoi(argv[5]) : 0;
+	string metric = (argc > 6) ? argv[6] : "euclidean";
+	int lazy = (argc > 7) ? atoi(argv[7]) : 0;
+	int sketch = (argc > 8) ? atoi(argv[8]) : 0;
+	int shortlist = (argc > 9) ? atoi(argv[9]) : 16;
+	int budget = (argc > 10) ? atoi(argv[10]) : 0;
+	string policy = (argc > 11) ? argv[11] : "recent";
+
+	DistanceMetric dm = DM_EUCLIDEAN;
+	if (metric == "cosine") dm = DM_COSINE;
+	if (metric == "manhattan") dm = DM_MANHATTAN;
+	cout << "Benchmark " << engine << " with dimension " << dimension << ", " << N_train
+			<< " training and " << N_test << " test samples" << endl;
+	srand48(1);
+	if (engine == "sparse") return sparse(dimension, N_train, N_test, dm);
+	if (engine == "generator") return generator(dimension, N_train, threads);
+	if (engine == "counter") return counter(dimension, N_train);
+	if (engine == "sharded") return sharded(dimension, N_train, threads);
+	if (engine == "powerlaw") return powerlaw(N_train, threads);
+
+	ILVQ *ilvq;
+	if (engine == "kwk") {
+		ilvq = new ILVQ_KWK();
+	} else {
+		ILVQ_XSZ *xsz = new ILVQ_XSZ(100, 0.1, 0.001, 16, dm);
+		if (lazy > 0) xsz->setLazy(true, lazy);
+		if (sketch > 0) xsz->setPrefilter(sketch, shortlist);
+		ILVQ_EVICTION ev = EV_LEAST_RECENT;
+		if (policy == "wins") ev = EV_LEAST_WINS;
+		if (policy == "redundant") ev = EV_REDUNDANT;
+		if (budget > 0) xsz->setBudget(budget, ev);
+		ilvq = xsz;
+	}
+	std::vector<ILVQ_ASPECT> train, test;
+	std::vector<ILVQ_CLASS_REPRESENTATION> train_classes, test_classes, result;
+	Generator g(generator_config(GT_CIRCLE, dimension, 2, 1));
+	g.generate(0, N_train, train, train_classes);
+	g.generate(N_train, N_test, test, test_classes);
+
+	int peak = 0;
+	double t0 = now();
+	for (int t = 0; t < N_train; ++t) {
+		ilvq->add(train[t], train_classes[t]);
+		peak = std::max(peak, ilvq->getPrototypeCount());
+	}
+	double t1 = now();
+	cout << "Train:          " << (t1 - t0) << " s, " << (N_train / (t1 - t0)) << " samples/s" << endl;
+
+	int correct = 0;
+	t0 = now();
+	for (int t = 0; t < N_test; ++t) {
+		if (ilvq->classify(test[t]) == test_classes[t]) correct++;
+	}
+	t1 = now();
+	cout << "Classify:       " << (t1 - t0) << " s, " << (N_test / (t1 - t0)) << " samples/s" << endl;
+
+	t0 = now();
+	ilvq->classify(test, result, threads);
+	t1 = now();
+	cout << "Classify batch: " << (t1 - t0) << " s, " << (N_test / (t1 - t0)) << " samples/s" << endl;
+
+	cout << "Prototypes:     " << ilvq->getPrototypeCount() << ", at most " << peak << " while training" << endl;
+	cout << "Accuracy:       " << (correct / (double)N_test) << endl;
+
+	if (engine != "kwk" && sketch > 0) {
+		ILVQ_XSZ *xsz = (ILVQ_XSZ*)ilvq;
+		std::vector<ILVQ_PROTOTYPE_INDEX> winners(N_test);
+		for (int t = 0; t < N_test; ++t) winners[t] = xsz->getWinner(test[t]);
+		xsz->setPrefilter(0);
+		int same = 0;
+		for (int t = 0; t < N_test; ++t) {
+			if (xsz->getWinner(test[t]) == winners[t]) same++;
+		}
+		cout << "Recall:         " << (same / (double)N_test) << " with exact distances to "
+				<< std::min(shortlist, ilvq->getPrototypeCount()) << " instead of all prototypes" << endl;
+	}
+	delete ilvq;
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,150 @@
+/**
+ * @file client.cpp
+ * @brief Load generator for main/server.cpp, reports throughput and latency
+ *
+ * This file is created at Almende B.V. It is open-source software and part of the Common
+ * Hybrid Agent Platform (CHAP). A toolbox with a lot of open-source tools, ranging from
+ * thread pools and TCP/IP components to control architectures and learning algorithms.
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless,
+ * we personally strongly object against this software used by the military, in the
+ * bio-industry, for animal experimentation, or anything that violates the Universal
+ * Declaration of Human Rights.
+ *
+ * Copyright © 2012 Anne van Rossum <anne@almende.com>
+ *
+ * @author     Anne C. van Rossum
+ * @date       Apr 22, 2012
+ * @project    Replicator FP7
+ * @company    Almende B.V.
+ * @case       Machine learning (fit for Surveyeor robots)
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <ilvq/Server.h>
+#include <ilvq/Parallel.hpp>
+
+using namespace std;
+using namespace dobots;
+
+const char *path = "/tmp/ilvq.sock";
+
+int connect_to(const char *path) {
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+	if (fd >= 0 && connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/**
+ * Every connection keeps "depth" requests in flight, and sends a new one when one of them is
+ * answered. The latency of a request is the time between sending it and reading its answer.
+ */
+struct Load {
+	int requests;
+	int depth;
+	int k;
+	int dimension;
+	std::vector<std::vector<int64_t> > latencies;
+	int errors;
+
+	void operator()(int begin, int end, int thread) {
+		for (int c = begin; c < end; ++c) run(c);
+	}
+
+	void run(int c) {
+		int fd = connect_to(path);
+		if (fd < 0) {
+			__atomic_add_fetch(&errors, requests, __ATOMIC_RELAXED);
+			return;
+		}
+		unsigned short seed[3] = { (unsigned short)c, 1, 2 };
+		std::vector<int64_t> sent(requests);
+		std::vector<char> request(sizeof(ServerRequest) + dimension * sizeof(float));
+		ServerResponse response;
+		ServerResult results[SERVER_MAX_K];
+		latencies[c].reserve(requests);
+		int next = 0, received = 0;
+		while (received < requests) {
+			while (next < requests && next - received < depth) {
+				ServerRequest *r = (ServerRequest*)&request[0];
+				r->type = (k > 1) ? SR_TOPK : SR_CLASSIFY;
+				r->id = next;
+				r->k = k;
+				r->dimension = dimension;
+				float *x = (float*)&request[sizeof(ServerRequest)];
+				for (int i = 0; i < dimension; ++i) x[i] = erand48(seed);
+				sent[next] = now_us();
+				if (!write_fully(fd, &request[0], request.size())) break;
+				next++;
+			}
+			if (!read_fully(fd, &response, sizeof(response)) ||
+					!read_fully(fd, results, response.count * sizeof(ServerResult))) break;
+			latencies[c].push_back(now_us() - sent[response.id]);
+			if (response.status != SS_OK) __atomic_add_fetch(&errors, 1, __ATOMIC_RELAXED);
+			received++;
+		}
+		if (received < requests) __atomic_add_fetch(&errors, requests - received, __ATOMIC_RELAXED);
+		close(fd);
+	}
+};
+
+/**
+ * Usage: client [socket] [connections] [requests per connection] [depth] [k]
+ */
+int main(int argc, char *argv[]) {
+	if (argc > 1) path = argv[1];
+	int connections = (argc > 2) ? atoi(argv[2]) : 16;
+	Load load;
+	load.requests = (argc > 3) ? atoi(argv[3]) : 10000;
+	load.depth = (argc > 4) ? atoi(argv[4]) : 1;
+	load.k = (argc > 5) ? atoi(argv[5]) : 1;
+	load.errors = 0;
+
+	// ask the server for the dimension of its model
+	int fd = connect_to(path);
+	ServerRequest info = { SR_INFO, 0, 0, 0 };
+	ServerResponse response;
+	if (fd < 0 || !write_fully(fd, &info, sizeof(info)) || !read_fully(fd, &response, sizeof(response))) {
+		cerr << "Can not connect to " << path << endl;
+		return EXIT_FAILURE;
+	}
+	close(fd);
+	load.dimension = response.dimension;
+	load.latencies.resize(connections);
+	cout << "Send " << load.requests << " requests of dimension " << load.dimension << " over each of "
+			<< connections << " connections, " << load.depth << " in flight per connection" << endl;
+
+	int64_t t0 = now_us();
+	parallel_for(connections, connections, load);
+	int64_t t1 = now_us();
+
+	std::vector<int64_t> all;
+	for (int c = 0; c < connections; ++c) all.insert(all.end(), load.latencies[c].begin(), load.latencies[c].end());
+	std::sort(all.begin(), all.end());
+	if (all.empty()) {
+		cerr << "No answers" << endl;
+		return EXIT_FAILURE;
+	}
+	cout << "Throughput:     " << (all.size() * 1e6 / (t1 - t0)) << " requests/s" << endl;
+	cout << "Latency p50:    " << all[all.size() / 2] << " us" << endl;
+	cout << "Latency p99:    " << all[(all.size() * 99) / 100] << " us" << endl;
+	cout << "Latency max:    " << all.back() << " us" << endl;
+	cout << "Errors:         " << load.errors << endl;
+	return EXIT_SUCCESS;
+}
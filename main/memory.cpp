@@ -0,0 +1,146 @@
+/**
+ * @file memory.cpp
+ * @brief Memory used by ILVQ_XSZ by structure, checked against the statistics of malloc
+ *
+ * This file is created at Almende B.V. It is open-source software and part of the Common
+ * Hybrid Agent Platform (CHAP). A toolbox with a lot of open-source tools, ranging from
+ * thread pools and TCP/IP components to control architectures and learning algorithms.
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless,
+ * we personally strongly object against this software used by the military, in the
+ * bio-industry, for animal experimentation, or anything that violates the Universal
+ * Declaration of Human Rights.
+ *
+ * Copyright © 2012 Anne van Rossum <anne@almende.com>
+ *
+ * @author     Anne C. van Rossum
+ * @date       Apr 22, 2012
+ * @project    Replicator FP7
+ * @company    Almende B.V.
+ * @case       Machine learning (fit for Surveyeor robots)
+ */
+
+#include <stdlib.h>
+#include <malloc.h>
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <cmath>
+#include <new>
+
+#include <ilvq/ILVQ_XSZ.h>
+#include <ilvq/Generator.h>
+
+using namespace std;
+using namespace dobots;
+
+/**
+ * Bytes in use according to malloc: every allocation by new is counted with the size of its chunk,
+ * as malloc reports it. The totals of mallinfo2 can not be used for this, they count the chunks in
+ * the per-thread caches of freed chunks as in use.
+ */
+size_t allocated = 0;
+
+void *operator new(size_t n) {
+	void *p = malloc(n ? n : 1);
+	if (p == NULL) throw std::bad_alloc();
+	allocated += malloc_usable_size(p) + sizeof(size_t);
+	return p;
+}
+
+void operator delete(void *p) noexcept {
+	if (p == NULL) return;
+	allocated -= malloc_usable_size(p) + sizeof(size_t);
+	free(p);
+}
+
+void operator delete(void *p, size_t n) noexcept {
+	operator delete(p);
+}
+
+size_t heap_used() {
+	return allocated;
+}
+
+void print(const string & name, const ILVQ_MEMORY_PART & part) {
+	cout << setw(12) << name << setw(14) << part.payload << setw(14) << part.bookkeeping << setw(14)
+			<< part.slack << setw(14) << part.total() << endl;
+}
+
+void print(const ILVQ_XSZ_MEMORY & m) {
+	cout << setw(12) << "" << setw(14) << "payload" << setw(14) << "bookkeeping" << setw(14) << "slack"
+			<< setw(14) << "total" << endl;
+	print("prototype", m.prototype);
+	print("position", m.position);
+	print("connection", m.connection);
+	print("extra", m.extra);
+	print("model", m.model);
+	cout << m.prototypes << " prototypes of dimension " << m.dimension << ", " << m.connections
+			<< " connections, " << m.total() << " bytes in total, ";
+	if (m.prototypes) {
+		cout << (m.prototype.total() + m.position.total() + m.extra.total()) / m.prototypes << " per prototype";
+	}
+	if (m.connections) cout << ", " << m.connection.total() / m.connections << " per connection";
+	cout << endl << "Free in the heap (fragmentation): " << m.heap_free << endl;
+}
+
+/**
+ * Usage: memory [dimension] [samples] [type] [lazy] [sketch]
+ * The model is trained on a stack object, so everything that is allocated after the start is the
+ * model's, apart from the object itself. memoryUsage() has to match that within 1%, and nothing
+ * should be left after the model is gone. Halfway, the memory at
+ * the end is projected from the prototype count at the end.
+ */
+int main(int argc, char *argv[]) {
+	int dimension = (argc > 1) ? atoi(argv[1]) : 16;
+	int N = (argc > 2) ? atoi(argv[2]) : 100000;
+	string type = (argc > 3) ? argv[3] : "mixture";
+	int lazy = (argc > 4) ? atoi(argv[4]) : 0;
+	int sketch = (argc > 5) ? atoi(argv[5]) : 0;
+	GeneratorType gt = (type == "circle") ? GT_CIRCLE : (type == "xor") ? GT_XOR : GT_MIXTURE;
+	GeneratorConfig config = generator_config(gt, dimension, 4, 1);
+	config.clusters = 8;
+	Generator generator(config);
+	std::vector<ILVQ_ASPECT> data;
+	std::vector<ILVQ_CLASS_REPRESENTATION> classes;
+	generator.generate(0, N, data, classes);
+
+	// the first output allocates the buffer of stdout, do it before measuring
+	cout << "Train on " << N << " " << type << " samples of dimension " << dimension << endl;
+	size_t before = heap_used();
+	ILVQ_XSZ_MEMORY end;
+	size_t used;
+	{
+		ILVQ_XSZ ilvq(16, 0.1, 0.001, 100);
+		if (lazy > 0) ilvq.setLazy(true, lazy);
+		if (sketch > 0) ilvq.setPrefilter(sketch);
+		for (int t = 0; t < N; ++t) {
+			ilvq.add(data[t], classes[t]);
+		}
+		end = ilvq.memoryUsage();
+		used = heap_used() - before;
+	}
+	print(end);
+	size_t after = heap_used() - before;
+
+	size_t expected = end.total() - sizeof(ILVQ_XSZ);
+	double error = ((double)expected - used) / used;
+	cout << "According to malloc " << used << " bytes, memoryUsage " << expected << " bytes (without the object), "
+			<< "error " << setprecision(3) << error * 100 << "%" << endl;
+	cout << "After deleting the model " << after << " bytes are left" << endl;
+
+	// the same model trained on the first half, projected to the size at the end
+	ILVQ_XSZ ilvq(16, 0.1, 0.001, 100);
+	if (lazy > 0) ilvq.setLazy(true, lazy);
+	if (sketch > 0) ilvq.setPrefilter(sketch);
+	for (int t = 0; t < N / 2; ++t) {
+		ilvq.add(data[t], classes[t]);
+	}
+	ILVQ_XSZ_MEMORY projected = ilvq.projectMemory(end.prototypes, dimension);
+	cout << "Projected from " << ilvq.getPrototypeCount() << " to " << end.prototypes << " prototypes: "
+			<< projected.total() << " bytes, error " << ((double)projected.total() - end.total()) / end.total() * 100
+			<< "%" << endl;
+	return (std::fabs(error) < 0.01 && after == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
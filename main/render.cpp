@@ -0,0 +1,118 @@
+/**
+ * @file render.cpp
+ * @brief Decision map of a model as PPM image
+ *
+ * This file is created at Almende B.V. It is open-source software and part of the Common
+ * Hybrid Agent Platform (CHAP). A toolbox with a lot of open-source tools, ranging from
+ * thread pools and TCP/IP components to control architectures and learning algorithms.
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless,
+ * we personally strongly object against this software used by the military, in the
+ * bio-industry, for animal experimentation, or anything that violates the Universal
+ * Declaration of Human Rights.
+ *
+ * Copyright © 2012 Anne van Rossum <anne@almende.com>
+ *
+ * @author     Anne C. van Rossum
+ * @date       Apr 22, 2012
+ * @project    Replicator FP7
+ * @company    Almende B.V.
+ * @case       Machine learning (fit for Surveyeor robots)
+ */
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <iostream>
+#include <string>
+#include <time.h>
+
+#include <ilvq/ILVQ_XSZ.h>
+#include <ilvq/Generator.h>
+#include <ilvq/DecisionMap.h>
+#include <ilvq/defs.h>
+
+using namespace std;
+using namespace dobots;
+
+double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/**
+ * Usage: render [model|mixture] [size] [output] [block] [threads] [check]
+ * Renders the decision regions of a model over the unit square in its first two dimensions, with
+ * size x size pixels, to a PPM file (default decision.ppm). The model is a file written by
+ * ILVQ_XSZ::save (main/test.cpp writes ilvq.model), or with "mixture" a model is trained on a 2D
+ * mixture of gaussians with many small clusters, which needs a lot of prototypes. Block is the
+ * size of the blocks that are tested as a whole, 1 classifies every pixel. With check (1) the map
+ * is rendered per pixel as well and the number of pixels that differ is reported.
+ */
+int main(int argc, char *argv[]) {
+	string source = (argc > 1) ? argv[1] : "ilvq.model";
+	int size = (argc > 2) ? atoi(argv[2]) : 1024;
+	string output = (argc > 3) ? argv[3] : "decision.ppm";
+	int block = (argc > 4) ? atoi(argv[4]) : 32;
+	int threads = (argc > 5) ? atoi(argv[5]) : 0;
+	bool check = (argc > 6) && atoi(argv[6]);
+
+	ILVQ_XSZ model(100, 0.1, 0.001, 1000);
+	int classes = 2;
+	if (source == "mixture") {
+		GeneratorConfig gc = generator_config(GT_MIXTURE, 2, 4, 1);
+		gc.clusters = 64;
+		gc.spread = 0.02;
+		classes = gc.classes;
+		Generator g(gc);
+		ILVQ_ASPECT aspect;
+		ILVQ_CLASS_REPRESENTATION class_id;
+		for (int t = 0; t < 100000; ++t) {
+			g.sample(t, aspect, class_id);
+			model.add(aspect, class_id);
+		}
+	} else {
+		FILE *f = fopen(source.c_str(), "rb");
+		if (f == NULL) {
+			cerr << "Can not open " << source << endl;
+			return EXIT_FAILURE;
+		}
+		bool ok = model.load(f);
+		fclose(f);
+		if (!ok) return EXIT_FAILURE;
+	}
+	if (model.getDimension() < 2) {
+		cerr << "Model has no prototypes of dimension 2 or more" << endl;
+		return EXIT_FAILURE;
+	}
+	cout << "Model with " << model.getPrototypeCount() << " prototypes of dimension " << model.getDimension() << endl;
+
+	DecisionMapConfig config = decision_map_config(size, size, model.getDimension());
+	config.classes = classes;
+	config.block = block;
+	config.threads = threads;
+	DecisionMap map(config);
+	double t0 = now();
+	map.render(model);
+	double t1 = now();
+	cout << "Rendered " << size << "x" << size << " in " << (t1 - t0) << " s, " << map.getEvaluated()
+			<< " points classified" << endl;
+	if (check) {
+		config.block = 1;
+		DecisionMap exact(config);
+		t0 = now();
+		exact.render(model);
+		t1 = now();
+		long differ = 0;
+		for (unsigned int i = 0; i < exact.getClasses().size(); ++i) {
+			if (exact.getClasses()[i] != map.getClasses()[i]) differ++;
+		}
+		cout << "Per pixel in " << (t1 - t0) << " s, " << differ << " pixels differ" << endl;
+	}
+	map.overlay(model);
+	if (!map.write(output.c_str())) return EXIT_FAILURE;
+	cout << "Written to " << output << endl;
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,76 @@
+/**
+ * @file server.cpp
+ * @brief Serve classification requests for a saved model over a Unix domain socket
+ *
+ * This file is created at Almende B.V. It is open-source software and part of the Common
+ * Hybrid Agent Platform (CHAP). A toolbox with a lot of open-source tools, ranging from
+ * thread pools and TCP/IP components to control architectures and learning algorithms.
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless,
+ * we personally strongly object against this software used by the military, in the
+ * bio-industry, for animal experimentation, or anything that violates the Universal
+ * Declaration of Human Rights.
+ *
+ * Copyright © 2012 Anne van Rossum <anne@almende.com>
+ *
+ * @author     Anne C. van Rossum
+ * @date       Apr 22, 2012
+ * @project    Replicator FP7
+ * @company    Almende B.V.
+ * @case       Machine learning (fit for Surveyeor robots)
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <signal.h>
+#include <iostream>
+
+#include <ilvq/Server.h>
+
+using namespace std;
+using namespace dobots;
+
+ClassifyServer *server = NULL;
+
+void handler(int signal) {
+	if (server != NULL) server->stop();
+}
+
+/**
+ * Usage: server <model file> [socket] [workers] [window in us] [max batch] [max queue] [max connections]
+ * The model file is written by ILVQ_XSZ::save, for example by main/test.cpp. Stop with ctrl-c.
+ */
+int main(int argc, char *argv[]) {
+	if (argc < 2) {
+		cerr << "Usage: " << argv[0] << " <model file> [socket] [workers] [window in us] [max batch] [max queue]"
+				<< " [max connections]" << endl;
+		return EXIT_FAILURE;
+	}
+	const char *path = (argc > 2) ? argv[2] : "/tmp/ilvq.sock";
+	ServerConfig config;
+	config.workers = (argc > 3) ? atoi(argv[3]) : 2;
+	config.window_us = (argc > 4) ? atoi(argv[4]) : 200;
+	config.max_batch = (argc > 5) ? atoi(argv[5]) : 64;
+	config.max_queue = (argc > 6) ? atoi(argv[6]) : 4096;
+	config.max_connections = (argc > 7) ? atoi(argv[7]) : 64;
+
+	ILVQ_XSZ model;
+	FILE *f = fopen(argv[1], "rb");
+	if (f == NULL || !model.load(f)) {
+		cerr << "Can not load model " << argv[1] << endl;
+		if (f != NULL) fclose(f);
+		return EXIT_FAILURE;
+	}
+	fclose(f);
+	cout << "Serve model with " << model.getPrototypeCount() << " prototypes of dimension "
+			<< model.getDimension() << " at " << path << endl;
+
+	server = new ClassifyServer(model, config);
+	signal(SIGINT, handler);
+	signal(SIGTERM, handler);
+	bool ok = server->run(path);
+	delete server;
+	server = NULL;
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
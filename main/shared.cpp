@@ -0,0 +1,175 @@
+/**
+ * @file shared.cpp
+ * @brief Publish a model in shared memory while training, and classify from it in other processes
+ *
+ * This file is created at Almende B.V. It is open-source software and part of the Common
+ * Hybrid Agent Platform (CHAP). A toolbox with a lot of open-source tools, ranging from
+ * thread pools and TCP/IP components to control architectures and learning algorithms.
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless,
+ * we personally strongly object against this software used by the military, in the
+ * bio-industry, for animal experimentation, or anything that violates the Universal
+ * Declaration of Human Rights.
+ *
+ * Copyright © 2012 Anne van Rossum <anne@almende.com>
+ *
+ * @author     Anne C. van Rossum
+ * @date       Apr 22, 2012
+ * @project    Replicator FP7
+ * @company    Almende B.V.
+ * @case       Machine learning (fit for Surveyeor robots)
+ */
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <time.h>
+
+#include <ilvq/SharedModel.h>
+
+using namespace std;
+using namespace dobots;
+
+double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+//! Uniform sample in [0,1]^D, the class is determined by a circle in the first two dimensions
+void getSample(int dimension, ILVQ_ASPECT & a, ILVQ_CLASS_REPRESENTATION & c) {
+	a.resize(dimension);
+	for (int i = 0; i < dimension; ++i) a[i] = (float)drand48();
+	float x = a[0], y = (dimension > 1) ? a[1] : 0.5;
+	c = ((2*x-1)*(2*x-1)+(2*y-1)*(2*y-1) < 1.0) ? 1 : 0;
+}
+
+//! Split a sample in the modalities of the model, the first two dimensions and the rest
+void getView(const ILVQ_ASPECT & a, ILVQ_ASPECT & first, ILVQ_ASPECT & rest, ILVQ_VIEW & view) {
+	first.assign(a.begin(), a.begin() + 2);
+	rest.assign(a.begin() + 2, a.end());
+	view.resize(2);
+	view[0] = &first;
+	view[1] = &rest;
+}
+
+/**
+ * Train in rounds and publish a new generation after every round. After publishing, a reader in
+ * this process checks that it classifies the same as the model itself. With views, the model has
+ * two modalities: the first two dimensions (euclidean) and the rest (cosine, half the weight).
+ */
+int runPublisher(const string & name, int dimension, int rounds, int samples, bool views) {
+	ILVQ_XSZ ilvq(100, 0.1, 0.001, 16);
+	if (views) {
+		if (dimension < 3) {
+			cerr << "Views need a dimension of at least 3" << endl;
+			return EXIT_FAILURE;
+		}
+		std::vector<ILVQ_MODALITY> modalities(2);
+		modalities[0].dimension = 2;
+		modalities[0].metric = DM_EUCLIDEAN;
+		modalities[0].weight = 1;
+		modalities[1].dimension = dimension - 2;
+		modalities[1].metric = DM_COSINE;
+		modalities[1].weight = 0.5;
+		ilvq.setModalities(modalities);
+	}
+	SharedModelWriter writer(name);
+	SharedModelReader reader(name);
+	ILVQ_ASPECT a, first, rest;
+	ILVQ_VIEW view;
+	ILVQ_CLASS_REPRESENTATION c;
+	for (int r = 0; r < rounds; ++r) {
+		for (int t = 0; t < samples; ++t) {
+			getSample(dimension, a, c);
+			if (views) {
+				getView(a, first, rest, view);
+				ilvq.add(view, c);
+			} else {
+				ilvq.add(a, c);
+			}
+		}
+		double t0 = now();
+		if (!writer.publish(ilvq)) return EXIT_FAILURE;
+		double t1 = now();
+		reader.refresh();
+		int same = 0, checks = 1000;
+		for (int t = 0; t < checks; ++t) {
+			getSample(dimension, a, c);
+			if (views) {
+				getView(a, first, rest, view);
+				ILVQ_CLASS_REPRESENTATION expected = ilvq.classify(view);
+				view[t % 2] = NULL; // a view of which a modality is absent
+				if (reader.classify(a) == expected && reader.classify(view) == ilvq.classify(view)) same++;
+			} else if (reader.classify(a) == ilvq.classify(a)) {
+				same++;
+			}
+		}
+		cout << "Published generation " << writer.getGeneration() << " with " << ilvq.getPrototypeCount()
+				<< " prototypes in " << (t1 - t0) * 1e6 << " us, reader agrees on " << same << "/" << checks << endl;
+		if (same != checks) {
+			cerr << "Check failed: the reader does not classify as the model" << endl;
+			return EXIT_FAILURE;
+		}
+		sleep(1);
+	}
+	return EXIT_SUCCESS;
+}
+
+/**
+ * Classify from the shared model for the given time, looking for a new generation before every
+ * batch of classifications.
+ */
+int runReader(const string & name, int seconds) {
+	SharedModelReader reader(name);
+	ILVQ_ASPECT a;
+	ILVQ_CLASS_REPRESENTATION c;
+	long count = 0;
+	double t0 = now(), t1 = t0;
+	while (t1 - t0 < seconds) {
+		if (reader.refresh()) {
+			cout << "Reader " << getpid() << " uses generation " << reader.getGeneration() << " with "
+					<< reader.getPrototypeCount() << " prototypes" << endl;
+		}
+		if (reader.getGeneration() == 0) {
+			usleep(100000);
+		} else {
+			for (int t = 0; t < 1000; ++t, ++count) {
+				getSample(reader.getDimension(), a, c);
+				reader.classify(a);
+			}
+		}
+		t1 = now();
+	}
+	cout << "Reader " << getpid() << " classified " << (count / (t1 - t0)) << " samples/s" << endl;
+	return EXIT_SUCCESS;
+}
+
+/**
+ * Usage: shared publish [name] [dimension] [rounds] [samples per round] [views]
+ *        shared read [name] [seconds]
+ *        shared remove [name]
+ * Start one publisher and as many readers as you like, in any order.
+ */
+int main(int argc, char *argv[]) {
+	string mode = (argc > 1) ? argv[1] : "publish";
+	string name = (argc > 2) ? argv[2] : "/ilvq";
+	srand48(getpid());
+	if (mode == "publish") {
+		int dimension = (argc > 3) ? atoi(argv[3]) : 2;
+		int rounds = (argc > 4) ? atoi(argv[4]) : 10;
+		int samples = (argc > 5) ? atoi(argv[5]) : 10000;
+		bool views = (argc > 6) && string(argv[6]) == "views";
+		return runPublisher(name, dimension, rounds, samples, views);
+	}
+	if (mode == "read") return runReader(name, (argc > 3) ? atoi(argv[3]) : 10);
+	if (mode == "remove") {
+		SharedModelWriter(name).unpublish();
+		return EXIT_SUCCESS;
+	}
+	cerr << "Usage: " << argv[0] << " publish|read|remove [name] ..." << endl;
+	return EXIT_FAILURE;
+}
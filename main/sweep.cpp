@@ -0,0 +1,260 @@
+/**
+ * @file sweep.cpp
+ * @brief Hyperparameter sweep for ILVQ_XSZ with k-fold or prequential evaluation, over all cores
+ *
+ * This file is created at Almende B.V. It is open-source software and part of the Common
+ * Hybrid Agent Platform (CHAP). A toolbox with a lot of open-source tools, ranging from
+ * thread pools and TCP/IP components to control architectures and learning algorithms.
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless,
+ * we personally strongly object against this software used by the military, in the
+ * bio-industry, for animal experimentation, or anything that violates the Universal
+ * Declaration of Human Rights.
+ *
+ * Copyright © 2012 Anne van Rossum <anne@almende.com>
+ *
+ * @author     Anne C. van Rossum
+ * @date       Apr 22, 2012
+ * @project    Replicator FP7
+ * @company    Almende B.V.
+ * @case       Machine learning (fit for Surveyeor robots)
+ */
+
+#include <stdlib.h>
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <cmath>
+#include <pthread.h>
+#include <time.h>
+
+#include <ilvq/ILVQ_XSZ.h>
+#include <ilvq/Generator.h>
+#include <ilvq/Parallel.hpp>
+
+using namespace std;
+using namespace dobots;
+
+double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/**
+ * The parameters of the ILVQ_XSZ constructor that have an effect. The learning rates mu1 and mu2
+ * are not among them, ILVQ_XSZ::updateLearningRates sets them before every update.
+ */
+struct Params {
+	int ageOld;
+	int lambda;
+};
+
+struct Result {
+	Params params;
+	int runs;
+	double accuracy; // sum over the runs, and sum of squares
+	double accuracy2;
+	double prototypes;
+	double samples; // trained, and time spent training
+	double seconds;
+
+	inline double mean() const { return accuracy / runs; }
+
+	inline double deviation() const { return std::sqrt(std::max(0.0, accuracy2 / runs - mean() * mean())); }
+};
+
+bool better(const Result & a, const Result & b) {
+	return a.mean() > b.mean();
+}
+
+/**
+ * Every run (a parameter setting and a fold) is a job. The threads take the next job until there
+ * are none left, so slow settings do not keep the other threads waiting. The dataset is shared
+ * and only read.
+ */
+struct Sweep {
+	const std::vector<ILVQ_ASPECT> *data;
+	const std::vector<ILVQ_CLASS_REPRESENTATION> *classes;
+	int folds; // 0 for prequential evaluation
+	std::vector<Result> results;
+	int next;
+	pthread_mutex_t lock;
+
+	void operator()(int begin, int end, int thread) {
+		const int runs = std::max(folds, 1);
+		const int jobs = results.size() * runs;
+		for (int j = __atomic_fetch_add(&next, 1, __ATOMIC_RELAXED); j < jobs;
+				j = __atomic_fetch_add(&next, 1, __ATOMIC_RELAXED)) {
+			run(results[j / runs], j % runs);
+		}
+	}
+
+	//! add and classify only read their input, so the shared samples can be passed
+	inline ILVQ_ASPECT & sample(int t) {
+		return const_cast<ILVQ_ASPECT&>((*data)[t]);
+	}
+
+	void run(Result & result, int fold) {
+		const Params & p = result.params;
+		ILVQ_XSZ ilvq(p.ageOld, 0.1, 0.001, p.lambda);
+		const int N = data->size();
+		int correct = 0, tested = 0, trained = 0;
+		double seconds = 0;
+		if (folds == 0) {
+			// prequential: test every sample first, then train on it
+			double t0 = now();
+			for (int t = 0; t < N; ++t) {
+				ILVQ_CLASS_REPRESENTATION c = (*classes)[t];
+				if (t > 0 && ilvq.classify(sample(t)) == c) correct++;
+				ilvq.add(sample(t), c);
+			}
+			seconds = now() - t0;
+			tested = N - 1;
+			trained = N;
+		} else {
+			const int begin = (long)N * fold / folds, end = (long)N * (fold + 1) / folds;
+			double t0 = now();
+			for (int t = 0; t < N; ++t) {
+				if (t >= begin && t < end) continue;
+				ILVQ_CLASS_REPRESENTATION c = (*classes)[t];
+				ilvq.add(sample(t), c);
+				trained++;
+			}
+			seconds = now() - t0;
+			for (int t = begin; t < end; ++t) {
+				if (ilvq.classify(sample(t)) == (*classes)[t]) correct++;
+			}
+			tested = end - begin;
+		}
+		double accuracy = tested ? correct / (double)tested : 0;
+		pthread_mutex_lock(&lock);
+		result.runs++;
+		result.accuracy += accuracy;
+		result.accuracy2 += accuracy * accuracy;
+		result.prototypes += ilvq.getPrototypeCount();
+		result.samples += trained;
+		result.seconds += seconds;
+		pthread_mutex_unlock(&lock);
+	}
+};
+
+template <typename T>
+std::vector<T> parseList(const string & s) {
+	std::vector<T> v;
+	std::istringstream in(s);
+	string item;
+	while (getline(in, item, ',')) v.push_back((T)atof(item.c_str()));
+	return v;
+}
+
+/**
+ * Usage: sweep [key=value ...] with the keys (and defaults)
+ *   type=circle dimension=2 classes=2 samples=10000 seed=1    the dataset (see Generator.h)
+ *   folds=5                                                   k-fold, 0 is prequential
+ *   ageOld=8,16,32,100 lambda=16,50,100
+ *   random=0                                                  random settings within the ranges
+ *   threads=0                                                 0 is all processors
+ * Without random all combinations of the lists are tried. With random=N, N settings are drawn
+ * between the smallest and largest value of every list. The learning rates are not swept, because
+ * ILVQ_XSZ::updateLearningRates replaces them by its own schedule (based on the winner count)
+ * before every update.
+ */
+int main(int argc, char *argv[]) {
+	std::map<string,string> args;
+	args["type"] = "circle";
+	args["dimension"] = "2";
+	args["classes"] = "2";
+	args["samples"] = "10000";
+	args["seed"] = "1";
+	args["folds"] = "5";
+	args["ageOld"] = "8,16,32,100";
+	args["lambda"] = "16,50,100";
+	args["random"] = "0";
+	args["threads"] = "0";
+	for (int i = 1; i < argc; ++i) {
+		string a = argv[i];
+		string::size_type eq = a.find('=');
+		if (eq == string::npos || !args.count(a.substr(0, eq))) {
+			cerr << "Unknown argument " << a << endl;
+			return EXIT_FAILURE;
+		}
+		args[a.substr(0, eq)] = a.substr(eq + 1);
+	}
+	const char *names[GT_TYPES] = { "halves", "circle", "xor", "mixture", "manifold" };
+	GeneratorType type = GT_TYPES;
+	for (int t = 0; t < GT_TYPES; ++t) if (args["type"] == names[t]) type = (GeneratorType)t;
+	if (type == GT_TYPES) {
+		cerr << "Unknown type " << args["type"] << endl;
+		return EXIT_FAILURE;
+	}
+	const int N = atoi(args["samples"].c_str());
+	const uint64_t seed = strtoull(args["seed"].c_str(), NULL, 10);
+	Generator generator(generator_config(type, atoi(args["dimension"].c_str()), atoi(args["classes"].c_str()),
+			seed));
+	std::vector<ILVQ_ASPECT> data;
+	std::vector<ILVQ_CLASS_REPRESENTATION> classes;
+	generator.generate(0, N, data, classes);
+
+	std::vector<int> ageOld = parseList<int>(args["ageOld"]), lambda = parseList<int>(args["lambda"]);
+	if (ageOld.empty() || lambda.empty()) {
+		cerr << "Empty parameter list" << endl;
+		return EXIT_FAILURE;
+	}
+	Sweep sweep;
+	sweep.data = &data;
+	sweep.classes = &classes;
+	sweep.folds = atoi(args["folds"].c_str());
+	sweep.next = 0;
+	pthread_mutex_init(&sweep.lock, NULL);
+	Result empty = { { 0, 0 }, 0, 0, 0, 0, 0, 0 };
+	const int random = atoi(args["random"].c_str());
+	if (random > 0) {
+		CounterRNG rng(seed, 0xffffffffULL);
+		int a0 = *min_element(ageOld.begin(), ageOld.end()), a1 = *max_element(ageOld.begin(), ageOld.end());
+		int l0 = *min_element(lambda.begin(), lambda.end()), l1 = *max_element(lambda.begin(), lambda.end());
+		for (int r = 0; r < random; ++r) {
+			Result result = empty;
+			result.params.ageOld = a0 + (int)(rng.uniform() * (a1 - a0 + 1));
+			result.params.lambda = l0 + (int)(rng.uniform() * (l1 - l0 + 1));
+			sweep.results.push_back(result);
+		}
+	} else {
+		for (unsigned int a = 0; a < ageOld.size(); ++a)
+			for (unsigned int l = 0; l < lambda.size(); ++l) {
+				Result result = empty;
+				Params p = { ageOld[a], lambda[l] };
+				result.params = p;
+				sweep.results.push_back(result);
+			}
+	}
+	int threads = atoi(args["threads"].c_str());
+	if (threads <= 0) threads = hardware_threads();
+	const int runs = sweep.results.size() * std::max(sweep.folds, 1);
+	cout << "Sweep " << sweep.results.size() << " settings on " << N << " " << args["type"] << " samples, "
+			<< (sweep.folds ? args["folds"] + "-fold" : string("prequential")) << ", " << runs << " runs on "
+			<< threads << " threads" << endl;
+
+	double t0 = now();
+	parallel_for(threads, threads, sweep);
+	double t1 = now();
+	pthread_mutex_destroy(&sweep.lock);
+
+	std::sort(sweep.results.begin(), sweep.results.end(), better);
+	cout << setw(8) << "ageOld" << setw(8) << "lambda"
+			<< setw(10) << "accuracy" << setw(10) << "+-" << setw(12) << "prototypes" << setw(14) << "samples/s" << endl;
+	for (unsigned int i = 0; i < sweep.results.size(); ++i) {
+		const Result & r = sweep.results[i];
+		cout << setw(8) << r.params.ageOld << setw(8) << r.params.lambda << setw(10) << setprecision(4) << r.mean()
+				<< setw(10) << setprecision(2) << r.deviation()
+				<< setw(12) << setprecision(4) << r.prototypes / r.runs << setw(14) << setprecision(6)
+				<< (r.seconds > 0 ? r.samples / r.seconds : 0) << endl;
+	}
+	cout << "Done in " << (t1 - t0) << " s" << endl;
+	return EXIT_SUCCESS;
+}
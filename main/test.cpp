@@ -25,119 +25,111 @@
 #include <stdlib.h>
 #include <iostream>
 #include <time.h>
+#include <vector>
 
 #include <ilvq/ILVQ_XSZ.h>
+#include <ilvq/ILVQ_KWK.h>
+#include <ilvq/Generator.h>
+#include <ilvq/DecisionMap.h>
 #include <ilvq/defs.h>
 
-#if (RUNONPC==true)
-#include <DataDecorator.h>
-#include <Plot.h>
-#endif
-
 using namespace std;
 using namespace dobots;
 
-enum TestCase { TC_CIRCLE, TC_HALVES, TC_COUNT };
-
-TestCase testCase = TC_HALVES;
+// GT_CIRCLE: class 1 within the circle, GT_HALVES: class 1 in the left half (see Generator.h)
+GeneratorType testCase = GT_HALVES;
 
 /**
- * Input: expects x in [0,1], y in [0,1]
- * Will return if
+ * Usage: test [xsz|kwk] [seed]
+ * Without a seed the time is used, it is printed so a run can be repeated.
  */
-bool withinCircle(float x, float y) {
-	return ((2*x-1)*(2*x-1)+(2*y-1)*(2*y-1) < 1.0);
-}
-
-bool verticalHalves(float x, float y) {
-	return (x < 0.5);
-}
-
-
-void getRandomSample(ILVQ_ASPECT *aspect, ILVQ_CLASS_REPRESENTATION *c) {
-	float x = (float)drand48();
-	float y = (float)drand48();
-	switch (testCase) {
-	case TC_CIRCLE:
-		*c = withinCircle(x,y) ? 1 : 0;
-	break;
-	case TC_HALVES:
-		*c = verticalHalves(x,y) ? 1 : 0;
-	break;
-	default:
-		*c = verticalHalves(x,y) ? 1 : 0;
-		break;
-	}
-	aspect->clear();
-	aspect->push_back(x);
-	aspect->push_back(y);
-}
-
 int main(int argc, char *argv[]) {
 	cout << "Test for ILVQ" << endl;
-	srand48( time(NULL) );
-	ILVQ_TYPE lambda = 100;
-	ILVQ_XSZ *ilvq = new ILVQ_XSZ(lambda);
+	uint64_t seed = (argc > 2) ? strtoull(argv[2], NULL, 10) : time(NULL);
+	cout << "Seed " << seed << endl;
+	Generator generator(generator_config(testCase, 2, 2, seed));
+#ifdef ILVQ_TRACE
+	Trace::setCapacity(1 << 18);
+#endif
+	int lambda = 100;
+	// "test kwk" runs the same test with the Kirstein, Wersing, Körner variant
+	ILVQ *ilvq;
+	if (argc > 1 && string(argv[1]) == "kwk") {
+		cout << "Use ILVQ_KWK" << endl;
+		ilvq = new ILVQ_KWK();
+	} else {
+		ilvq = new ILVQ_XSZ(16, 0.1, 0.001, lambda);
+	}
 	ILVQ_ASPECT aspect;
 	ILVQ_CLASS_REPRESENTATION class_id;
 	int mis_classified = 0, correct_classified = 0;
 	int N = 100000;
-
-#if (RUNONPC==true)
-	int L = 256;
-	float *data = new float[L*L];
-	for (int i = 0; i < L; ++i) {
-		for (int j = 0; j < L; ++j) {
-			data[i+j*L] = 0;
-		}
-	}
-#endif
+	std::vector<ILVQ_ASPECT> test_set;
+	std::vector<ILVQ_CLASS_REPRESENTATION> test_classes;
 	for (int t = 0; t < N; ++t) {
+		generator.sample(t, aspect, class_id);
 		if (t < N*0.9) {
-			getRandomSample(&aspect, &class_id);
 			ilvq->add(aspect, class_id);
 		} else {
-			getRandomSample(&aspect, &class_id);
+			test_set.push_back(aspect);
+			test_classes.push_back(class_id);
 			ILVQ_CLASS_REPRESENTATION cl = ilvq->classify(aspect);
 			if (cl == class_id) {
 				correct_classified++;
 			} else {
 				mis_classified++;
 			}
-#if (RUNONPC==true)
-			int x = L * aspect[0];
-			int y = L * aspect[1];
-			float p = (0.99-(cl*0.5));
-			data[x+y*L]=p;
-			data[(x+1)%L+y*L]=p;
-			data[x+((y+1)%L)*L]=p;
-			data[(x+1)%L+((y+1)%L)*L]=p;
-#endif
 		}
 	}
 	cout << "Number of prototypes necessary: " << ilvq->getPrototypeCount() << "" << endl;
 	cout << "Classified [correct/incorrect]: [" << correct_classified << "/" << mis_classified << "]" << endl;
-	delete ilvq;
 
-#if (RUNONPC==true)
-	Plot *p = new Plot();
+	// the same test set once more as a single batch over all processors, now with a 5-NN vote
+	ILVQ_XSZ *xsz = dynamic_cast<ILVQ_XSZ*>(ilvq);
+	if (xsz != NULL) {
+		std::vector<ILVQ_CLASS_REPRESENTATION> knn_classes;
+		xsz->classifyKNN(test_set, 5, knn_classes, NULL, 0);
+		int knn_correct = 0;
+		for (unsigned int i = 0; i < test_set.size(); ++i) {
+			if (knn_classes[i] == test_classes[i]) knn_correct++;
+		}
+		cout << "Classified with 5-NN vote [correct/incorrect]: [" << knn_correct << "/"
+				<< (test_set.size() - knn_correct) << "]" << endl;
+
+		// can be served with main/server.cpp
+		FILE *model = fopen("ilvq.model", "wb");
+		if (model != NULL && xsz->save(model)) cout << "Model written to ilvq.model" << endl;
+		if (model != NULL) fclose(model);
+	}
+
+	// the decision regions over the unit square, with the prototypes
 	string f = "ilvq";
 	switch (testCase) {
-	case TC_CIRCLE:
+	case GT_CIRCLE:
 		f += "_circle";
 		break;
-	case TC_HALVES:
+	case GT_HALVES:
 		f += "_halves";
 		break;
 	default:
 		break;
 	}
-	p->SetFileName(f, PPM);
-	cout << "Write to file: " << f << endl;
-	DataContainer &dc = p->GetData();
-	dc.SetData(data, L*L);
-	p->Draw(PPM);
-	delete [] data;
+	f += ".ppm";
+	DecisionMap map(decision_map_config(256, 256, 2));
+	if (xsz != NULL) {
+		map.render(*xsz);
+		map.overlay(*xsz);
+	} else {
+		map.render(*ilvq);
+	}
+	if (map.write(f.c_str())) cout << "Decision map written to " << f << endl;
+	delete ilvq;
+
+#ifdef ILVQ_TRACE
+	FILE *trace = fopen("ilvq.trace", "wb");
+	cout << "Write " << Trace::dump(trace) << " trace events to ilvq.trace (dropped "
+			<< Trace::dropped() << ")" << endl;
+	fclose(trace);
 #endif
 
 	return EXIT_SUCCESS;
@@ -0,0 +1,85 @@
+/**
+ * @file tracedump.cpp
+ * @brief Offline decoder for the binary trace files written by Trace::dump
+ *
+ * This file is created at Almende B.V. It is open-source software and part of the Common
+ * Hybrid Agent Platform (CHAP). A toolbox with a lot of open-source tools, ranging from
+ * thread pools and TCP/IP components to control architectures and learning algorithms.
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless,
+ * we personally strongly object against this software used by the military, in the
+ * bio-industry, for animal experimentation, or anything that violates the Universal
+ * Declaration of Human Rights.
+ *
+ * Copyright © 2012 Anne van Rossum <anne@almende.com>
+ *
+ * @author     Anne C. van Rossum
+ * @date       Apr 22, 2012
+ * @project    Replicator FP7
+ * @company    Almende B.V.
+ * @case       Machine learning (fit for Surveyeor robots)
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <iostream>
+#include <vector>
+#include <algorithm>
+
+#include <ilvq/Trace.h>
+
+using namespace std;
+using namespace dobots;
+
+bool earlier(const TraceEvent & e0, const TraceEvent & e1) {
+	return e0.timestamp < e1.timestamp;
+}
+
+/**
+ * Usage: tracedump <file> [--sort]
+ * Prints one line per event: time (relative to first event, in us), thread, type, ids, class
+ * and distances. With --sort the events of all threads are merged on timestamp.
+ */
+int main(int argc, char *argv[]) {
+	if (argc < 2) {
+		cerr << "Usage: " << argv[0] << " <trace file> [--sort]" << endl;
+		return EXIT_FAILURE;
+	}
+	FILE *file = fopen(argv[1], "rb");
+	if (file == NULL) {
+		cerr << "Cannot open " << argv[1] << endl;
+		return EXIT_FAILURE;
+	}
+	if (!Trace::readHeader(file)) {
+		cerr << "Not a trace file (or written by another version): " << argv[1] << endl;
+		fclose(file);
+		return EXIT_FAILURE;
+	}
+	std::vector<TraceEvent> events;
+	TraceEvent buf[1024];
+	size_t n;
+	while ((n = fread(buf, sizeof(TraceEvent), 1024, file)) > 0) {
+		events.insert(events.end(), buf, buf + n);
+	}
+	fclose(file);
+
+	if (argc > 2 && string(argv[2]) == "--sort") {
+		std::stable_sort(events.begin(), events.end(), earlier);
+	}
+
+	int count[TE_TYPES] = { 0 };
+	uint64_t t0 = events.empty() ? 0 : events.front().timestamp;
+	for (unsigned int i = 0; i < events.size(); ++i) {
+		const TraceEvent & e = events[i];
+		printf("%12.3f %3d %-8s %6d %6d %4d %g %g\n", (double)(e.timestamp - t0) / 1000.0,
+				e.thread, Trace::name(e.type), e.id1, e.id2, e.class_id, e.d1, e.d2);
+		if (e.type < TE_TYPES) count[e.type]++;
+	}
+	cerr << "Read " << events.size() << " events:";
+	for (int t = TE_WINNERS; t < TE_TYPES; ++t) {
+		cerr << " " << Trace::name(t) << "=" << count[t];
+	}
+	cerr << endl;
+	return EXIT_SUCCESS;
+}
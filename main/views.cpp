@@ -0,0 +1,156 @@
+/**
+ * @file views.cpp
+ * @brief Train with multi-modal inputs of which modalities are missing, and check the result
+ *
+ * This file is created at Almende B.V. It is open-source software and part of the Common
+ * Hybrid Agent Platform (CHAP). A toolbox with a lot of open-source tools, ranging from
+ * thread pools and TCP/IP components to control architectures and learning algorithms.
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless,
+ * we personally strongly object against this software used by the military, in the
+ * bio-industry, for animal experimentation, or anything that violates the Universal
+ * Declaration of Human Rights.
+ *
+ * Copyright © 2012 Anne van Rossum <anne@almende.com>
+ *
+ * @author     Anne C. van Rossum
+ * @date       Apr 22, 2012
+ * @project    Replicator FP7
+ * @company    Almende B.V.
+ * @case       Machine learning (fit for Surveyeor robots)
+ */
+
+#include <stdlib.h>
+#include <iostream>
+#include <vector>
+#include <string>
+
+#include <ilvq/ILVQ_XSZ.h>
+#include <ilvq/Generator.h>
+#include <ilvq/defs.h>
+
+using namespace std;
+using namespace dobots;
+
+//! Dimension of the second modality, a noisy code of the class
+#define CODE_DIMENSION 4
+
+//! The code of class c with uniform noise of the given amplitude
+void getCode(ILVQ_CLASS_REPRESENTATION c, float noise, ILVQ_ASPECT & a) {
+	a.resize(CODE_DIMENSION);
+	for (int i = 0; i < CODE_DIMENSION; ++i) {
+		a[i] = ((i % 2) == c) + noise * (float)(drand48() - 0.5);
+	}
+}
+
+//! Share of the inputs of which the class is right, with only the modalities in "use" (bit per modality)
+double accuracy(ILVQ_XSZ & ilvq, std::vector<ILVQ_ASPECT> & points, std::vector<ILVQ_ASPECT> & codes,
+		const std::vector<ILVQ_CLASS_REPRESENTATION> & classes, int use) {
+	int correct = 0;
+	ILVQ_VIEW view(2);
+	for (unsigned int t = 0; t < classes.size(); ++t) {
+		view[0] = (use & 1) ? &points[t] : NULL;
+		view[1] = (use & 2) ? &codes[t] : NULL;
+		if (ilvq.classify(view) == classes[t]) correct++;
+	}
+	return correct / (double)classes.size();
+}
+
+//! Number of prototypes of which a modality is all zeros, which happens only if it was never seen
+int zeroModalities(ILVQ_XSZ & ilvq, const std::vector<ILVQ_MODALITY> & modalities) {
+	int n = ilvq.getPrototypeCount(), dim = ilvq.getDimension();
+	std::vector<ILVQ_TYPE> positions(n * dim), norms(n);
+	std::vector<ILVQ_CLASS_REPRESENTATION> classes(n);
+	ilvq.exportPrototypes(&positions[0], &norms[0], &classes[0]);
+	int zero = 0;
+	for (int j = 0; j < n; ++j) {
+		for (unsigned int m = 0; m < modalities.size(); ++m) {
+			const ILVQ_TYPE *w = &positions[j * dim + modalities[m].offset];
+			int i = 0;
+			while (i < modalities[m].dimension && w[i] == 0) i++;
+			if (i == modalities[m].dimension) {
+				zero++;
+				break;
+			}
+		}
+	}
+	return zero;
+}
+
+/**
+ * Usage: views [train samples] [test samples] [missing] [noise]
+ * The first modality is a point in the circle data set (see Generator.h), the second a code of the
+ * class with uniform noise. One model is trained on complete inputs, the other on inputs of which
+ * a random modality is missing with probability "missing". Both are tested on complete inputs and
+ * on either modality alone. Only the very first prototype may lack a modality, and leaving out
+ * modalities while training should cost little accuracy on complete inputs.
+ */
+int main(int argc, char *argv[]) {
+	int N_train = (argc > 1) ? atoi(argv[1]) : 20000;
+	int N_test = (argc > 2) ? atoi(argv[2]) : 2000;
+	double missing = (argc > 3) ? atof(argv[3]) : 0.5;
+	float noise = (argc > 4) ? atof(argv[4]) : 1.5;
+
+	std::vector<ILVQ_MODALITY> modalities(2);
+	modalities[0].dimension = 2;
+	modalities[0].metric = DM_EUCLIDEAN;
+	modalities[0].weight = 1;
+	modalities[0].offset = 0;
+	modalities[1].dimension = CODE_DIMENSION;
+	modalities[1].metric = DM_COSINE;
+	modalities[1].weight = 1;
+	modalities[1].offset = 2; // as setModalities packs them
+
+	std::vector<ILVQ_ASPECT> train, test, train_codes, test_codes;
+	std::vector<ILVQ_CLASS_REPRESENTATION> train_classes, test_classes;
+	Generator g(generator_config(GT_CIRCLE, 2, 2, 1));
+	g.generate(0, N_train, train, train_classes);
+	g.generate(N_train, N_test, test, test_classes);
+	srand48(1);
+	train_codes.resize(N_train);
+	for (int t = 0; t < N_train; ++t) getCode(train_classes[t], noise, train_codes[t]);
+	test_codes.resize(N_test);
+	for (int t = 0; t < N_test; ++t) getCode(test_classes[t], noise, test_codes[t]);
+
+	ILVQ_XSZ full(100, 0.1, 0.001, 16), partial(100, 0.1, 0.001, 16);
+	full.setModalities(modalities);
+	partial.setModalities(modalities);
+	ILVQ_VIEW view(2);
+	int absent = 0;
+	for (int t = 0; t < N_train; ++t) {
+		view[0] = &train[t];
+		view[1] = &train_codes[t];
+		full.add(view, train_classes[t]);
+		if (drand48() < missing) {
+			view[lrand48() % 2] = NULL;
+			absent++;
+		}
+		partial.add(view, train_classes[t]);
+	}
+
+	const char *names[4] = { "", "points only", "codes only", "complete" };
+	cout << "Trained with " << absent << " of " << N_train << " inputs missing a modality" << endl;
+	cout << "Prototypes:     " << full.getPrototypeCount() << " complete, " << partial.getPrototypeCount()
+			<< " partial" << endl;
+	double acc_full[4], acc_partial[4];
+	for (int use = 1; use < 4; ++use) {
+		acc_full[use] = accuracy(full, test, test_codes, test_classes, use);
+		acc_partial[use] = accuracy(partial, test, test_codes, test_classes, use);
+		cout << "Accuracy, " << names[use] << ": " << acc_full[use] << " complete, " << acc_partial[use]
+				<< " partial" << endl;
+	}
+	int zero = zeroModalities(partial, modalities);
+	cout << "Prototypes that lack a modality: " << zero << endl;
+
+	bool ok = true;
+	if (zero > 1) {
+		cerr << "Check failed: absent modalities of new prototypes are not taken from the winner" << endl;
+		ok = false;
+	}
+	if (acc_partial[3] < acc_full[3] - 0.05) {
+		cerr << "Check failed: training on partial inputs costs too much accuracy" << endl;
+		ok = false;
+	}
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,116 @@
+/**
+ * @file wal.cpp
+ * @brief Train with a write-ahead log, crash on purpose, and recover
+ *
+ * This file is created at Almende B.V. It is open-source software and part of the Common
+ * Hybrid Agent Platform (CHAP). A toolbox with a lot of open-source tools, ranging from
+ * thread pools and TCP/IP components to control architectures and learning algorithms.
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless,
+ * we personally strongly object against this software used by the military, in the
+ * bio-industry, for animal experimentation, or anything that violates the Universal
+ * Declaration of Human Rights.
+ *
+ * Copyright © 2012 Anne van Rossum <anne@almende.com>
+ *
+ * @author     Anne C. van Rossum
+ * @date       Apr 22, 2012
+ * @project    Replicator FP7
+ * @company    Almende B.V.
+ * @case       Machine learning (fit for Surveyeor robots)
+ */
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <iostream>
+#include <string>
+#include <algorithm>
+#include <time.h>
+
+#include <ilvq/WriteAheadLog.h>
+
+using namespace std;
+using namespace dobots;
+
+double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+//! Uniform sample in [0,1]^D, the class is determined by a circle in the first two dimensions
+void getSample(int dimension, ILVQ_ASPECT & a, ILVQ_CLASS_REPRESENTATION & c) {
+	a.resize(dimension);
+	for (int i = 0; i < dimension; ++i) a[i] = (float)drand48();
+	float x = a[0], y = (dimension > 1) ? a[1] : 0.5;
+	c = ((2*x-1)*(2*x-1)+(2*y-1)*(2*y-1) < 1.0) ? 1 : 0;
+}
+
+/**
+ * Usage: wal train [path] [samples] [crash after] [compact every] [dimension] [background]
+ *        wal recover [path]
+ * Training goes on from what is recovered. With "crash after" > 0 the process exits without
+ * writing or syncing anything after that many samples, as in a crash. With background 1 the
+ * snapshots are written by a forked child. The longest add() shows how long training stalls.
+ */
+int main(int argc, char *argv[]) {
+	string mode = (argc > 1) ? argv[1] : "train";
+	string path = (argc > 2) ? argv[2] : "ilvq";
+	long samples = (argc > 3) ? atol(argv[3]) : 100000;
+	long crash = (argc > 4) ? atol(argv[4]) : 0;
+	WalConfig config;
+	config.group = 64;
+	config.sync_every = 1024;
+	config.sync_ms = 100;
+	config.compact_every = (argc > 5) ? atoi(argv[5]) : 50000;
+	int dimension = (argc > 6) ? atoi(argv[6]) : 2;
+	config.background = (argc > 7) ? atoi(argv[7]) : false;
+
+	ILVQ_XSZ ilvq(100, 0.1, 0.001, 16);
+	WriteAheadLog log(ilvq, path, config);
+	double t0 = now();
+	if (!log.recover()) return EXIT_FAILURE;
+	double t1 = now();
+	cout << "Recovered " << ilvq.getPrototypeCount() << " prototypes, replayed " << log.getReplayed()
+			<< " records in " << (t1 - t0) << " s" << endl;
+	if (mode == "recover") return EXIT_SUCCESS;
+
+	srand48(getpid());
+	ILVQ_ASPECT a;
+	ILVQ_CLASS_REPRESENTATION c;
+	double max_add = 0;
+	long rejected = 0;
+	WalSnapshotState state = WS_NONE;
+	t0 = now();
+	for (long t = 0; t < samples; ++t) {
+		if (crash && t == crash) {
+			cout << "Crash after " << t << " samples with " << log.getRecords() << " records in the log" << endl;
+			_exit(EXIT_FAILURE);
+		}
+		getSample(dimension, a, c);
+		long before = log.getRecords();
+		double t2 = now();
+		if (!log.add(a, c)) rejected++;
+		max_add = std::max(max_add, now() - t2);
+		if (log.getRecords() < before) {
+			cout << "Compaction at sample " << t << ", add() took " << (now() - t2) * 1e6 << " us" << endl;
+		}
+		if (log.pollSnapshot() != state) {
+			state = log.pollSnapshot();
+			if (state == WS_RUNNING) cout << "Background snapshot started, fork and rotation took "
+					<< log.getStall() << " us" << endl;
+			if (state == WS_DONE) cout << "Background snapshot done at sample " << t << endl;
+			if (state == WS_FAILED) cout << "Background snapshot failed at sample " << t << endl;
+		}
+		if (state == WS_RUNNING && !(t % 10000)) {
+			cout << "Background snapshot at " << (int)(log.getSnapshotProgress() * 100) << "%" << endl;
+		}
+	}
+	t1 = now();
+	cout << "Train:          " << (t1 - t0) << " s, " << (samples / (t1 - t0)) << " samples/s" << endl;
+	cout << "Longest add():  " << (max_add * 1e6) << " us" << endl;
+	cout << "Prototypes:     " << ilvq.getPrototypeCount() << ", records in the log " << log.getRecords() << endl;
+	if (rejected) cout << "Rejected:       " << rejected << " samples that could not be logged" << endl;
+	return EXIT_SUCCESS;
+}
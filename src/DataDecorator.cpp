@@ -24,22 +24,69 @@
 
 // General files
 #include <iostream>
-#include <locale>
+#include <iterator>
+#include <iomanip>
 #include <vector>
+#include <limits>
+#include <algorithm>
 #include <assert.h>
 #include <cmath>
+#include <errno.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#if __cplusplus >= 201703L
+#include <charconv>
+#if defined(__cpp_lib_to_chars)
+#define DATADECORATOR_FROM_CHARS
+#endif
+#endif
 
 #include <DataDecorator.h>
 #include <EventCounter.hpp>
+#include <ilvq/Parallel.hpp>
 
 using namespace std;
 
+//! Order of the pairs on x only, so a stable sort keeps the first of equal x in front
+template <typename X, typename Y>
+static bool less_first(const std::pair<X,Y> & a, const std::pair<X,Y> & b) {
+	return a.first < b.first;
+}
+
+template <typename X, typename Y>
+static bool equal_first(const std::pair<X,Y> & a, const std::pair<X,Y> & b) {
+	return a.first == b.first;
+}
+
+//! Add the (x, count) pairs of a map or of DT_FLAT data to an estimator, without a copy
+template <typename Iterator>
+static void add_events(Iterator begin, Iterator end, dobots::PowerLawEstimator & estimator) {
+	for (Iterator it = begin; it != end; ++it) estimator.addEvent(it->first, it->second);
+}
+
+//! The same for an event counter
+template <typename Iterator>
+static void add_events(Iterator begin, Iterator end, EventCounter<DataDecoratorType> & counter) {
+	for (Iterator it = begin; it != end; ++it) counter.AddEvent(it->first, it->second);
+}
+
 /* **************************************************************************************
  * Implementation of DataContainer
  * **************************************************************************************/
 
-DataContainer::DataContainer(): id(-1) {
+DataContainer::DataContainer(): id(-1),
+		dataType(DT_MAP),
+		map_data(NULL),
+		flat_data(NULL),
+		float_data(NULL),
+		float_data_len(0),
+		estimated(false),
+		fitted(false) {
 
 }
 
@@ -49,31 +96,44 @@ DataContainer::~DataContainer() {
 
 /**
  * It is not good to estimate power law distributions by linear regression (see wikipedia,
- * or [1]). Maximum likelihood should be used instead.
+ * or [1]). Maximum likelihood should be used instead. The estimator is kept with the container,
+ * so after a fit of x_min the events that are added update the exponent in O(1). The fit is
+ * repeated only if the data is replaced (SetData, read, ApplyBins, clear) or Sort drops pairs.
  * [1] Power-law Distributions in Empirical Data (2009) Clauset et al.
  */
 float DataContainer::CalculateSlope() {
 	// alpha estimation = 1 + n [ sum_i^N ln (x_i / (x_min - 1/2) ) ]^-1
-	if (dataType != DT_MAP) return -1.0;
-	float alpha;
-	int x_min = 1; float denom = 1.0 /(x_min - 0.5);
+	if (dataType != DT_MAP && dataType != DT_FLAT) return -1.0;
+	Estimate();
+	if (!fitted) FitPowerLaw();
+	cout << "Using x_min=" << estimator.getXMin() << " resulting in n=" << estimator.getTail() << " samples" << endl;
+	return estimator.getAlpha();
+}
 
-//	int x_max = 10000;
+dobots::PowerLawFit DataContainer::FitPowerLaw(int threads, int max_candidates) {
+	if (dataType != DT_MAP && dataType != DT_FLAT) return dobots::PowerLawEstimator().fit(threads, max_candidates);
+	Estimate();
+	fitted = true;
+	return estimator.fit(threads, max_candidates);
+}
 
-	float sum = 0; int N = 0;
-	std::map<DataDecoratorType,int>::iterator it;
-	for (it = map_data->begin(); it != map_data->end(); ++it) {
-		int value = it->first;
-		if (value < x_min) continue;
-//		if (value > x_max) continue;
-		int count = it->second;
-		N += count;
-		sum += count * std::log(value * denom);
-	}
-	cout << "Using x_min=" << x_min << " resulting in n=" << N << " samples" << endl;
-	alpha = 1 + N / sum;
+/**
+ * The data is sorted, so the estimator takes it in linear time.
+ */
+void DataContainer::Estimate() {
+	if (estimated) return;
+	estimator.clear();
+	estimator.setXMin(1);
+	if (dataType == DT_FLAT) add_events(flat_data->begin(), flat_data->end(), estimator);
+	else add_events(map_data->begin(), map_data->end(), estimator);
+	estimated = true;
+	fitted = false;
+}
 
-	return alpha;
+void DataContainer::AddEvent(DataDecoratorType x, int count) {
+	assert (dataType == DT_MAP && map_data != NULL);
+	(*map_data)[x] += count;
+	if (estimated) estimator.addEvent(x, count);
 }
 
 /**
@@ -83,6 +143,7 @@ int DataContainer::size() {
 	switch(dataType) {
 	case DT_MAP: assert (map_data != NULL); return map_data->size();
 	case DT_F2DARRAY: return float_data_len;
+	case DT_FLAT: assert (flat_data != NULL); return flat_data->size();
 	default:
 		cerr << "Size: Unknown data type" << endl;
 	}
@@ -98,83 +159,272 @@ float DataContainer::item<float>(int index) {
 /**
  * Actually, this function is quite "stupid". A map is not a random access container, so having
  * an index doesn't make sense. A call to item is of order O(N) (and not of order O(1)). However,
- * if it is only used once for plotting or so, everything might be fine.
+ * if it is only used once for plotting or so, everything might be fine. With DT_FLAT it is O(1),
+ * or use Flatten to go over a map in linear time.
  */
 template<>
 pair<DataDecoratorType,int> DataContainer::item< pair<DataDecoratorType,int> >(int index) {
+	if (dataType == DT_FLAT) return (*flat_data)[index];
 	assert (dataType == DT_MAP);
 	std::map<DataDecoratorType,int>::iterator it( map_data->begin() );
 	std::advance( it, index );
 	return *it;
 }
 
+void DataContainer::Sort() {
+	assert (dataType == DT_FLAT);
+	DataFlat & d = *flat_data;
+	bool sorted = true;
+	for (unsigned int i = 1; i < d.size() && sorted; ++i) sorted = d[i-1].first < d[i].first;
+	if (sorted) return;
+	std::stable_sort(d.begin(), d.end(), less_first<DataDecoratorType,int>);
+	DataFlat::iterator last = std::unique(d.begin(), d.end(), equal_first<DataDecoratorType,int>);
+	// the estimator counted the pairs that are dropped
+	if (last != d.end()) estimated = false;
+	d.erase(last, d.end());
+}
+
+int DataContainer::Count(DataDecoratorType x) {
+	switch(dataType) {
+	case DT_MAP: {
+		std::map<DataDecoratorType,int>::const_iterator it = map_data->find(x);
+		return (it == map_data->end()) ? 0 : it->second;
+	}
+	case DT_FLAT: {
+		DataFlat::const_iterator it = std::lower_bound(flat_data->begin(), flat_data->end(), make_pair(x, 0),
+				less_first<DataDecoratorType,int>);
+		return (it == flat_data->end() || it->first != x) ? 0 : it->second;
+	}
+	default:
+		cerr << "Count: Unknown data type" << endl;
+	}
+	return 0;
+}
+
+void DataContainer::Flatten(DataFlat & out) {
+	switch(dataType) {
+	case DT_MAP:
+		out.assign(map_data->begin(), map_data->end());
+		break;
+	case DT_FLAT:
+		out = *flat_data;
+		break;
+	default:
+		out.clear();
+		cerr << "Flatten: Unknown data type" << endl;
+	}
+}
+
+//! Separators between the numbers, the old reader with a ctype locale had only the first three
+static inline bool separator(char c) {
+	return c == ':' || c == ' ' || c == '\n' || c == '\t' || c == '\r';
+}
+
+/**
+ * Locale-free conversion of the number at p, returns the end of it or NULL if there is none. A
+ * plus sign is skipped, as operator>> did. Without std::from_chars the token is copied so it ends
+ * with a zero for strtod/strtol, which do use the C locale.
+ */
+template <typename T>
+static inline const char *parse_number(const char *p, const char *end, T & value) {
+	if (p < end && *p == '+') ++p;
+#ifdef DATADECORATOR_FROM_CHARS
+	std::from_chars_result r = std::from_chars(p, end, value);
+	return (r.ec == std::errc()) ? r.ptr : NULL;
+#else
+	char token[64];
+	int n = 0;
+	while (p + n < end && n < 63 && !separator(p[n])) {
+		token[n] = p[n];
+		n++;
+	}
+	token[n] = 0;
+	char *stop;
+	errno = 0;
+	if (std::numeric_limits<T>::is_integer) {
+		long v = strtol(token, &stop, 10);
+		if (v < std::numeric_limits<T>::min() || v > std::numeric_limits<T>::max()) errno = ERANGE;
+		value = v;
+	} else {
+		value = strtod(token, &stop);
+	}
+	return (stop == token || errno == ERANGE) ? NULL : p + (stop - token);
+#endif
+}
+
 /**
- * Local class that knows that colons can be treated as white spaces. It is
- * used by read.
+ * Parses chunks of a buffer that start and end at a line end. A pair that is cut in two by the
+ * end of a chunk is "dangling". The parsing of a chunk stops at the first number that can not be
+ * read, like operator>> does, and then it is marked as failed.
  */
-struct colonsep: std::ctype<char> {
-	colonsep(): std::ctype<char>(get_table()) {}
+template <typename X, typename Y>
+struct DataParseJob {
+	std::vector<const char*> bounds; // begin of every chunk and the end of the last
+	std::vector<std::vector<std::pair<X,Y> > > pairs;
+	std::vector<char> failed, dangling;
 
-	static std::ctype_base::mask const* get_table() {
-		static std::vector<std::ctype_base::mask>
-		rc(std::ctype<char>::table_size,std::ctype_base::mask());
+	DataParseJob(int chunks): bounds(chunks + 1), pairs(chunks), failed(chunks), dangling(chunks) {}
 
-		rc[':'] = std::ctype_base::space;
-		rc[' '] = std::ctype_base::space;
-		rc['\n'] = std::ctype_base::space;
-		return &rc[0];
+	void operator()(int begin, int end, int thread) {
+		for (int c = begin; c < end; ++c) parse(c);
+	}
+
+	void parse(int c) {
+		const char *p = bounds[c], *e = bounds[c+1];
+		while (p < e && separator(*p)) ++p;
+		while (p < e) {
+			X x;
+			Y y;
+			const char *q = parse_number(p, e, x);
+			if (q == NULL) { failed[c] = true; return; }
+			for (p = q; p < e && separator(*p); ++p);
+			if (p == e) { dangling[c] = true; return; }
+			q = parse_number(p, e, y);
+			if (q == NULL) { failed[c] = true; return; }
+			pairs[c].push_back(std::make_pair(x, y));
+			for (p = q; p < e && separator(*p); ++p);
+		}
 	}
 };
 
+//! Minimum size of a chunk that gets its own thread
+#define DATA_PARSE_CHUNK (1 << 20)
+
 /**
- * Read data from a file. Only DT_MAP is tested. With an array it is hard to set the
- * size beforehand properly (except if you know what to retrieve).
+ * Split the buffer at line ends and parse the chunks in parallel. The pairs are collected in order
+ * up to the first failure. If a pair is spread over two lines at the edge of a chunk (writes never
+ * do that), the whole buffer is parsed again as one chunk.
  */
-void DataContainer::read(std::istream& in) { //, DataDecoratorType resolution) {
-	DataDecoratorType x;
+template <typename X, typename Y>
+static void parse_pairs(const char *begin, const char *end, int threads, std::vector<std::pair<X,Y> > & out) {
+	if (threads <= 0) threads = dobots::hardware_threads();
+	int chunks = std::max(1, std::min<int>(threads, (end - begin) / DATA_PARSE_CHUNK));
+	DataParseJob<X,Y> job(chunks);
+	job.bounds[0] = begin;
+	for (int c = 1; c < chunks; ++c) {
+		const char *p = begin + ((end - begin) * (long)c) / chunks;
+		p = std::max(p, job.bounds[c-1]);
+		while (p < end && *p != '\n') ++p;
+		job.bounds[c] = (p < end) ? p + 1 : end;
+	}
+	job.bounds[chunks] = end;
+	dobots::parallel_for(chunks, threads, job);
+	for (int c = 0; c < chunks - 1; ++c) {
+		if (job.failed[c]) break;
+		if (job.dangling[c]) {
+			DataParseJob<X,Y> serial(1);
+			serial.bounds[0] = begin;
+			serial.bounds[1] = end;
+			serial.parse(0);
+			out.swap(serial.pairs[0]);
+			return;
+		}
+	}
+	out.clear();
+	for (int c = 0; c < chunks; ++c) {
+		out.insert(out.end(), job.pairs[c].begin(), job.pairs[c].end());
+		if (job.failed[c]) break;
+	}
+}
+
+/**
+ * The result is the same as that of inserting the pairs one by one: for DT_MAP (and DT_FLAT) the
+ * first pair with a given x wins, for DT_F2DARRAY the last one, and an index outside of the array
+ * stops the reading. The map is filled in order with a hint, so that is linear if the file is
+ * sorted (as write makes it), else the pairs are sorted first.
+ */
+void DataContainer::parse(const char *begin, const char *end, int threads) {
 	switch(dataType) {
-	case DT_MAP:
-		assert (map_data != NULL);
+	case DT_MAP: case DT_FLAT: {
+		assert (map_data != NULL || dataType == DT_FLAT);
+		assert (flat_data != NULL || dataType == DT_MAP);
+		DataFlat pairs;
+		parse_pairs(begin, end, threads, pairs);
+		bool sorted = true;
+		for (unsigned int i = 1; i < pairs.size() && sorted; ++i) sorted = pairs[i-1].first < pairs[i].first;
+		if (!sorted) {
+			std::stable_sort(pairs.begin(), pairs.end(), less_first<DataDecoratorType,int>);
+			pairs.erase(std::unique(pairs.begin(), pairs.end(), equal_first<DataDecoratorType,int>), pairs.end());
+		}
+		// the estimator is built on first use, so a plain load stays as fast as it was
+		estimated = fitted = false;
+		if (dataType == DT_FLAT) {
+			flat_data->swap(pairs);
+			break;
+		}
 		map_data->clear();
-		int y;
-		in.imbue(std::locale(std::locale(), new colonsep));
-
-		while(in >> x >> y) {
-//			if (resolution > 0) {
-//				int x_ins = (int)(x * resolution);
-//				x = x_ins / (DataDecoratorType)resolution;
-//			}
-			map_data->insert(make_pair<DataDecoratorType,int>(x, y));
-			assert(y != 0);
-//			cout << "x and y: " << x << " and " << y << endl;
+		for (unsigned int i = 0; i < pairs.size(); ++i) {
+			assert(pairs[i].second != 0);
+			map_data->insert(map_data->end(), pairs[i]);
 		}
-//		cout << "Read " << map_data->size() << " items" << endl;
 		break;
-	case DT_F2DARRAY:
+	}
+	case DT_F2DARRAY: {
 		assert (float_data != NULL);
-		int ix;
-		float fy;
-		in.imbue(std::locale(std::locale(), new colonsep));
-		while(in >> ix >> fy) {
-			if (ix >= float_data_len) {
+		std::vector<std::pair<int,float> > pairs;
+		parse_pairs(begin, end, threads, pairs);
+		for (unsigned int i = 0; i < pairs.size(); ++i) {
+			if (pairs[i].first < 0 || pairs[i].first >= float_data_len) {
 				cerr << "Array is not large enough (" << float_data_len << ")" << endl;
 				break;
 			}
-			float_data[ix] = fy;
-			cout << "x and y: " << ix << " and " << fy << endl;
+			float_data[pairs[i].first] = pairs[i].second;
 		}
 		break;
-
+	}
 	default:
 		cerr << "Read: Unknown data type" << endl;
 	}
 }
 
+/**
+ * Read data from a stream of "x: y" pairs, x is a double and y an int for DT_MAP. For
+ * DT_F2DARRAY x is an index in the array and y a float, the array should be large enough.
+ */
+void DataContainer::read(std::istream& in) { //, DataDecoratorType resolution) {
+	std::string buffer((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+	parse(buffer.data(), buffer.data() + buffer.size(), 1);
+}
+
+/**
+ * The same, but the file is mapped in memory instead of copied, and larger files are split over
+ * threads.
+ */
+bool DataContainer::read(const std::string & filename, int threads) {
+	int fd = open(filename.c_str(), O_RDONLY);
+	if (fd < 0) {
+		cerr << "Can not open " << filename << endl;
+		return false;
+	}
+	struct stat st;
+	if (fstat(fd, &st) < 0) {
+		cerr << "Can not stat " << filename << endl;
+		close(fd);
+		return false;
+	}
+	if (st.st_size == 0) {
+		close(fd);
+		parse(NULL, NULL, 1);
+		return true;
+	}
+	void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) {
+		cerr << "Can not map " << filename << endl;
+		return false;
+	}
+	madvise(data, st.st_size, MADV_SEQUENTIAL);
+	parse((const char*)data, (const char*)data + st.st_size, threads);
+	munmap(data, st.st_size);
+	return true;
+}
+
 /**
  * Write map_data to a file
  */
 void DataContainer::write(std::ostream& out) {
 	std::map<DataDecoratorType,int>::const_iterator i;
+	DataFlat::const_iterator j;
 	out << fixed << setprecision (10);
 	switch(dataType) {
 	case DT_MAP:
@@ -183,6 +433,12 @@ void DataContainer::write(std::ostream& out) {
 			out << i->first << ": " << i->second << "\n";
 		}
 		break;
+	case DT_FLAT:
+		assert (flat_data != NULL);
+		for (j = flat_data->begin(); j != flat_data->end(); ++j) {
+			out << j->first << ": " << j->second << "\n";
+		}
+		break;
 	case DT_F2DARRAY:
 //		cerr << "We don't know how to write this" << endl;
 		break;
@@ -197,26 +453,35 @@ void DataContainer::clear() {
 		assert (map_data != NULL);
 		map_data->clear();
 		break;
+	case DT_FLAT:
+		assert (flat_data != NULL);
+		flat_data->clear();
+		break;
 	default:
 		cerr << "Clear: Unknown data type" << endl;
 	}
+	estimated = fitted = false;
 }
 
 void DataContainer::ApplyBins(int no_bins, DataDecoratorType min, DataDecoratorType max) {
-	assert (dataType == DT_MAP);
+	assert (dataType == DT_MAP || dataType == DT_FLAT);
 
 //	write(std::cout);
 
 	std::map<DataDecoratorType,int>::const_iterator i;
 	EventCounter<DataDecoratorType> ec;
-	for (i = map_data->begin(); i != map_data->end(); ++i) {
-		ec.AddEvent(i->first, i->second);
-	}
+	if (dataType == DT_FLAT) add_events(flat_data->begin(), flat_data->end(), ec);
+	else add_events(map_data->begin(), map_data->end(), ec);
 	ec.Bin(no_bins, min, max);
+	estimated = false;
 
+	if (dataType == DT_FLAT) {
+		flat_data->assign(ec.getEvents().begin(), ec.getEvents().end());
+		return;
+	}
 	map_data->clear();
 	for (i = ec.getEvents().begin(); i != ec.getEvents().end(); ++i) {
-		map_data->insert(make_pair<DataDecoratorType,int>(i->first, i->second));
+		map_data->insert(make_pair(i->first, i->second));
 	}
 
 //	cout << "After bins: " << endl;
@@ -0,0 +1,240 @@
+/**
+ * @brief Image of the decision regions of a model in two of its input dimensions
+ * @file DecisionMap.cpp
+ *
+ * This file is created at Almende B.V. It is open-source software and part of the Common
+ * Hybrid Agent Platform (CHAP). A toolbox with a lot of open-source tools, ranging from
+ * thread pools and TCP/IP components to control architectures and learning algorithms.
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless,
+ * we personally strongly object against this software used by the military, in the
+ * bio-industry, for animal experimentation, or anything that violates the Universal
+ * Declaration of Human Rights.
+ *
+ * Copyright © 2012 Anne van Rossum <anne@almende.com>
+ *
+ * @author     Anne C. van Rossum
+ * @date       Apr 22, 2012
+ * @project    Replicator FP7
+ * @company    Almende B.V.
+ * @case       Machine learning (fit for Surveyeor robots)
+ */
+
+
+#include <ilvq/DecisionMap.h>
+
+#include <iostream>
+#include <limits>
+#include <cmath>
+#include <stdio.h>
+#include <assert.h>
+
+using namespace dobots;
+using namespace std;
+
+//! Number of nearest prototypes looked at for the center of a block
+#define DECISION_MAP_K 8
+
+//! Maximum number of inputs that are classified in one batch
+#define DECISION_MAP_BATCH 65536
+
+struct DecisionBlock {
+	int x, y, w, h;
+};
+
+DecisionMapConfig dobots::decision_map_config(int width, int height, int dimension) {
+	DecisionMapConfig c;
+	c.width = width;
+	c.height = height;
+	c.dimension = dimension;
+	c.x_dim = 0;
+	c.y_dim = std::min(1, dimension - 1);
+	c.x_min = c.y_min = 0;
+	c.x_max = c.y_max = 1;
+	c.classes = 2;
+	c.block = 32;
+	c.threads = 0;
+	return c;
+}
+
+DecisionMap::DecisionMap(const DecisionMapConfig & config): config(config),
+		evaluated(0) {
+	assert (config.width > 0 && config.height > 0 && config.dimension > 0);
+	assert (config.x_dim >= 0 && config.x_dim < config.dimension);
+	assert (config.y_dim >= 0 && config.y_dim < config.dimension);
+	assert (config.base.empty() || (int)config.base.size() == config.dimension);
+	sx = (config.x_max - config.x_min) / config.width;
+	sy = (config.y_max - config.y_min) / config.height;
+	classes.resize(config.width * config.height, -1);
+	image.resize(config.width * config.height * 3);
+}
+
+void DecisionMap::point(ILVQ_TYPE px, ILVQ_TYPE py, ILVQ_ASPECT & aspect) {
+	if (config.base.empty()) aspect.assign(config.dimension, ILVQ_TYPE(0));
+	else aspect = config.base;
+	aspect[config.x_dim] = config.x_min + (px + ILVQ_TYPE(0.5)) * sx;
+	aspect[config.y_dim] = config.y_min + (py + ILVQ_TYPE(0.5)) * sy;
+}
+
+void DecisionMap::fill(int x, int y, int w, int h, ILVQ_CLASS_REPRESENTATION class_rep) {
+	for (int j = y; j < y + h; ++j) {
+		std::fill(&classes[j * config.width + x], &classes[j * config.width + x] + w, class_rep);
+	}
+}
+
+/**
+ * Class c gets value 0.99*(1-c/classes), so with two classes the same red and green as the
+ * scattered test samples of main/test.cpp used to have. Unknown classes are black.
+ */
+void DecisionMap::colour() {
+	unsigned char palette[256][3];
+	const int colours = std::max(1, std::min(256, config.classes));
+	for (int c = 0; c < colours; ++c) {
+		ppm_colour(0.99 * (1 - c / (float)colours), palette[c]);
+	}
+	unsigned char *rgb = &image[0];
+	for (unsigned int i = 0; i < classes.size(); ++i, rgb += 3) {
+		ILVQ_CLASS_REPRESENTATION c = classes[i];
+		if (c < 0) {
+			rgb[0] = rgb[1] = rgb[2] = 0;
+		} else {
+			c %= colours;
+			rgb[0] = palette[c][0];
+			rgb[1] = palette[c][1];
+			rgb[2] = palette[c][2];
+		}
+	}
+}
+
+void DecisionMap::render(ILVQ & model) {
+	evaluated = 0;
+	std::vector<ILVQ_CLASS_REPRESENTATION> result;
+	const int rows = std::max(1, DECISION_MAP_BATCH / config.width);
+	for (int y = 0; y < config.height; y += rows) {
+		const int h = std::min(rows, config.height - y);
+		batch.resize(h * config.width);
+		for (int j = 0; j < h; ++j) {
+			for (int i = 0; i < config.width; ++i) point(i, y + j, batch[j * config.width + i]);
+		}
+		model.classify(batch, result, config.threads);
+		std::copy(result.begin(), result.end(), classes.begin() + y * config.width);
+		evaluated += batch.size();
+	}
+	colour();
+}
+
+/**
+ * A block is uniform if d2 - d1 > 2r, with d1 the distance from its center to the nearest
+ * prototype, d2 to the nearest one of another class and r from the center to the furthest pixel
+ * center in the block. Every pixel is within r of the center, so its nearest prototype of the
+ * same class is at most d1 + r away and any other at least d2 - r. If none of the k nearest ones
+ * has another class, d2 is at least the distance to the k-th. A single pixel has r = 0, so it just
+ * gets the class of its nearest prototype, which is what classify would give.
+ */
+void DecisionMap::render(ILVQ_XSZ & model) {
+	const DistanceMetric metric = model.getMetric();
+	if ((metric != DM_EUCLIDEAN && metric != DM_MANHATTAN) || config.block <= 1) {
+		render((ILVQ&)model);
+		return;
+	}
+	evaluated = 0;
+	const int k = DECISION_MAP_K;
+	std::vector<DecisionBlock> blocks, next;
+	for (int y = 0; y < config.height; y += config.block) {
+		for (int x = 0; x < config.width; x += config.block) {
+			DecisionBlock b = { x, y, std::min(config.block, config.width - x), std::min(config.block, config.height - y) };
+			blocks.push_back(b);
+		}
+	}
+	std::vector<ILVQ_CLASS_REPRESENTATION> ids;
+	std::vector<ILVQ_TYPE> dists;
+	while (!blocks.empty()) {
+		next.clear();
+		for (unsigned int first = 0; first < blocks.size(); first += DECISION_MAP_BATCH) {
+			const int n = std::min<int>(DECISION_MAP_BATCH, blocks.size() - first);
+			batch.resize(n);
+			for (int i = 0; i < n; ++i) {
+				const DecisionBlock & b = blocks[first + i];
+				point(b.x + (b.w - 1) * ILVQ_TYPE(0.5), b.y + (b.h - 1) * ILVQ_TYPE(0.5), batch[i]);
+			}
+			ids.resize(n * k);
+			dists.resize(n * k);
+			model.classifyTopK(batch, k, &ids[0], &dists[0], config.threads);
+			evaluated += n;
+			for (int i = 0; i < n; ++i) {
+				const DecisionBlock & b = blocks[first + i];
+				const ILVQ_CLASS_REPRESENTATION *id = &ids[i * k];
+				const ILVQ_TYPE *d = &dists[i * k];
+				bool uniform = (b.w == 1 && b.h == 1) || id[0] < 0;
+				if (!uniform) {
+					ILVQ_TYPE dx = (b.w - 1) * ILVQ_TYPE(0.5) * std::fabs(sx);
+					ILVQ_TYPE dy = (b.h - 1) * ILVQ_TYPE(0.5) * std::fabs(sy);
+					ILVQ_TYPE r, d1, d2 = numeric_limits<ILVQ_TYPE>::infinity();
+					int j = 1;
+					while (j < k && id[j] == id[0]) j++;
+					if (metric == DM_EUCLIDEAN) {
+						// the distances are squared
+						r = std::sqrt(dx * dx + dy * dy);
+						d1 = std::sqrt(d[0]);
+						if (j < k && id[j] >= 0) d2 = std::sqrt(d[j]);
+						else if (j == k) d2 = std::sqrt(d[k - 1]);
+					} else {
+						r = dx + dy;
+						d1 = d[0];
+						if (j < k && id[j] >= 0) d2 = d[j];
+						else if (j == k) d2 = d[k - 1];
+					}
+					uniform = d2 - d1 > 2 * r;
+				}
+				if (uniform) {
+					fill(b.x, b.y, b.w, b.h, id[0]);
+					continue;
+				}
+				// split in (at most) four
+				const int w1 = (b.w + 1) / 2, h1 = (b.h + 1) / 2;
+				DecisionBlock c[4] = { { b.x, b.y, w1, h1 }, { b.x + w1, b.y, b.w - w1, h1 },
+						{ b.x, b.y + h1, w1, b.h - h1 }, { b.x + w1, b.y + h1, b.w - w1, b.h - h1 } };
+				for (int q = 0; q < 4; ++q) {
+					if (c[q].w > 0 && c[q].h > 0) next.push_back(c[q]);
+				}
+			}
+		}
+		blocks.swap(next);
+	}
+	colour();
+}
+
+void DecisionMap::overlay(ILVQ_XSZ & model, int size) {
+	const int count = model.getPrototypeCount(), dimension = model.getDimension();
+	if (count == 0 || dimension != config.dimension) return;
+	std::vector<ILVQ_TYPE> positions(count * dimension), norms(count);
+	std::vector<ILVQ_CLASS_REPRESENTATION> ids(count);
+	model.exportPrototypes(&positions[0], &norms[0], &ids[0]);
+	for (int p = 0; p < count; ++p) {
+		const ILVQ_TYPE *v = &positions[p * dimension];
+		int x = (int)std::floor((v[config.x_dim] - config.x_min) / sx);
+		int y = (int)std::floor((v[config.y_dim] - config.y_min) / sy);
+		for (int o = -size; o <= size; ++o) {
+			const int xs[2] = { x + o, x }, ys[2] = { y, y + o };
+			for (int a = 0; a < 2; ++a) {
+				if (xs[a] < 0 || xs[a] >= config.width || ys[a] < 0 || ys[a] >= config.height) continue;
+				unsigned char *rgb = &image[(ys[a] * config.width + xs[a]) * 3];
+				rgb[0] = rgb[1] = rgb[2] = (o == 0) ? 0 : 255;
+			}
+		}
+	}
+}
+
+bool DecisionMap::write(const char *path) {
+	FILE *f = fopen(path, "wb");
+	if (f == NULL) {
+		cerr << "Can not open " << path << endl;
+		return false;
+	}
+	fprintf(f, "P6\n%d %d\n255\n", config.width, config.height);
+	bool ok = fwrite(&image[0], 1, image.size(), f) == image.size();
+	if (fclose(f) != 0) ok = false;
+	if (!ok) cerr << "Can not write " << path << endl;
+	return ok;
+}
@@ -0,0 +1,232 @@
+/**
+ * @brief Deterministic generator of synthetic workloads
+ * @file Generator.cpp
+ *
+ * This file is created at Almende B.V. It is open-source software and part of the Common
+ * Hybrid Agent Platform (CHAP). A toolbox with a lot of open-source tools, ranging from
+ * thread pools and TCP/IP components to control architectures and learning algorithms.
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless,
+ * we personally strongly object against this software used by the military, in the
+ * bio-industry, for animal experimentation, or anything that violates the Universal
+ * Declaration of Human Rights.
+ *
+ * Copyright © 2012 Anne van Rossum <anne@almende.com>
+ *
+ * @author     Anne C. van Rossum
+ * @date       Apr 22, 2012
+ * @project    Replicator FP7
+ * @company    Almende B.V.
+ * @case       Machine learning (fit for Surveyeor robots)
+ */
+
+
+#include <ilvq/Generator.h>
+#include <ilvq/Parallel.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <assert.h>
+#include <stdlib.h>
+
+using namespace dobots;
+using namespace std;
+
+//! Largest dimension of the latent space of the manifold
+#define GENERATOR_MAX_LATENT 16
+
+//! Attempts to find a sample of an accepted class, after that the last one is taken
+#define GENERATOR_MAX_ATTEMPTS 64
+
+//! Streams for the parameters of the generator, far away from the streams of the samples
+#define GENERATOR_PARAMETERS (1ULL << 63)
+
+static const float two_pi = 6.28318530718f;
+
+GeneratorConfig dobots::generator_config(GeneratorType type, int dimension, int classes, uint64_t seed) {
+	GeneratorConfig c;
+	c.type = type;
+	c.dimension = dimension;
+	c.classes = classes;
+	c.seed = seed;
+	c.clusters = 2;
+	c.spread = (type == GT_MANIFOLD) ? 0.01 : 0.1;
+	c.imbalance = 1;
+	c.drift = 0;
+	c.xor_bits = std::min(2, dimension);
+	c.manifold_dimension = std::min(2, dimension);
+	return c;
+}
+
+float CounterRNG::gaussian() {
+	if (has_spare) {
+		has_spare = false;
+		return spare;
+	}
+	float u1 = uniform(), u2 = uniform();
+	float r = std::sqrt(-2.0f * std::log(1.0f - u1)); // 1-u1 is in (0,1]
+	spare = r * std::sin(two_pi * u2);
+	has_spare = true;
+	return r * std::cos(two_pi * u2);
+}
+
+Generator::Generator(const GeneratorConfig & config): config(config) {
+	const int D = config.dimension;
+	assert (D > 0 && config.classes > 0 && config.type < GT_TYPES);
+	assert (config.type != GT_MANIFOLD || (config.manifold_dimension > 0 &&
+			config.manifold_dimension <= GENERATOR_MAX_LATENT));
+	assert (config.imbalance > 0);
+	stride = (D + 15) & ~15;
+
+	float w = 1, total = 0;
+	for (int c = 0; c < config.classes; ++c, w *= config.imbalance) {
+		total += w;
+		cumulative.push_back(total);
+		relative.push_back(w);
+	}
+	float max_w = *std::max_element(relative.begin(), relative.end());
+	for (int c = 0; c < config.classes; ++c) relative[c] /= max_w;
+
+	CounterRNG rng(config.seed, GENERATOR_PARAMETERS);
+	if (config.type == GT_MIXTURE) {
+		assert (config.clusters > 0);
+		const int K = config.classes * config.clusters;
+		centers.resize(K * D);
+		directions.resize(K * D);
+		for (int k = 0; k < K; ++k) {
+			float n = 0;
+			for (int j = 0; j < D; ++j) {
+				centers[k*D+j] = rng.uniform();
+				directions[k*D+j] = rng.gaussian();
+				n += directions[k*D+j] * directions[k*D+j];
+			}
+			n = (n > 0) ? 1 / std::sqrt(n) : 0;
+			for (int j = 0; j < D; ++j) directions[k*D+j] *= n;
+		}
+	}
+	if (config.type == GT_MANIFOLD) {
+		const int m = config.manifold_dimension;
+		frequencies.resize(D * m);
+		phases.resize(D);
+		for (int j = 0; j < D; ++j) {
+			for (int l = 0; l < m; ++l) frequencies[j*m+l] = 4 * rng.uniform() - 2;
+			phases[j] = two_pi * rng.uniform();
+		}
+	}
+}
+
+ILVQ_CLASS_REPRESENTATION Generator::drawClass(CounterRNG & rng) const {
+	float u = rng.uniform() * cumulative.back();
+	int c = std::upper_bound(cumulative.begin(), cumulative.end(), u) - cumulative.begin();
+	return std::min(c, config.classes - 1);
+}
+
+bool Generator::accept(CounterRNG & rng, ILVQ_CLASS_REPRESENTATION class_rep) const {
+	return relative[class_rep] >= 1 || rng.uniform() < relative[class_rep];
+}
+
+/**
+ * For the types with a boundary the first two coordinates are rotated around the center by the
+ * drift before the class is determined, so the boundary rotates while the inputs stay uniform.
+ * Imbalance is obtained by rejecting samples of the less frequent classes.
+ */
+void Generator::sample(uint64_t index, ILVQ_TYPE *out, ILVQ_CLASS_REPRESENTATION & class_rep) const {
+	const int D = config.dimension, C = config.classes;
+	CounterRNG rng(config.seed, index);
+	const float phase = config.drift * (index * 1e-6);
+	if (config.type == GT_MIXTURE) {
+		class_rep = drawClass(rng);
+		int k = std::min((int)(rng.uniform() * config.clusters), config.clusters - 1);
+		const float *center = &centers[(class_rep * config.clusters + k) * D];
+		const float *direction = &directions[(class_rep * config.clusters + k) * D];
+		for (int j = 0; j < D; ++j) out[j] = center[j] + phase * direction[j] + config.spread * rng.gaussian();
+		return;
+	}
+	const float cos_p = std::cos(phase), sin_p = std::sin(phase);
+	for (int attempt = 0; attempt < GENERATOR_MAX_ATTEMPTS; ++attempt) {
+		if (config.type == GT_MANIFOLD) {
+			const int m = config.manifold_dimension;
+			float u[GENERATOR_MAX_LATENT];
+			for (int l = 0; l < m; ++l) u[l] = rng.uniform();
+			for (int j = 0; j < D; ++j) {
+				float a = phases[j];
+				for (int l = 0; l < m; ++l) a += two_pi * frequencies[j*m+l] * u[l];
+				out[j] = 0.5f + 0.25f * std::sin(a) + config.spread * rng.gaussian();
+			}
+			float t = u[0] + phase / two_pi;
+			t -= std::floor(t);
+			class_rep = std::min((int)(t * C), C - 1);
+		} else {
+			for (int j = 0; j < D; ++j) out[j] = rng.uniform();
+			float x = out[0] - 0.5f, y = (D > 1) ? out[1] - 0.5f : 0;
+			float xr = 0.5f + cos_p * x - sin_p * y, yr = 0.5f + sin_p * x + cos_p * y;
+			switch (config.type) {
+			case GT_HALVES:
+				class_rep = C - 1 - std::max(0, std::min((int)(xr * C), C - 1));
+				break;
+			case GT_CIRCLE: {
+				float r = std::sqrt((2*xr-1)*(2*xr-1)+(2*yr-1)*(2*yr-1));
+				class_rep = C - 1 - std::min((int)(r * std::max(C - 1, 1)), C - 1);
+				break;
+			}
+			default: {
+				int bits = (xr > 0.5f) + (D > 1 && config.xor_bits > 1 && yr > 0.5f);
+				for (int j = 2; j < std::min(config.xor_bits, D); ++j) bits += (out[j] > 0.5f);
+				class_rep = bits % C;
+			}
+			}
+		}
+		if (accept(rng, class_rep)) return;
+	}
+}
+
+void Generator::sample(uint64_t index, ILVQ_ASPECT & aspect, ILVQ_CLASS_REPRESENTATION & class_rep) const {
+	aspect.resize(config.dimension);
+	sample(index, &aspect[0], class_rep);
+}
+
+namespace dobots {
+
+//! Every thread generates its own contiguous block
+struct GenerateBlock {
+	const Generator *generator;
+	uint64_t first;
+	ILVQ_TYPE *out;
+	ILVQ_CLASS_REPRESENTATION *classes;
+	std::vector<ILVQ_ASPECT> *aspects;
+
+	void operator()(int begin, int end, int thread) {
+		const int stride = generator->getStride();
+		for (int i = begin; i < end; ++i) {
+			if (aspects != NULL) {
+				generator->sample(first + i, (*aspects)[i], classes[i]);
+			} else {
+				generator->sample(first + i, out + (size_t)i * stride, classes[i]);
+			}
+		}
+	}
+};
+
+}
+
+void Generator::generate(uint64_t first, int count, ILVQ_TYPE *out, ILVQ_CLASS_REPRESENTATION *classes,
+		int threads) const {
+	GenerateBlock block = { this, first, out, classes, NULL };
+	parallel_for(count, threads, block);
+}
+
+void Generator::generate(uint64_t first, int count, std::vector<ILVQ_ASPECT> & aspects,
+		std::vector<ILVQ_CLASS_REPRESENTATION> & classes, int threads) const {
+	aspects.resize(count);
+	classes.resize(count);
+	if (count == 0) return;
+	GenerateBlock block = { this, first, NULL, &classes[0], &aspects };
+	parallel_for(count, threads, block);
+}
+
+ILVQ_TYPE *Generator::allocate(int rows) const {
+	void *p = NULL;
+	if (posix_memalign(&p, 64, (size_t)rows * stride * sizeof(ILVQ_TYPE))) return NULL;
+	return (ILVQ_TYPE*)p;
+}
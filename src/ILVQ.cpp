@@ -22,41 +22,19 @@
  */
 
 #include <ilvq/ILVQ.h>
+#include <ilvq/Kernels.h>
 
 #include <functional>
 #include <numeric>
 #include <iostream>
 #include <algorithm>
+#include <cmath>
 
 #include <assert.h>
 
 using namespace dobots;
 using namespace std;
 
-/**
- * The norm for a N-dimensional vector, element-wise squaring the difference.
- */
-ILVQ_TYPE euclidean(ILVQ_TYPE x, ILVQ_TYPE y) {
-	return (x-y)*(x-y);
-}
-
-/**
- * Create a template function which moves vector x from or towards y with a learning rate "mu".
- * A positive mu will move "x" away, while a negative mu will move "x" towards "y".
- */
-template<typename T>
-class op_adjust: std::binary_function<T,T,T> {
-	T mu_;
-public:
-	op_adjust(T mu): mu_(mu) {}
-	T operator()(T x, T y) const {
-		T result = x+(x-y)*mu_;
-//		if (result < 0) result = T(0);
-//		if (result > 1) result = T(1);
-		return result;
-	}
-};
-
 ILVQ::ILVQ() {
 
 }
@@ -65,11 +43,21 @@ ILVQ::~ILVQ() {
 
 }
 
+void ILVQ::classify(const std::vector<ILVQ_ASPECT> & inputs, std::vector<ILVQ_CLASS_REPRESENTATION> & classes,
+		int threads) {
+	classes.resize(inputs.size());
+	for (unsigned int i = 0; i < inputs.size(); ++i) {
+		classes[i] = classify(const_cast<ILVQ_ASPECT&>(inputs[i]));
+	}
+}
+
 /**
  * This function tells something about the "distance" between vectors, in other words the similarity or
  * dissimilarity. There are currently several metrics implemented:
  *   DM_DOTPRODUCT:		return sum_i { x_i*w_i }
  *   DM_EUCLIDEAN:		return sum_i { (x_i-w_i)^2 }
+ *   DM_COSINE:			return 1 - sum_i { x_i*w_i } / (|x| |w|)
+ *   DM_MANHATTAN:		return sum_i { |x_i-w_i| }
  * It is assumed that the prototype size is equal to the aspect size.
  * @param aspect		in: incoming value
  * @param prototype		in: prototype to check against
@@ -77,46 +65,106 @@ ILVQ::~ILVQ() {
  * @return				out: the distance between aspect and prototype
  */
 ILVQ_TYPE ILVQ::distance(const ILVQ_ASPECT & aspect, const ILVQ_PROTOTYPE & prototype, DistanceMetric metric) {
+	if (metric == DM_COSINE) {
+		return distance(aspect, prototype, metric, norm(aspect), norm(prototype));
+	}
+	return distance(aspect, prototype, metric, 0, 0);
+}
+
+/**
+ * The same, but for DM_COSINE the norms are given. The norms of the prototypes are cached by the
+ * callers (see increaseDistance), so a query costs one dot product per prototype. If one of the
+ * vectors is zero the cosine is undefined and 1 (orthogonal) is returned.
+ */
+ILVQ_TYPE ILVQ::distance(const ILVQ_ASPECT & aspect, const ILVQ_PROTOTYPE & prototype, DistanceMetric metric,
+		ILVQ_TYPE aspect_norm, ILVQ_TYPE prototype_norm) {
 	if (aspect.size() != prototype.size()) {
 		cerr << "Aspect size " << aspect.size() << " while prototype size " << prototype.size() << endl;
 		assert (aspect.size() == prototype.size());
 	}
 	switch (metric) {
 	case DM_DOTPRODUCT:
-		return inner_product(aspect.begin(), aspect.end(), prototype.begin(), ILVQ_TYPE(0));
+		return dot_product(&aspect[0], &prototype[0], aspect.size());
 	case DM_EUCLIDEAN:
-		return inner_product(aspect.begin(), aspect.end(), prototype.begin(), ILVQ_TYPE(0), plus<ILVQ_TYPE>(), euclidean);
+		return squared_euclidean(&aspect[0], &prototype[0], aspect.size());
+	case DM_COSINE: {
+		ILVQ_TYPE n = aspect_norm * prototype_norm;
+		if (n <= ILVQ_TYPE(0)) return ILVQ_TYPE(1);
+		return ILVQ_TYPE(1) - dot_product(&aspect[0], &prototype[0], aspect.size()) / n;
+	}
+	case DM_MANHATTAN:
+		return manhattan(&aspect[0], &prototype[0], aspect.size());
 	default:
 		cerr << "Unknown distance metric" << endl;
 		return -1;
 	}
 }
 
+/**
+ * Everything is expressed in the dot product between aspect and prototype, using the norms:
+ *   sum_i (x_i - w_i)^2 = |x|^2 + |w|^2 - 2 x.w
+ * only the non-zero x_i contribute to x.w. Rounding can make the squared euclidean distance a
+ * tiny bit negative, so it is clamped at zero.
+ */
+ILVQ_TYPE ILVQ::distance(const ILVQ_SPARSE_ASPECT & aspect, const ILVQ_PROTOTYPE & prototype, DistanceMetric metric,
+		ILVQ_TYPE aspect_norm, ILVQ_TYPE prototype_norm, ILVQ_TYPE scale) {
+	assert (aspect.dimension == (int)prototype.size());
+	assert (aspect.index.size() == aspect.value.size());
+	ILVQ_TYPE dot = aspect.index.empty() ? ILVQ_TYPE(0) :
+			scale * sparse_dot(&aspect.index[0], &aspect.value[0], aspect.index.size(), &prototype[0]);
+	switch (metric) {
+	case DM_DOTPRODUCT:
+		return dot;
+	case DM_EUCLIDEAN:
+		return std::max(ILVQ_TYPE(0), aspect_norm * aspect_norm + prototype_norm * prototype_norm - 2 * dot);
+	case DM_COSINE: {
+		ILVQ_TYPE n = aspect_norm * prototype_norm;
+		if (n <= ILVQ_TYPE(0)) return ILVQ_TYPE(1);
+		return ILVQ_TYPE(1) - dot / n;
+	}
+	default:
+		cerr << "Distance metric not supported for sparse aspects" << endl;
+		return -1;
+	}
+}
+
+ILVQ_TYPE ILVQ::norm(const ILVQ_ASPECT & aspect) {
+	if (aspect.empty()) return 0;
+	return std::sqrt(dot_product(&aspect[0], &aspect[0], aspect.size()));
+}
+
+ILVQ_TYPE ILVQ::norm(const ILVQ_SPARSE_ASPECT & aspect) {
+	if (aspect.value.empty()) return 0;
+	return std::sqrt(dot_product(&aspect.value[0], &aspect.value[0], aspect.value.size()));
+}
+
 /**
  * Prototype is adjusted away from the input:
- * w_s = w_s + mu ( x - w_s)
+ * w_s = w_s + mu ( w_s - x)
+ * The norm of the prototype is updated in the same pass if prototype_norm is given.
  */
-void ILVQ::increaseDistance(ILVQ_PROTOTYPE & prototype, const ILVQ_ASPECT & input, ILVQ_TYPE mu) {
+void ILVQ::increaseDistance(ILVQ_PROTOTYPE & prototype, const ILVQ_ASPECT & input, ILVQ_TYPE mu,
+		ILVQ_TYPE *prototype_norm) {
 	if (input.size() != prototype.size()) {
 		cerr << "Input size " << input.size() << " while prototype size " << prototype.size() << endl;
 		assert (input.size() == prototype.size());
 	}
-	std::transform(prototype.begin(), prototype.end(), input.begin(), prototype.begin(),
-			op_adjust<ILVQ_TYPE>(mu));
-
+	ILVQ_TYPE squared_norm = adjust(&prototype[0], &input[0], mu, prototype.size());
+	if (prototype_norm) *prototype_norm = std::sqrt(squared_norm);
 }
 
 /**
- * Prototype is adjusted away towards the input:
- * w_s = w_s - mu ( x - w_s)
+ * Prototype is adjusted towards the input:
+ * w_s = w_s - mu ( w_s - x)
  */
-void ILVQ::decreaseDistance(ILVQ_PROTOTYPE & prototype, const ILVQ_ASPECT & input, ILVQ_TYPE mu) {
+void ILVQ::decreaseDistance(ILVQ_PROTOTYPE & prototype, const ILVQ_ASPECT & input, ILVQ_TYPE mu,
+		ILVQ_TYPE *prototype_norm) {
 	if (input.size() != prototype.size()) {
 		cerr << "Input size " << input.size() << " while prototype size " << prototype.size() << endl;
 		assert (input.size() == prototype.size());
 	}
-	std::transform(prototype.begin(), prototype.end(), input.begin(), prototype.begin(),
-			op_adjust<ILVQ_TYPE>(-mu));
+	ILVQ_TYPE squared_norm = adjust(&prototype[0], &input[0], -mu, prototype.size());
+	if (prototype_norm) *prototype_norm = std::sqrt(squared_norm);
 }
 
 void ILVQ::print(ILVQ_ASPECT & vector) {
@@ -0,0 +1,194 @@
+/**
+ * @brief
+ * @file ILVQ_KWK.cpp
+ *
+ * This file is created at Almende B.V. It is open-source software and part of the Common
+ * Hybrid Agent Platform (CHAP). A toolbox with a lot of open-source tools, ranging from
+ * thread pools and TCP/IP components to control architectures and learning algorithms.
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless,
+ * we personally strongly object against this software used by the military, in the
+ * bio-industry, for animal experimentation, or anything that violates the Universal
+ * Declaration of Human Rights.
+ *
+ * Copyright © 2012 Anne van Rossum <anne@almende.com>
+ *
+ * @author     Anne C. van Rossum
+ * @date       Apr 22, 2012
+ * @project    Replicator FP7
+ * @company    Almende B.V.
+ * @case       Machine learning (fit for Surveyeor robots)
+ */
+
+#include <ilvq/ILVQ_KWK.h>
+#include <ilvq/Kernels.h>
+#include <ilvq/Trace.h>
+
+#include <limits>
+#include <cmath>
+#include <iostream>
+#include <assert.h>
+
+using namespace dobots;
+using namespace std;
+
+//! Number of samples after which the running average of sigma becomes an exponential one
+#define SIGMA_WINDOW 1000
+
+ILVQ_KWK::ILVQ_KWK(ILVQ_TYPE S_t, ILVQ_TYPE mu): S_t(S_t),
+		sigma(0),
+		d_t(0),
+		mu(mu),
+		d_mean(0),
+		d_samples(0) {
+	assert (S_t > 0 && S_t < 1);
+}
+
+ILVQ_KWK::~ILVQ_KWK() {
+
+}
+
+/**
+ * Sigma should be such that the average similarity is about 0.5. The distance between two
+ * successive inputs is used as a sample of the distance between two arbitrary inputs, so:
+ *   exp(-E[d]/sigma) = 0.5  =>  sigma = E[d] / ln 2
+ * The threshold on similarity is translated once into a threshold on squared distance, so the
+ * exponential does not need to be calculated while learning:
+ *   exp(-d/sigma) >= S_t  <=>  d <= -sigma ln S_t
+ */
+void ILVQ_KWK::updateSigma(const ILVQ_ASPECT & input) {
+	if (!previous.empty()) {
+		ILVQ_TYPE d = squared_euclidean(&input[0], &previous[0], input.size());
+		if (d_samples < SIGMA_WINDOW) d_samples++;
+		d_mean += (d - d_mean) / d_samples;
+		sigma = d_mean / std::log(2.0);
+		d_t = -sigma * std::log(S_t);
+	}
+	previous = input;
+}
+
+int ILVQ_KWK::findClass(ILVQ_CLASS_REPRESENTATION class_rep) {
+	for (unsigned int c = 0; c < classes.size(); ++c) {
+		if (classes[c].class_id == class_rep) return c;
+	}
+	return -1;
+}
+
+void ILVQ_KWK::getClosePrototypes(const ILVQ_ASPECT & input, int & winner_class, int & winner_index) {
+	const int dim = input.size();
+	ILVQ_TYPE winner_value = numeric_limits<ILVQ_TYPE>::max();
+	winner_class = winner_index = -1;
+	min_dist.resize(classes.size());
+	min_index.resize(classes.size());
+	for (unsigned int c = 0; c < classes.size(); ++c) {
+		const ILVQ_KWK_CLASS & cl = classes[c];
+		assert (cl.prototypes.size() == (unsigned int)(cl.count * dim));
+		const ILVQ_TYPE *row = &cl.prototypes[0];
+		ILVQ_TYPE best = numeric_limits<ILVQ_TYPE>::max();
+		int best_index = -1;
+		for (int l = 0; l < cl.count; ++l, row += dim) {
+			ILVQ_TYPE d = squared_euclidean(&input[0], row, dim);
+			if (d < best) {
+				best = d;
+				best_index = l;
+			}
+		}
+		min_dist[c] = best;
+		min_index[c] = best_index;
+		if (best < winner_value) {
+			winner_value = best;
+			winner_class = c;
+			winner_index = best_index;
+		}
+	}
+}
+
+void ILVQ_KWK::add(ILVQ_ASPECT & input, ILVQ_CLASS_REPRESENTATION & class_rep) {
+	const int dim = input.size();
+	updateSigma(input);
+	int wc, wi;
+	getClosePrototypes(input, wc, wi);
+	int own = findClass(class_rep);
+	if (own < 0) {
+		ILVQ_KWK_CLASS cl;
+		cl.class_id = class_rep;
+		cl.count = 0;
+		classes.push_back(cl);
+		own = classes.size() - 1;
+		min_dist.push_back(numeric_limits<ILVQ_TYPE>::max());
+		min_index.push_back(-1);
+	}
+	// same as !accept(max_similar(input, class_rep)), but without exponentials
+	ILVQ_KWK_CLASS & cl = classes[own];
+	if (min_dist[own] > d_t) {
+		cl.prototypes.insert(cl.prototypes.end(), input.begin(), input.end());
+		// prototypes are never deleted, so the total count is a unique id
+		cl.ids.push_back(getPrototypeCount());
+		ILVQ_TRACE_EVENT(TE_CREATE, cl.ids.back(), -1, class_rep, min_dist[own], d_t);
+		cl.count++;
+		return;
+	}
+	ILVQ_TRACE_EVENT(TE_WINNERS, classes[wc].ids[wi], cl.ids[min_index[own]], classes[wc].class_id, min_dist[wc],
+			min_dist[own]);
+	// LVQ1: the winner moves towards the input if it is correct, else away
+	ILVQ_TYPE *w = &classes[wc].prototypes[wi * dim];
+	ILVQ_TYPE m = (wc == own) ? mu : -mu;
+	for (int i = 0; i < dim; ++i) w[i] += m * (input[i] - w[i]);
+	if (wc != own) {
+		// and the closest of the right class is moved towards it
+		w = &cl.prototypes[min_index[own] * dim];
+		for (int i = 0; i < dim; ++i) w[i] += mu * (input[i] - w[i]);
+	}
+}
+
+ILVQ_CLASS_REPRESENTATION ILVQ_KWK::classify(ILVQ_ASPECT & input) {
+	int wc, wi;
+	getClosePrototypes(input, wc, wi);
+	if (wc < 0) return -1;
+	return classes[wc].class_id;
+}
+
+int ILVQ_KWK::getPrototypeCount() {
+	int count = 0;
+	for (unsigned int c = 0; c < classes.size(); ++c) count += classes[c].count;
+	return count;
+}
+
+ILVQ_TYPE ILVQ_KWK::similarity(const ILVQ_ASPECT & aspect, const ILVQ_PROTOTYPE & prototype) {
+	assert (aspect.size() == prototype.size());
+	if (sigma <= 0) return 0;
+	return std::exp(-squared_euclidean(&aspect[0], &prototype[0], aspect.size()) / sigma);
+}
+
+ILVQ_TYPE ILVQ_KWK::max_similar(const ILVQ_ASPECT & aspect, ILVQ_CLASS_REPRESENTATION class_index) {
+	int c = findClass(class_index);
+	if (c < 0 || sigma <= 0) return 0;
+	const int dim = aspect.size();
+	const ILVQ_KWK_CLASS & cl = classes[c];
+	ILVQ_TYPE best = numeric_limits<ILVQ_TYPE>::max();
+	const ILVQ_TYPE *row = &cl.prototypes[0];
+	for (int l = 0; l < cl.count; ++l, row += dim) {
+		best = std::min(best, squared_euclidean(&aspect[0], row, dim));
+	}
+	// exp is monotonous, so the maximum similarity belongs to the minimum distance
+	return std::exp(-best / sigma);
+}
+
+void ILVQ_KWK::max_similarities(const ILVQ_ASPECT & aspect, std::vector<ILVQ_CLASS_REPRESENTATION> & class_ids,
+		std::vector<ILVQ_TYPE> & similarities) {
+	int wc, wi;
+	getClosePrototypes(aspect, wc, wi);
+	class_ids.resize(classes.size());
+	similarities.resize(classes.size());
+	for (unsigned int c = 0; c < classes.size(); ++c) {
+		class_ids[c] = classes[c].class_id;
+		// without a sigma there is no similarity, as in similarity and max_similar
+		similarities[c] = (sigma > 0) ? min_dist[c] * (-1 / sigma) : 0;
+	}
+	if (sigma > 0 && !similarities.empty()) fast_exp(&similarities[0], &similarities[0], similarities.size());
+}
+
+bool ILVQ_KWK::accept(ILVQ_TYPE similarity) {
+	return similarity < S_t;
+}
@@ -22,56 +22,92 @@
  */
 
 #include <ilvq/ILVQ_XSZ.h>
+#include <ilvq/Parallel.hpp>
 
 #include <map>
 #include <algorithm>
 #include <limits>
 #include <numeric>
 #include <iostream>
+#include <cmath>
 #include <assert.h>
+#include <string.h>
+#include <stddef.h>
+#include <malloc.h>
 
-#include <sys/syslog.h>
+//! Number of inputs that are compared against a prototype while it is in cache
+#define ILVQ_BATCH 8
+
+//! Once the support is larger than this share of the dimension it is no longer kept, the vector kernels are faster
+#define ILVQ_SUPPORT_DENSE 8
 
 using namespace dobots;
 using namespace std;
 
-ILVQ_XSZ::ILVQ_XSZ(int ageOld, ILVQ_TYPE mu1, ILVQ_TYPE mu2, int lambda): ageOld(ageOld),
+//! Mark entry i as one that can be non-zero
+static inline void support_add(ILVQ_XSZ_PROTOTYPE &p, int i) {
+	uint64_t &word = p.support[i >> 6];
+	uint64_t bit = uint64_t(1) << (i & 63);
+	p.support_count += !(word & bit);
+	word |= bit;
+}
+
+ILVQ_XSZ::ILVQ_XSZ(int ageOld, ILVQ_TYPE mu1, ILVQ_TYPE mu2, int lambda, DistanceMetric metric): ageOld(ageOld),
 		mu1(mu1),
 		mu2(mu2),
 		lambda(lambda),
-		lambda_i(0) {
-	debug = LOG_ERR;
+		lambda_i(0),
+		metric(metric),
+		sparse(false),
+		sketch_dimension(0),
+		shortlist(16),
+		lazy(false),
+		lazy_window(16),
+		lazy_slot(0),
+		next_index(0),
+		winner_count_sum(0),
+		max_prototypes(0),
+		eviction(EV_LEAST_RECENT),
+		budget_clock(0) {
+	buckets[0] = buckets[1] = NULL;
 }
 
 ILVQ_XSZ::~ILVQ_XSZ() {
-
+	clear();
 }
 
-void ILVQ_XSZ::add(ILVQ_ASPECT & input, ILVQ_CLASS_REPRESENTATION & class_rep) {
-	if (debug >= LOG_INFO) {
-		cout << __func__ << ": input=";
-		print(input);
-		cout << ", class=" << class_rep << endl;
+void ILVQ_XSZ::clear() {
+	std::set<ILVQ_XSZ_PROTOTYPE*>::const_iterator it;
+	for (it = prototypes.begin(); it != prototypes.end(); ++it) {
+		ILVQ_XSZ_CONNECTIONS::const_iterator it_e;
+		for (it_e = (*it)->outgoing_connections->begin(); it_e != (*it)->outgoing_connections->end(); ++it_e) {
+			delete *it_e;
+		}
+		delete (*it)->outgoing_connections;
+		delete (*it)->prototype;
+		delete *it;
 	}
-	getClosePrototypes(input, temp_winners);
-	if (isNewPrototype(input, class_rep, temp_winners)) {
-		ILVQ_XSZ_PROTOTYPE *p = new ILVQ_XSZ_PROTOTYPE();
-		p->T_s = 0;
-		p->class_id = class_rep;
-		p->outgoing_connections = new ILVQ_XSZ_CONNECTIONS();
-		p->prototype = new ILVQ_ASPECT(input);
-		//		*p->prototype = input;
-		assert (p->prototype->size() == input.size());
-		p->winner_count = 0;
-		prototypes.insert(p);
-		updateThreshold(*p);
+	prototypes.clear();
+	buckets[0] = buckets[1] = NULL;
+	budget_heap.clear();
+	budget_young.clear();
+	winner_count_sum = 0;
+	lazy_slot = 0;
+}
+
+template <typename INPUT, typename EXTRA>
+void ILVQ_XSZ::learn(const INPUT & input, const EXTRA & extra, ILVQ_CLASS_REPRESENTATION & class_rep) {
+	getClosePrototypes(input, extra, temp_winners, TE_WINNERS);
+	if (isNewPrototype(input, extra, class_rep, temp_winners)) {
+		createPrototype(input, extra, class_rep, temp_winners);
 	} else
 		// additional check for emptiness, but should be only the first two times
 		if (temp_winners.s1 && temp_winners.s2) {
 			addEdge(temp_winners.s1, temp_winners.s2);
 			updateLearningRates(*temp_winners.s1);
-			updatePrototype(*temp_winners.s1, input, class_rep);
+			updatePrototype(*temp_winners.s1, input, extra, class_rep);
 			updateThreshold(*temp_winners.s1);
+			if (max_prototypes > 0 && eviction == EV_REDUNDANT) budgetRefresh(*temp_winners.s1);
 			deleteEdges();
 		}
 	temp_winners.s1 = NULL;
@@ -83,31 +119,867 @@ void ILVQ_XSZ::add(ILVQ_ASPECT & input, ILVQ_CLASS_REPRESENTATION & class_rep) {
 	lambda_i++;
 }
 
+void ILVQ_XSZ::add(ILVQ_ASPECT & input, ILVQ_CLASS_REPRESENTATION & class_rep) {
+	if (debug >= LOG_INFO) {
+		cout << __func__ << ": input=";
+		print(input);
+		cout << ", class=" << class_rep << endl;
+	}
+	assert (!sparse && modalities.empty());
+	if (sketch_dimension > 0) project(input, temp_projection);
+	learn(input, temp_projection, class_rep);
+}
+
+void ILVQ_XSZ::createPrototype(const ILVQ_ASPECT & input, const std::vector<ILVQ_TYPE> & sketch,
+		ILVQ_CLASS_REPRESENTATION & class_rep, const ILVQ_XSZ_PROTOTYPE_PAIR &) {
+	addPrototype(input, class_rep, sketch);
+}
+
+ILVQ_XSZ_PROTOTYPE *ILVQ_XSZ::addPrototype(const ILVQ_ASPECT & input, ILVQ_CLASS_REPRESENTATION & class_rep,
+		const std::vector<ILVQ_TYPE> & sketch) {
+	if (max_prototypes > 0 && (int)prototypes.size() >= max_prototypes) evict();
+	ILVQ_XSZ_PROTOTYPE *p = newPrototype(input, class_rep, sketch);
+	ILVQ_TRACE_EVENT(TE_CREATE, p->index, -1, class_rep, 0, 0);
+	updateThreshold(*p);
+	return p;
+}
+
+ILVQ_XSZ_PROTOTYPE *ILVQ_XSZ::newPrototype(const ILVQ_ASPECT & input, ILVQ_CLASS_REPRESENTATION class_rep,
+		const std::vector<ILVQ_TYPE> & sketch) {
+	assert (sketch.size() == (unsigned int)sketch_dimension);
+	ILVQ_XSZ_PROTOTYPE *p = new ILVQ_XSZ_PROTOTYPE();
+	p->index = next_index++;
+	p->T_s = 0;
+	p->class_id = class_rep;
+	p->outgoing_connections = new ILVQ_XSZ_CONNECTIONS();
+	p->prototype = new ILVQ_ASPECT(input);
+	p->norm = norm(input);
+	p->norm2 = p->norm * p->norm;
+	p->scale = 1;
+	p->support_count = input.size();
+	for (unsigned int m = 0; m < modalities.size(); ++m) {
+		p->norms.push_back(std::sqrt(dot_product(&input[modalities[m].offset], &input[modalities[m].offset],
+				modalities[m].dimension)));
+	}
+	p->version = 0;
+	p->sketch = sketch;
+	//		*p->prototype = input;
+	assert (p->prototype->size() == input.size());
+	p->winner_count = 0;
+	p->bucket = -1;
+	p->bucket_prev = p->bucket_next = NULL;
+	p->born = p->last_win = ++budget_clock;
+	p->budget_heap = -1;
+	prototypes.insert(p);
+	updateBucket(*p);
+	if (max_prototypes > 0) budgetUpdate(*p);
+	return p;
+}
+
+void ILVQ_XSZ::add(const ILVQ_SPARSE_ASPECT & input, ILVQ_CLASS_REPRESENTATION & class_rep) {
+	assert (sparse || prototypes.empty());
+	assert (metric != DM_MANHATTAN && !lazy && !sketch_dimension && modalities.empty());
+	sparse = true;
+	learn(input, norm(input), class_rep);
+}
+
+/**
+ * A new prototype is created from a dense copy of the input, which costs the full dimension, but
+ * that does not happen often.
+ */
+void ILVQ_XSZ::createPrototype(const ILVQ_SPARSE_ASPECT & input, ILVQ_TYPE,
+		ILVQ_CLASS_REPRESENTATION & class_rep, const ILVQ_XSZ_PROTOTYPE_PAIR &) {
+	temp_dense.assign(input.dimension, ILVQ_TYPE(0));
+	for (unsigned int k = 0; k < input.index.size(); ++k) {
+		temp_dense[input.index[k]] = input.value[k];
+	}
+	ILVQ_XSZ_PROTOTYPE *p = addPrototype(temp_dense, class_rep);
+	if ((int)input.index.size() * ILVQ_SUPPORT_DENSE <= input.dimension) {
+		p->support.assign((input.dimension + 63) / 64, 0);
+		p->support_count = 0;
+		for (unsigned int k = 0; k < input.index.size(); ++k) support_add(*p, input.index[k]);
+	}
+}
+
+ILVQ_CLASS_REPRESENTATION ILVQ_XSZ::classify(const ILVQ_SPARSE_ASPECT & input) {
+	assert (sparse);
+	getClosePrototypes(input, norm(input), temp_winners, TE_CLASSIFY);
+	return temp_winners.s1->class_id;
+}
+
+void ILVQ_XSZ::setModalities(const std::vector<ILVQ_MODALITY> & modalities) {
+	assert (prototypes.empty() && !sparse && !lazy && !sketch_dimension);
+	this->modalities = modalities;
+	int offset = 0;
+	for (unsigned int m = 0; m < this->modalities.size(); ++m) {
+		this->modalities[m].offset = offset;
+		offset += this->modalities[m].dimension;
+	}
+}
+
+void ILVQ_XSZ::prepareView(const ILVQ_VIEW & input, ILVQ_XSZ_VIEW & view) {
+	assert (input.size() == modalities.size());
+	view.x.resize(modalities.size());
+	view.norms.resize(modalities.size());
+	for (unsigned int m = 0; m < modalities.size(); ++m) {
+		const ILVQ_ASPECT *a = input[m];
+		if (a == NULL || a->empty()) {
+			view.x[m] = NULL;
+			continue;
+		}
+		assert ((int)a->size() == modalities[m].dimension);
+		view.x[m] = &(*a)[0];
+		view.norms[m] = (modalities[m].metric == DM_COSINE) ? norm(*a) : 0;
+	}
+}
+
+void ILVQ_XSZ::fillView(const ILVQ_XSZ_VIEW & view, const ILVQ_XSZ_PROTOTYPE & p, ILVQ_XSZ_VIEW & out) {
+	out.x = view.x;
+	out.norms = view.norms;
+	for (unsigned int m = 0; m < modalities.size(); ++m) {
+		if (out.x[m] != NULL) continue;
+		out.x[m] = &(*p.prototype)[modalities[m].offset];
+		out.norms[m] = p.norms[m];
+	}
+}
+
+/**
+ * The modalities are stored one after the other, so this goes once through the prototype, with
+ * the kernel for the metric of each modality.
+ */
+ILVQ_TYPE ILVQ_XSZ::distance(const ILVQ_TYPE * const * x, const ILVQ_TYPE *x_norms, const ILVQ_TYPE *w,
+		const ILVQ_TYPE *w_norms) {
+	ILVQ_TYPE sum = 0;
+	for (unsigned int m = 0; m < modalities.size(); ++m) {
+		if (x[m] == NULL) continue;
+		const ILVQ_MODALITY & mod = modalities[m];
+		const ILVQ_TYPE *wm = w + mod.offset;
+		ILVQ_TYPE d;
+		switch (mod.metric) {
+		case DM_DOTPRODUCT:
+			d = dot_product(x[m], wm, mod.dimension);
+			break;
+		case DM_COSINE: {
+			ILVQ_TYPE n = x_norms[m] * w_norms[m];
+			d = (n <= ILVQ_TYPE(0)) ? ILVQ_TYPE(1) : ILVQ_TYPE(1) - dot_product(x[m], wm, mod.dimension) / n;
+			break;
+		}
+		case DM_MANHATTAN:
+			d = manhattan(x[m], wm, mod.dimension);
+			break;
+		default:
+			d = squared_euclidean(x[m], wm, mod.dimension);
+		}
+		sum += mod.weight * d;
+	}
+	return sum;
+}
+
+void ILVQ_XSZ::add(const ILVQ_VIEW & input, ILVQ_CLASS_REPRESENTATION & class_rep) {
+	assert (!modalities.empty());
+	prepareView(input, temp_view);
+	learn(input, temp_view, class_rep);
+}
+
+void ILVQ_XSZ::createPrototype(const ILVQ_VIEW &, const ILVQ_XSZ_VIEW & view,
+		ILVQ_CLASS_REPRESENTATION & class_rep, const ILVQ_XSZ_PROTOTYPE_PAIR & winners) {
+	const ILVQ_MODALITY & last = modalities.back();
+	temp_dense.assign(last.offset + last.dimension, ILVQ_TYPE(0));
+	for (unsigned int m = 0; m < modalities.size(); ++m) {
+		const ILVQ_TYPE *x = view.x[m];
+		if (x == NULL && winners.s1) x = &(*winners.s1->prototype)[modalities[m].offset];
+		if (x == NULL) continue;
+		std::copy(x, x + modalities[m].dimension, temp_dense.begin() + modalities[m].offset);
+	}
+	addPrototype(temp_dense, class_rep);
+}
+
+ILVQ_CLASS_REPRESENTATION ILVQ_XSZ::classify(const ILVQ_VIEW & input) {
+	assert (!modalities.empty());
+	prepareView(input, temp_view);
+	getClosePrototypes(input, temp_view, temp_winners, TE_CLASSIFY);
+	return temp_winners.s1->class_id;
+}
+
+/**
+ * The sketches of existing prototypes are calculated from scratch, which is also a way to get rid
+ * of the rounding errors that accumulate while they are updated.
+ */
+void ILVQ_XSZ::setPrefilter(int dimension, int shortlist) {
+	assert (dimension >= 0 && shortlist > 1 && !sparse && modalities.empty());
+	if (dimension != sketch_dimension) projection.clear();
+	sketch_dimension = dimension;
+	this->shortlist = shortlist;
+	temp_projection.clear();
+	std::set<ILVQ_XSZ_PROTOTYPE*>::const_iterator it;
+	for (it = prototypes.begin(); it != prototypes.end(); ++it) {
+		if (dimension > 0) {
+			flush(**it);
+			project(*(*it)->prototype, (*it)->sketch);
+		} else {
+			std::vector<ILVQ_TYPE>().swap((*it)->sketch);
+		}
+	}
+}
+
+//! Order of the prototypes in their grace period
+static inline bool born_before(const ILVQ_XSZ_PROTOTYPE *a, const ILVQ_XSZ_PROTOTYPE *b) {
+	return a->born < b->born;
+}
+
+void ILVQ_XSZ::setBudget(int max_prototypes, ILVQ_EVICTION policy) {
+	assert (max_prototypes >= 0 && policy >= 0 && policy < EV_TYPES);
+	this->max_prototypes = max_prototypes;
+	eviction = policy;
+	budget_heap.clear();
+	budget_young.clear();
+	std::set<ILVQ_XSZ_PROTOTYPE*>::const_iterator it;
+	for (it = prototypes.begin(); it != prototypes.end(); ++it) {
+		(*it)->budget_heap = -1;
+		if (max_prototypes > 0) budgetUpdate(**it);
+	}
+	budget_young.sort(born_before);
+	while (max_prototypes > 0 && (int)prototypes.size() > max_prototypes) evict();
+}
+
+/**
+ * The projection matrix has random entries +1 or -1 (scaled with 1/sqrt(dimension)), which
+ * preserves distances about as well as gaussian entries (Achlioptas, 2003). It is created when
+ * the input dimension is known, with its own random generator so the global one is not touched.
+ */
+void ILVQ_XSZ::project(const ILVQ_ASPECT & input, std::vector<ILVQ_TYPE> & out) {
+	const int n = input.size();
+	if (projection.size() != (unsigned int)(sketch_dimension * n)) {
+		unsigned int seed = 1;
+		ILVQ_TYPE f = 1 / std::sqrt(ILVQ_TYPE(sketch_dimension));
+		projection.resize(sketch_dimension * n);
+		for (unsigned int i = 0; i < projection.size(); ++i) {
+			projection[i] = (rand_r(&seed) & 0x100) ? f : -f;
+		}
+	}
+	out.resize(sketch_dimension);
+	for (int j = 0; j < sketch_dimension; ++j) {
+		out[j] = dot_product(&projection[j * n], &input[0], n);
+	}
+}
+
+void ILVQ_XSZ::updateSketch(ILVQ_XSZ_PROTOTYPE &p, const std::vector<ILVQ_TYPE> & sketch, ILVQ_TYPE mu) {
+	assert (p.sketch.size() == sketch.size());
+	for (int j = 0; j < sketch_dimension; ++j) {
+		p.sketch[j] += (p.sketch[j] - sketch[j]) * mu;
+	}
+}
+
 int ILVQ_XSZ::getPrototypeCount() {
 	return prototypes.size();
 }
 
+int ILVQ_XSZ::getDimension() {
+	return prototypes.empty() ? 0 : (*prototypes.begin())->prototype->size();
+}
+
+bool ILVQ_XSZ::save(FILE *f) {
+	ILVQ_XSZ_FILE_HEADER h;
+	memcpy(h.magic, "ILVQXSZ2", 8);
+	h.dimension = getDimension();
+	h.prototypes = prototypes.size();
+	h.connections = 0;
+	std::set<ILVQ_XSZ_PROTOTYPE*>::const_iterator it;
+	for (it = prototypes.begin(); it != prototypes.end(); ++it) {
+		h.connections += (*it)->outgoing_connections->size();
+	}
+	h.metric = metric;
+	h.sparse = sparse;
+	h.age_old = ageOld;
+	h.lambda = lambda;
+	h.lambda_i = lambda_i;
+	h.next_index = next_index;
+	h.mu1 = mu1;
+	h.mu2 = mu2;
+	h.modalities = modalities.size();
+	if (fwrite(&h, sizeof(h), 1, f) != 1) return false;
+	for (unsigned int m = 0; m < modalities.size(); ++m) {
+		ILVQ_XSZ_FILE_MODALITY r = { modalities[m].dimension, modalities[m].metric, modalities[m].weight };
+		if (fwrite(&r, sizeof(r), 1, f) != 1) return false;
+	}
+	for (it = prototypes.begin(); it != prototypes.end(); ++it) {
+		const ILVQ_XSZ_PROTOTYPE &p = **it;
+		int32_t ids[3] = { p.index, p.class_id, p.winner_count };
+		float T_s = p.T_s;
+		ILVQ_TYPE p_norm;
+		const ILVQ_PROTOTYPE & v = position(p, temp_position, p_norm);
+		temp_dense.resize(v.size());
+		for (unsigned int i = 0; i < v.size(); ++i) temp_dense[i] = p.scale * v[i];
+		if (fwrite(ids, sizeof(ids), 1, f) != 1) return false;
+		if (fwrite(&T_s, sizeof(T_s), 1, f) != 1) return false;
+		if (h.dimension && fwrite(&temp_dense[0], sizeof(ILVQ_TYPE), h.dimension, f) != (size_t)h.dimension) {
+			return false;
+		}
+	}
+	for (it = prototypes.begin(); it != prototypes.end(); ++it) {
+		ILVQ_XSZ_CONNECTIONS::const_iterator it_e;
+		for (it_e = (*it)->outgoing_connections->begin(); it_e != (*it)->outgoing_connections->end(); ++it_e) {
+			int32_t c[3] = { (*it_e)->s1->index, (*it_e)->s2->index, (*it_e)->age };
+			if (fwrite(c, sizeof(c), 1, f) != 1) return false;
+		}
+	}
+	return fflush(f) == 0;
+}
+
+size_t ILVQ_XSZ::getSaveSize() {
+	size_t connections = 0;
+	std::set<ILVQ_XSZ_PROTOTYPE*>::const_iterator it;
+	for (it = prototypes.begin(); it != prototypes.end(); ++it) {
+		connections += (*it)->outgoing_connections->size();
+	}
+	return sizeof(ILVQ_XSZ_FILE_HEADER) + modalities.size() * sizeof(ILVQ_XSZ_FILE_MODALITY) +
+			prototypes.size() * (3 * sizeof(int32_t) + sizeof(float) +
+			getDimension() * sizeof(ILVQ_TYPE)) + connections * 3 * sizeof(int32_t);
+}
+
+//! Nodes of std::set (color and three pointers) and std::list (two pointers) in libstdc++, without value
+#define ILVQ_SET_NODE (4 * sizeof(void*))
+#define ILVQ_LIST_NODE (2 * sizeof(void*))
+
+//! Bytes glibc malloc takes for a request: 8 bytes header, rounded up to 16, at least 32
+static size_t chunk(size_t request) {
+	if (request == 0) return 0;
+	return std::max((request + sizeof(size_t) + 15) & ~(size_t)15, (size_t)32);
+}
+
+//! A heap object of which "payload" and "bookkeeping" bytes are used
+static void account(ILVQ_MEMORY_PART & part, size_t payload, size_t bookkeeping, size_t count = 1) {
+	part.payload += count * payload;
+	part.bookkeeping += count * bookkeeping;
+	part.slack += count * (chunk(payload + bookkeeping) - payload - bookkeeping);
+}
+
+//! The buffer of a vector, only the used part is counted as payload or bookkeeping
+template <typename T>
+static void account(ILVQ_MEMORY_PART & part, const std::vector<T> & v, bool payload = false) {
+	const size_t used = v.size() * sizeof(T);
+	(payload ? part.payload : part.bookkeeping) += used;
+	part.slack += chunk(v.capacity() * sizeof(T)) - used;
+}
+
+/**
+ * Every prototype is a struct, a node in the set, a vector object and its buffer, and a list object
+ * for the outgoing connections. Every connection is a struct and a node in the outgoing list of
+ * s1 and in the incoming list of s2.
+ */
+ILVQ_XSZ_MEMORY ILVQ_XSZ::memoryUsage() {
+	ILVQ_XSZ_MEMORY m;
+	memset(&m, 0, sizeof(m));
+	m.prototypes = prototypes.size();
+	m.dimension = getDimension();
+	std::set<ILVQ_XSZ_PROTOTYPE*>::const_iterator it;
+	for (it = prototypes.begin(); it != prototypes.end(); ++it) {
+		const ILVQ_XSZ_PROTOTYPE &p = **it;
+		account(m.prototype, 0, sizeof(ILVQ_XSZ_PROTOTYPE));
+		account(m.prototype, 0, ILVQ_SET_NODE + sizeof(ILVQ_XSZ_PROTOTYPE*));
+		account(m.position, 0, sizeof(ILVQ_PROTOTYPE));
+		account(m.position, *p.prototype, true);
+		account(m.extra, p.pending);
+		account(m.extra, p.sketch);
+		account(m.extra, p.norms);
+		account(m.extra, p.support);
+		const int n = p.outgoing_connections->size();
+		m.connections += n;
+		account(m.connection, 0, sizeof(ILVQ_XSZ_CONNECTIONS));
+		account(m.connection, 0, sizeof(ILVQ_XSZ_CONNECTION), n);
+		account(m.connection, 0, ILVQ_LIST_NODE + sizeof(ILVQ_XSZ_CONNECTION*), 2 * n);
+	}
+	// the object itself may not be on the heap
+	m.model.bookkeeping += sizeof(ILVQ_XSZ);
+	account(m.model, modalities);
+	account(m.model, projection);
+	account(m.model, lazy_inputs);
+	account(m.model, temp_neighbours);
+	account(m.model, temp_scratch);
+	account(m.model, temp_norms);
+	account(m.model, temp_edges);
+	account(m.model, temp_position);
+	account(m.model, temp_view.x);
+	account(m.model, temp_view.norms);
+	account(m.model, temp_filled_view.x);
+	account(m.model, temp_filled_view.norms);
+	account(m.model, temp_edge_view);
+	account(m.model, temp_projection);
+	account(m.model, temp_shortlist);
+	account(m.model, temp_dense);
+	account(m.model, temp_delta);
+	account(m.model, temp_victims);
+	account(m.model, temp_refresh);
+	account(m.model, temp_topk_protos);
+	account(m.model, temp_topk_dists);
+	account(m.model, budget_heap);
+	account(m.model, sizeof(ILVQ_XSZ_PROTOTYPE*), ILVQ_LIST_NODE, budget_young.size());
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+	m.heap_free = mallinfo2().fordblks;
+#elif defined(__GLIBC__)
+	m.heap_free = (unsigned int)mallinfo().fordblks;
+#endif
+	return m;
+}
+
+ILVQ_XSZ_MEMORY ILVQ_XSZ::projectMemory(int count, int dimension) {
+	ILVQ_XSZ_MEMORY now = memoryUsage();
+	ILVQ_XSZ_MEMORY m;
+	memset(&m, 0, sizeof(m));
+	m.prototypes = count;
+	m.dimension = dimension;
+	// about two connections per prototype, as long as there are no prototypes to count them
+	double degree = now.prototypes ? now.connections / (double)now.prototypes : 2;
+	m.connections = (int)(degree * count + 0.5);
+	account(m.prototype, 0, sizeof(ILVQ_XSZ_PROTOTYPE), count);
+	account(m.prototype, 0, ILVQ_SET_NODE + sizeof(ILVQ_XSZ_PROTOTYPE*), count);
+	account(m.position, 0, sizeof(ILVQ_PROTOTYPE), count);
+	account(m.position, dimension * sizeof(ILVQ_TYPE), 0, count);
+	account(m.connection, 0, sizeof(ILVQ_XSZ_CONNECTIONS), count);
+	account(m.connection, 0, sizeof(ILVQ_XSZ_CONNECTION), m.connections);
+	account(m.connection, 0, ILVQ_LIST_NODE + sizeof(ILVQ_XSZ_CONNECTION*), 2 * m.connections);
+	if (now.prototypes) {
+		m.extra.bookkeeping = now.extra.bookkeeping / now.prototypes * count;
+		m.extra.slack = now.extra.slack / now.prototypes * count;
+	}
+	m.model = now.model;
+	m.heap_free = now.heap_free;
+	return m;
+}
+
+void ILVQ_XSZ::exportPrototypes(ILVQ_TYPE *positions, ILVQ_TYPE *norms, ILVQ_CLASS_REPRESENTATION *classes,
+		ILVQ_TYPE *modality_norms) {
+	const int dim = getDimension();
+	std::set<ILVQ_XSZ_PROTOTYPE*>::const_iterator it;
+	for (it = prototypes.begin(); it != prototypes.end(); ++it, positions += dim) {
+		const ILVQ_XSZ_PROTOTYPE &p = **it;
+		ILVQ_TYPE p_norm;
+		const ILVQ_PROTOTYPE & v = position(p, temp_position, p_norm);
+		for (int i = 0; i < dim; ++i) positions[i] = p.scale * v[i];
+		if (!modalities.empty()) {
+			// only the norms per modality are kept up to date
+			p_norm = std::sqrt(std::inner_product(p.norms.begin(), p.norms.end(), p.norms.begin(), ILVQ_TYPE(0)));
+			if (modality_norms != NULL) modality_norms = std::copy(p.norms.begin(), p.norms.end(), modality_norms);
+		}
+		*norms++ = p_norm; // already includes the scale
+		*classes++ = p.class_id;
+	}
+}
+
+/**
+ * The prototypes are created the same way as in add, so norms, buckets, sketches and the like
+ * are set up as usual, but the thresholds are read instead of calculated. The connections refer to the prototypes by their index.
+ */
+bool ILVQ_XSZ::load(FILE *f) {
+	ILVQ_XSZ_FILE_HEADER h;
+	const size_t v1_size = offsetof(ILVQ_XSZ_FILE_HEADER, modalities);
+	if (fread(&h, v1_size, 1, f) != 1 || (memcmp(h.magic, "ILVQXSZ1", 8) && memcmp(h.magic, "ILVQXSZ2", 8))) {
+		cerr << "Not a model file" << endl;
+		return false;
+	}
+	bool v1 = !memcmp(h.magic, "ILVQXSZ1", 8);
+	if (v1) {
+		h.modalities = 0;
+	} else if (fread(&h.modalities, sizeof(h.modalities), 1, f) != 1) {
+		cerr << "Model file is truncated" << endl;
+		return false;
+	}
+	if (h.dimension < 0 || h.prototypes < 0 || h.connections < 0 || h.metric < 0 || h.metric >= DM_TYPES ||
+			h.modalities < 0) {
+		cerr << "Corrupt model file header" << endl;
+		return false;
+	}
+	std::vector<ILVQ_MODALITY> mods(h.modalities);
+	int offset = 0;
+	for (int m = 0; m < h.modalities; ++m) {
+		ILVQ_XSZ_FILE_MODALITY r;
+		if (fread(&r, sizeof(r), 1, f) != 1 || r.dimension <= 0 || r.metric < 0 || r.metric >= DM_TYPES) {
+			cerr << "Model file is truncated or corrupt" << endl;
+			return false;
+		}
+		mods[m].dimension = r.dimension;
+		mods[m].metric = (DistanceMetric)r.metric;
+		mods[m].weight = r.weight;
+		mods[m].offset = offset;
+		offset += r.dimension;
+	}
+	if (!mods.empty() && h.prototypes > 0 && offset != h.dimension) {
+		cerr << "Corrupt model file: the modalities do not add up to the dimension" << endl;
+		return false;
+	}
+	if (!mods.empty() && (lazy || sketch_dimension)) {
+		cerr << "Model file has modalities, which do not go with lazy mode or the prefilter" << endl;
+		return false;
+	}
+	clear();
+	metric = (DistanceMetric)h.metric;
+	// the positions are stored dense, whatever the model was trained with
+	sparse = false;
+	if (!v1) modalities = mods;
+	ageOld = h.age_old;
+	lambda = h.lambda;
+	lambda_i = h.lambda_i;
+	mu1 = h.mu1;
+	mu2 = h.mu2;
+	std::map<ILVQ_PROTOTYPE_INDEX,ILVQ_XSZ_PROTOTYPE*> by_index;
+	ILVQ_ASPECT v(h.dimension);
+	std::vector<ILVQ_TYPE> sketch;
+	for (int j = 0; j < h.prototypes; ++j) {
+		int32_t ids[3];
+		float T_s;
+		if (fread(ids, sizeof(ids), 1, f) != 1 || fread(&T_s, sizeof(T_s), 1, f) != 1 ||
+				(h.dimension && fread(&v[0], sizeof(ILVQ_TYPE), h.dimension, f) != (size_t)h.dimension)) {
+			cerr << "Model file is truncated" << endl;
+			clear();
+			return false;
+		}
+		if (sketch_dimension > 0) project(v, sketch);
+		next_index = ids[0];
+		ILVQ_XSZ_PROTOTYPE *p = by_index[ids[0]] = newPrototype(v, ids[1], sketch);
+		p->winner_count = ids[2];
+		p->T_s = T_s;
+		winner_count_sum += p->winner_count;
+	}
+	for (int j = 0; j < h.connections; ++j) {
+		int32_t c[3];
+		if (fread(c, sizeof(c), 1, f) != 1 || !by_index.count(c[0]) || !by_index.count(c[1])) {
+			cerr << "Model file is truncated or corrupt" << endl;
+			clear();
+			return false;
+		}
+		ILVQ_XSZ_PROTOTYPE *s1 = by_index[c[0]], *s2 = by_index[c[1]];
+		addEdge(s1, s2);
+		// addEdge counts as a win and ages the other edges, undo that
+		s1->winner_count--;
+		winner_count_sum--;
+		ILVQ_XSZ_CONNECTIONS::const_iterator it_e;
+		for (it_e = s1->outgoing_connections->begin(); it_e != s1->outgoing_connections->end(); ++it_e) {
+			(*it_e)->age--;
+		}
+		s1->outgoing_connections->back()->age = c[2];
+	}
+	next_index = h.next_index;
+	// the keys in the heap are from before the winner counts were corrected
+	if (max_prototypes > 0) setBudget(max_prototypes, eviction);
+	return true;
+}
+
 ILVQ_CLASS_REPRESENTATION ILVQ_XSZ::classify(ILVQ_ASPECT & input) {
-	getClosePrototypes(input, temp_winners);
+	assert (!sparse);
+	if (sketch_dimension > 0) project(input, temp_projection);
+	getClosePrototypes(input, temp_projection, temp_winners, TE_CLASSIFY);
 	return temp_winners.s1->class_id;
 }
 
+void ILVQ_XSZ::setLazy(bool lazy, int window) {
+	assert (window > 0 && (!lazy || (!sparse && modalities.empty())));
+	flush();
+	this->lazy = lazy;
+	lazy_window = std::min(window, ILVQ_LAZY_MAX);
+	lazy_inputs.clear();
+}
+
+void ILVQ_XSZ::flush() {
+	std::set<ILVQ_XSZ_PROTOTYPE*>::const_iterator it;
+	for (it = prototypes.begin(); it != prototypes.end(); ++it) {
+		flush(**it);
+	}
+	lazy_slot = 0;
+}
+
+/**
+ * The pending updates are applied in the order in which they were made, with exactly the same
+ * operations as adjust_fused, so the result is bit for bit the same as in eager mode. The norm is
+ * summed in the same order as well. If scratch is the prototype itself, it is updated in place.
+ */
+const ILVQ_PROTOTYPE & ILVQ_XSZ::position(const ILVQ_XSZ_PROTOTYPE & p, ILVQ_PROTOTYPE & scratch,
+		ILVQ_TYPE & p_norm) {
+	if (p.pending.empty()) {
+		p_norm = p.norm;
+		return *p.prototype;
+	}
+	const int n = p.prototype->size();
+	const int count = p.pending.size();
+	assert (count <= ILVQ_LAZY_MAX);
+	const ILVQ_TYPE *x[ILVQ_LAZY_MAX];
+	ILVQ_TYPE mu[ILVQ_LAZY_MAX];
+	for (int k = 0; k < count; ++k) {
+		x[k] = &lazy_inputs[p.pending[k].slot * n];
+		mu[k] = p.pending[k].mu;
+	}
+	scratch.resize(n);
+	adjust_series(&(*p.prototype)[0], &scratch[0], x, mu, count, n);
+	p_norm = std::sqrt(dot_product(&scratch[0], &scratch[0], n));
+	return scratch;
+}
+
 /**
- * Returns the two closest prototypes to the given input.
+ * Bounded selection of the k smallest distances. The distances are kept sorted and padded with
+ * "infinity", so the insertion position is just the number of entries that are smaller or equal,
+ * a branch-free count the compiler vectorizes for small k. Most distances are rejected by the
+ * single comparison against the current k-th distance.
  */
-void ILVQ_XSZ::getClosePrototypes(const ILVQ_ASPECT & input, ILVQ_XSZ_PROTOTYPE_PAIR & winners) {
+class top_k {
+	int k_;
+	ILVQ_TYPE *dist_;
+	ILVQ_XSZ_PROTOTYPE **proto_;
+public:
+	void init(int k, ILVQ_TYPE *dist, ILVQ_XSZ_PROTOTYPE **proto) {
+		k_ = k;
+		dist_ = dist;
+		proto_ = proto;
+		std::fill(dist_, dist_ + k_, numeric_limits<ILVQ_TYPE>::max());
+		std::fill(proto_, proto_ + k_, (ILVQ_XSZ_PROTOTYPE*)NULL);
+	}
+	inline void push(ILVQ_TYPE d, ILVQ_XSZ_PROTOTYPE *p) {
+		if (d >= dist_[k_-1]) return;
+		int pos = 0;
+		for (int i = 0; i < k_; ++i) pos += (dist_[i] <= d);
+		for (int i = k_ - 1; i > pos; --i) {
+			dist_[i] = dist_[i-1];
+			proto_[i] = proto_[i-1];
+		}
+		dist_[pos] = d;
+		proto_[pos] = p;
+	}
+};
+
+void ILVQ_XSZ::getTopK(const ILVQ_ASPECT * const * inputs, int count, int k, ILVQ_XSZ_PROTOTYPE **out_protos,
+		ILVQ_TYPE *out_dists) {
+	assert (!sparse);
+	const int candidates = std::max(shortlist, k);
+	if (sketch_dimension > 0 && (int)prototypes.size() > candidates) {
+		getTopKPrefiltered(inputs, count, k, candidates, out_protos, out_dists);
+		return;
+	}
+	for (int b = 0; b < count; b += ILVQ_BATCH) {
+		int n = std::min(ILVQ_BATCH, count - b);
+		top_k sel[ILVQ_BATCH];
+		ILVQ_TYPE input_norm[ILVQ_BATCH];
+		ILVQ_PROTOTYPE scratch; // per call, so threads do not share it
+		for (int i = 0; i < n; ++i) {
+			sel[i].init(k, out_dists + (b+i)*k, out_protos + (b+i)*k);
+			input_norm[i] = (metric == DM_COSINE) ? norm(*inputs[b+i]) : 0;
+		}
+		std::set<ILVQ_XSZ_PROTOTYPE*>::const_iterator it;
+		for (it = prototypes.begin(); it != prototypes.end(); ++it) {
+			if ((*it)->pending.empty()) {
+				for (int i = 0; i < n; ++i) {
+					sel[i].push(distance(*inputs[b+i], input_norm[i], **it, scratch), *it);
+				}
+				continue;
+			}
+			// materialize a lazy prototype once for the whole batch
+			ILVQ_TYPE p_norm;
+			const ILVQ_PROTOTYPE & v = position(**it, scratch, p_norm);
+			for (int i = 0; i < n; ++i) {
+				sel[i].push(distance(*inputs[b+i], v, metric, input_norm[i], p_norm), *it);
+			}
+		}
+#ifdef ILVQ_TRACE
+		for (int i = 0; i < n; ++i) {
+			ILVQ_XSZ_PROTOTYPE **p = out_protos + (b+i)*k;
+			ILVQ_TYPE *d = out_dists + (b+i)*k;
+			ILVQ_TRACE_EVENT(TE_CLASSIFY, p[0] ? p[0]->index : -1, (k > 1 && p[1]) ? p[1]->index : -1,
+					p[0] ? p[0]->class_id : -1, d[0], (k > 1) ? d[1] : 0);
+		}
+#endif
+	}
+}
+
+/**
+ * As in getClosePrototypes, but everything is local, so threads do not share anything but the
+ * model. The projection matrix exists already, because the prototypes have been projected.
+ */
+void ILVQ_XSZ::getTopKPrefiltered(const ILVQ_ASPECT * const * inputs, int count, int k, int candidates,
+		ILVQ_XSZ_PROTOTYPE **out_protos, ILVQ_TYPE *out_dists) {
+	DistanceMetric sketch_metric = (metric == DM_MANHATTAN) ? DM_EUCLIDEAN : metric;
+	std::vector<ILVQ_TYPE> sketch;
+	std::vector<std::pair<ILVQ_TYPE,ILVQ_XSZ_PROTOTYPE*> > list;
+	list.reserve(prototypes.size());
+	ILVQ_PROTOTYPE scratch;
+	for (int i = 0; i < count; ++i) {
+		project(*inputs[i], sketch);
+		list.clear();
+		std::set<ILVQ_XSZ_PROTOTYPE*>::const_iterator it;
+		for (it = prototypes.begin(); it != prototypes.end(); ++it) {
+			list.push_back(make_pair(distance(sketch, (*it)->sketch, sketch_metric), *it));
+		}
+		std::nth_element(list.begin(), list.begin() + candidates, list.end());
+		top_k sel;
+		sel.init(k, out_dists + i*k, out_protos + i*k);
+		ILVQ_TYPE input_norm = (metric == DM_COSINE) ? norm(*inputs[i]) : 0;
+		for (int j = 0; j < candidates; ++j) {
+			sel.push(distance(*inputs[i], input_norm, *list[j].second, scratch), list[j].second);
+		}
+#ifdef ILVQ_TRACE
+		ILVQ_XSZ_PROTOTYPE **p = out_protos + i*k;
+		ILVQ_TYPE *d = out_dists + i*k;
+		ILVQ_TRACE_EVENT(TE_CLASSIFY, p[0]->index, (k > 1) ? p[1]->index : -1, p[0]->class_id, d[0],
+				(k > 1) ? d[1] : 0);
+#endif
+	}
+}
+
+ILVQ_CLASS_REPRESENTATION ILVQ_XSZ::vote(ILVQ_XSZ_PROTOTYPE * const * protos, const ILVQ_TYPE *dists, int k,
+		ILVQ_TYPE *confidence) {
+	const ILVQ_TYPE epsilon = 1e-6;
+	std::vector<std::pair<ILVQ_CLASS_REPRESENTATION,ILVQ_TYPE> > votes;
+	ILVQ_TYPE total = 0;
+	for (int j = 0; j < k && protos[j] != NULL; ++j) {
+		ILVQ_TYPE w = 1 / (dists[j] + epsilon);
+		total += w;
+		unsigned int c = 0;
+		while (c < votes.size() && votes[c].first != protos[j]->class_id) c++;
+		if (c == votes.size()) votes.push_back(make_pair(protos[j]->class_id, ILVQ_TYPE(0)));
+		votes[c].second += w;
+	}
+	if (votes.empty()) {
+		if (confidence) *confidence = 0;
+		return -1;
+	}
+	unsigned int best = 0;
+	for (unsigned int c = 1; c < votes.size(); ++c) {
+		if (votes[c].second > votes[best].second) best = c;
+	}
+	if (confidence) *confidence = votes[best].second / total;
+	return votes[best].first;
+}
+
+/**
+ * The part of a batch that is handled by one thread. It writes only to its own range of the
+ * output arrays, and the model is not modified (the set of prototypes is only read), so no
+ * locking is needed.
+ */
+struct ILVQ_XSZ::TopKJob {
+	ILVQ_XSZ *ilvq;
+	const std::vector<ILVQ_ASPECT> *inputs;
+	int k;
+	std::vector<ILVQ_XSZ_PROTOTYPE*> protos;
+	std::vector<ILVQ_TYPE> dists;
+
+	TopKJob(ILVQ_XSZ *ilvq, const std::vector<ILVQ_ASPECT> & inputs, int k): ilvq(ilvq), inputs(&inputs), k(k),
+			protos(inputs.size() * k), dists(inputs.size() * k) {}
+
+	void operator()(int begin, int end, int thread) {
+		std::vector<const ILVQ_ASPECT*> ptrs(end - begin);
+		for (int i = begin; i < end; ++i) ptrs[i-begin] = &(*inputs)[i];
+		ilvq->getTopK(&ptrs[0], end - begin, k, &protos[begin*k], &dists[begin*k]);
+	}
+};
+
+void ILVQ_XSZ::classify(const std::vector<ILVQ_ASPECT> & inputs, std::vector<ILVQ_CLASS_REPRESENTATION> & classes,
+		int threads) {
+	TopKJob job(this, inputs, 1);
+	parallel_for(inputs.size(), threads, job);
+	classes.resize(inputs.size());
+	for (unsigned int i = 0; i < inputs.size(); ++i) {
+		classes[i] = job.protos[i] ? job.protos[i]->class_id : -1;
+	}
+}
+
+ILVQ_PROTOTYPE_INDEX ILVQ_XSZ::getWinner(const ILVQ_ASPECT & input) {
+	ILVQ_XSZ_PROTOTYPE *p;
+	ILVQ_TYPE d;
+	const ILVQ_ASPECT *ptr = &input;
+	getTopK(&ptr, 1, 1, &p, &d);
+	return p ? p->index : -1;
+}
+
+int ILVQ_XSZ::classifyTopK(const ILVQ_ASPECT & input, int k, ILVQ_CLASS_REPRESENTATION *out_ids,
+		ILVQ_TYPE *out_dists) {
+	assert (k > 0);
+	temp_topk_protos.resize(k);
+	temp_topk_dists.resize(k);
+	const ILVQ_ASPECT *ptr = &input;
+	getTopK(&ptr, 1, k, &temp_topk_protos[0], &temp_topk_dists[0]);
+	int found = 0;
+	for (int j = 0; j < k; ++j) {
+		out_ids[j] = temp_topk_protos[j] ? temp_topk_protos[j]->class_id : -1;
+		if (out_dists) out_dists[j] = temp_topk_dists[j];
+		if (temp_topk_protos[j]) found++;
+	}
+	return found;
+}
+
+void ILVQ_XSZ::classifyTopK(const std::vector<ILVQ_ASPECT> & inputs, int k, ILVQ_CLASS_REPRESENTATION *out_ids,
+		ILVQ_TYPE *out_dists, int threads) {
+	assert (k > 0);
+	TopKJob job(this, inputs, k);
+	parallel_for(inputs.size(), threads, job);
+	for (unsigned int i = 0; i < job.protos.size(); ++i) {
+		out_ids[i] = job.protos[i] ? job.protos[i]->class_id : -1;
+		if (out_dists) out_dists[i] = job.dists[i];
+	}
+}
+
+ILVQ_CLASS_REPRESENTATION ILVQ_XSZ::classifyKNN(const ILVQ_ASPECT & input, int k, ILVQ_TYPE *confidence) {
+	assert (k > 0);
+	temp_topk_protos.resize(k);
+	temp_topk_dists.resize(k);
+	const ILVQ_ASPECT *ptr = &input;
+	getTopK(&ptr, 1, k, &temp_topk_protos[0], &temp_topk_dists[0]);
+	return vote(&temp_topk_protos[0], &temp_topk_dists[0], k, confidence);
+}
+
+void ILVQ_XSZ::classifyKNN(const std::vector<ILVQ_ASPECT> & inputs, int k,
+		std::vector<ILVQ_CLASS_REPRESENTATION> & classes, std::vector<ILVQ_TYPE> *confidences, int threads) {
+	assert (k > 0);
+	TopKJob job(this, inputs, k);
+	parallel_for(inputs.size(), threads, job);
+	classes.resize(inputs.size());
+	if (confidences) confidences->resize(inputs.size());
+	for (unsigned int i = 0; i < inputs.size(); ++i) {
+		classes[i] = vote(&job.protos[i*k], &job.dists[i*k], k, confidences ? &(*confidences)[i] : NULL);
+	}
+}
+
+/**
+ * Returns the two closest prototypes to the given input. If tracing is compiled in, the result is
+ * recorded as an event of the given type. With the prefilter, only the prototypes of which the
+ * sketch is among the closest "shortlist" are considered. Manhattan distance is not preserved by
+ * a random projection, so then the sketches are compared with the euclidean distance.
+ */
+void ILVQ_XSZ::getClosePrototypes(const ILVQ_ASPECT & input, const std::vector<ILVQ_TYPE> & sketch,
+		ILVQ_XSZ_PROTOTYPE_PAIR & winners, TraceEventType event) {
+	assert (!sparse && modalities.empty() && sketch.size() == (unsigned int)sketch_dimension);
 	std::set<ILVQ_XSZ_PROTOTYPE*>::const_iterator it;
 	ILVQ_TYPE winner_value = numeric_limits<ILVQ_TYPE>::max();
 	ILVQ_TYPE runnerup_value = numeric_limits<ILVQ_TYPE>::max();
 	winners.s1 = winners.s2 = NULL;
+	ILVQ_TYPE input_norm = (metric == DM_COSINE) ? norm(input) : 0;
 	if (debug >= LOG_DEBUG) {
 		cout << "Number of prototypes: " << prototypes.size() << endl;
 	}
+	if (sketch_dimension > 0 && (int)prototypes.size() > shortlist) {
+		DistanceMetric sketch_metric = (metric == DM_MANHATTAN) ? DM_EUCLIDEAN : metric;
+		temp_shortlist.clear();
+		for (it = prototypes.begin(); it != prototypes.end(); ++it) {
+			temp_shortlist.push_back(make_pair(distance(sketch, (*it)->sketch, sketch_metric), *it));
+		}
+		std::nth_element(temp_shortlist.begin(), temp_shortlist.begin() + shortlist, temp_shortlist.end());
+		for (int j = 0; j < shortlist; ++j) {
+			ILVQ_XSZ_PROTOTYPE *p = temp_shortlist[j].second;
+			ILVQ_TYPE dist = distance(input, input_norm, *p);
+			if (dist < winner_value) {
+				winners.s2 = winners.s1;
+				runnerup_value = winner_value;
+				winners.s1 = p;
+				winner_value = dist;
+			} else if (dist < runnerup_value) {
+				winners.s2 = p;
+				runnerup_value = dist;
+			}
+		}
+		ILVQ_TRACE_EVENT(event, winners.s1->index, winners.s2->index, winners.s1->class_id, winner_value,
+				runnerup_value);
+		return;
+	}
 	int index = 0;
 	for (it = prototypes.begin(); it != prototypes.end(); ++it) {
 		ILVQ_XSZ_PROTOTYPE *p = *it;
-		ILVQ_TYPE dist = distance(input, *p->prototype, DM_EUCLIDEAN);
-		if (debug >= LOG_ERR) index++;
+		ILVQ_TYPE dist = distance(input, input_norm, *p);
+		if (debug >= LOG_DEBUG) index++;
 		if (dist < winner_value) {
 			winners.s2 = winners.s1;
 			runnerup_value = winner_value;
@@ -124,6 +996,8 @@ void ILVQ_XSZ::getClosePrototypes(const ILVQ_ASPECT & input, ILVQ_XSZ_PROTOTYPE_
 			runnerup_value = dist;
 		}
 	}
+	ILVQ_TRACE_EVENT(event, winners.s1 ? winners.s1->index : -1, winners.s2 ? winners.s2->index : -1,
+			winners.s1 ? winners.s1->class_id : -1, winner_value, runnerup_value);
 	if (debug >= LOG_INFO) {
 		if (winners.s1 != NULL) {
 			cout << "Winner is: ";
@@ -140,20 +1014,43 @@ void ILVQ_XSZ::getClosePrototypes(const ILVQ_ASPECT & input, ILVQ_XSZ_PROTOTYPE_
 	}
 }
 
-bool ILVQ_XSZ::isNewPrototype(const ILVQ_ASPECT & input, ILVQ_CLASS_REPRESENTATION & class_rep,
-		const ILVQ_XSZ_PROTOTYPE_PAIR & winners) {
+void ILVQ_XSZ::getClosePrototypes(const ILVQ_SPARSE_ASPECT & input, ILVQ_TYPE input_norm,
+		ILVQ_XSZ_PROTOTYPE_PAIR & winners, TraceEventType event) {
+	std::set<ILVQ_XSZ_PROTOTYPE*>::const_iterator it;
+	ILVQ_TYPE winner_value = numeric_limits<ILVQ_TYPE>::max();
+	ILVQ_TYPE runnerup_value = numeric_limits<ILVQ_TYPE>::max();
+	winners.s1 = winners.s2 = NULL;
+	for (it = prototypes.begin(); it != prototypes.end(); ++it) {
+		ILVQ_TYPE dist = distance(input, input_norm, **it);
+		if (dist < winner_value) {
+			winners.s2 = winners.s1;
+			runnerup_value = winner_value;
+			winners.s1 = *it;
+			winner_value = dist;
+		} else if (dist < runnerup_value) {
+			winners.s2 = *it;
+			runnerup_value = dist;
+		}
+	}
+	ILVQ_TRACE_EVENT(event, winners.s1 ? winners.s1->index : -1, winners.s2 ? winners.s2->index : -1,
+			winners.s1 ? winners.s1->class_id : -1, winner_value, runnerup_value);
+}
+
+bool ILVQ_XSZ::isNewPrototype(const ILVQ_ASPECT & input, const std::vector<ILVQ_TYPE> &,
+		ILVQ_CLASS_REPRESENTATION & class_rep, const ILVQ_XSZ_PROTOTYPE_PAIR & winners) {
 	if (!winners.s1 || !winners.s2) {
 		if (debug >= LOG_DEBUG)
 			cout << "No two winners available" << endl;
 		return true;
 	}
-	ILVQ_TYPE dT1 = distance(input, *winners.s1->prototype, DM_EUCLIDEAN);
+	ILVQ_TYPE input_norm = (metric == DM_COSINE) ? norm(input) : 0;
+	ILVQ_TYPE dT1 = distance(input, input_norm, *winners.s1);
 	if (dT1 > winners.s1->T_s) {
 		if (debug >= LOG_DEBUG)
 			cout << "Far enough from winner: " << dT1 << " > " << winners.s1->T_s << endl;
 		return true;
 	}
-	ILVQ_TYPE dT2 = distance(input, *winners.s2->prototype, DM_EUCLIDEAN);
+	ILVQ_TYPE dT2 = distance(input, input_norm, *winners.s2);
 	if (dT2 > winners.s2->T_s) return true;
 	if (isNewClass(class_rep)) return true;
 	if (debug >= LOG_INFO) {
@@ -162,6 +1059,53 @@ bool ILVQ_XSZ::isNewPrototype(const ILVQ_ASPECT & input, ILVQ_CLASS_REPRESENTATI
 	return false;
 }
 
+void ILVQ_XSZ::getClosePrototypes(const ILVQ_VIEW &, const ILVQ_XSZ_VIEW & view,
+		ILVQ_XSZ_PROTOTYPE_PAIR & winners, TraceEventType event) {
+	std::set<ILVQ_XSZ_PROTOTYPE*>::const_iterator it;
+	ILVQ_TYPE winner_value = numeric_limits<ILVQ_TYPE>::max();
+	ILVQ_TYPE runnerup_value = numeric_limits<ILVQ_TYPE>::max();
+	winners.s1 = winners.s2 = NULL;
+	for (it = prototypes.begin(); it != prototypes.end(); ++it) {
+		ILVQ_TYPE dist = distance(&view.x[0], &view.norms[0], &(*(*it)->prototype)[0], &(*it)->norms[0]);
+		if (dist < winner_value) {
+			winners.s2 = winners.s1;
+			runnerup_value = winner_value;
+			winners.s1 = *it;
+			winner_value = dist;
+		} else if (dist < runnerup_value) {
+			winners.s2 = *it;
+			runnerup_value = dist;
+		}
+	}
+	ILVQ_TRACE_EVENT(event, winners.s1 ? winners.s1->index : -1, winners.s2 ? winners.s2->index : -1,
+			winners.s1 ? winners.s1->class_id : -1, winner_value, runnerup_value);
+}
+
+/**
+ * The thresholds come from edge lengths over all modalities, so the distances are as well, with
+ * the absent modalities of the input taken from the winner.
+ */
+bool ILVQ_XSZ::isNewPrototype(const ILVQ_VIEW &, const ILVQ_XSZ_VIEW & view,
+		ILVQ_CLASS_REPRESENTATION & class_rep, const ILVQ_XSZ_PROTOTYPE_PAIR & winners) {
+	if (!winners.s1 || !winners.s2) return true;
+	fillView(view, *winners.s1, temp_filled_view);
+	const ILVQ_XSZ_VIEW & x = temp_filled_view;
+	const ILVQ_XSZ_PROTOTYPE *s[2] = { winners.s1, winners.s2 };
+	for (int j = 0; j < 2; ++j) {
+		ILVQ_TYPE dist = distance(&x.x[0], &x.norms[0], &(*s[j]->prototype)[0], &s[j]->norms[0]);
+		if (dist > s[j]->T_s) return true;
+	}
+	return isNewClass(class_rep);
+}
+
+bool ILVQ_XSZ::isNewPrototype(const ILVQ_SPARSE_ASPECT & input, ILVQ_TYPE input_norm,
+		ILVQ_CLASS_REPRESENTATION & class_rep, const ILVQ_XSZ_PROTOTYPE_PAIR & winners) {
+	if (!winners.s1 || !winners.s2) return true;
+	if (distance(input, input_norm, *winners.s1) > winners.s1->T_s) return true;
+	if (distance(input, input_norm, *winners.s2) > winners.s2->T_s) return true;
+	return isNewClass(class_rep);
+}
+
 bool ILVQ_XSZ::isNewClass(ILVQ_CLASS_REPRESENTATION & class_rep) {
 	std::set<ILVQ_XSZ_PROTOTYPE*>::const_iterator it;
 	for (it = prototypes.begin(); it != prototypes.end(); ++it) {
@@ -170,6 +1114,25 @@ bool ILVQ_XSZ::isNewClass(ILVQ_CLASS_REPRESENTATION & class_rep) {
 	return true;
 }
 
+/**
+ * Dot product of two stored prototypes (without scale) over the smaller of their supports, the
+ * other entries of that prototype are zero. The words of the bitmap are skipped 64 entries at a
+ * time, so this costs the dimension / 64 plus the size of the support.
+ */
+static ILVQ_TYPE support_dot(const ILVQ_XSZ_PROTOTYPE &a, const ILVQ_XSZ_PROTOTYPE &b) {
+	const ILVQ_XSZ_PROTOTYPE &s = (a.support_count <= b.support_count) ? a : b;
+	const ILVQ_TYPE *u = &(*a.prototype)[0], *v = &(*b.prototype)[0];
+	if (s.support.empty()) return dot_product(u, v, a.prototype->size());
+	ILVQ_TYPE dot = 0;
+	for (unsigned int j = 0; j < s.support.size(); ++j) {
+		for (uint64_t word = s.support[j]; word; word &= word - 1) {
+			int i = (j << 6) + __builtin_ctzll(word);
+			dot += u[i] * v[i];
+		}
+	}
+	return dot;
+}
+
 /**
  * Creation of an edge if it does not exist. Updating the ages of the outgoing edges.
  * And updating the winning count of the source node.
@@ -194,7 +1157,12 @@ void ILVQ_XSZ::addEdge(ILVQ_XSZ_PROTOTYPE *s1, ILVQ_XSZ_PROTOTYPE *s2) {
 		c->s1 = s1;
 		c->s2 = s2;
 		c->age = 0;
+		c->version1 = c->version2 = -1;
 		s1->outgoing_connections->push_back(c);
+		s2->incoming_connections.push_back(c);
+		updateBucket(*s1);
+		if (max_prototypes > 0 && eviction == EV_REDUNDANT) budgetUpdate(*s2);
+		if (sparse) c->dot = support_dot(*s1, *s2);
 		if (debug >= LOG_DEBUG) {
 			cout << __func__ << ": Add edge between ";
 			print(*c->s1->prototype);
@@ -205,32 +1173,267 @@ void ILVQ_XSZ::addEdge(ILVQ_XSZ_PROTOTYPE *s1, ILVQ_XSZ_PROTOTYPE *s2) {
 	}
 	// update winner count
 	s1->winner_count++;
+	winner_count_sum++;
+	s1->last_win = ++budget_clock;
+	if (max_prototypes > 0) budgetUpdate(*s1);
 	//	cout << "Increment winner count" << endl;
 }
 
 /**
- * Updating the prototypes towards or from the input.
+ * Updating the prototypes towards or from the input. The winner moves with mu1 towards the input
+ * if it has the right class (else away), its neighbours move with mu2 the other way around. This
+ * is done in one pass over the input, and in that pass the norms and the lengths of the edges from
+ * the winner to its neighbours are calculated as well. In lazy mode only the winner is moved.
  */
 void ILVQ_XSZ::updatePrototype(ILVQ_XSZ_PROTOTYPE &winner, const ILVQ_ASPECT & input,
+		const std::vector<ILVQ_TYPE> & sketch, ILVQ_CLASS_REPRESENTATION & class_rep) {
+	ILVQ_TYPE mu_w = (winner.class_id == class_rep) ? -mu1 : mu1;
+	ILVQ_TYPE mu_v = (winner.class_id == class_rep) ? mu2 : -mu2;
+	ILVQ_XSZ_CONNECTIONS &e = *winner.outgoing_connections;
+	ILVQ_XSZ_CONNECTIONS::const_iterator it_e;
+	if (sketch_dimension > 0) {
+		updateSketch(winner, sketch, mu_w);
+		for (it_e = e.begin(); it_e != e.end(); ++it_e) {
+			updateSketch(*(*it_e)->s2, sketch, mu_v);
+		}
+	}
+	if (lazy) {
+		updatePrototypeLazy(winner, input, mu_w, mu_v);
+		return;
+	}
+	temp_neighbours.clear();
+	for (it_e = e.begin(); it_e != e.end(); ++it_e) {
+		assert ((*it_e)->s2->prototype->size() == input.size());
+		temp_neighbours.push_back(&(*(*it_e)->s2->prototype)[0]);
+	}
+	int count = temp_neighbours.size();
+	temp_scratch.resize(4*count + 1);
+	temp_norms.resize(count + 1);
+	temp_edges.resize(count + 1);
+	assert (winner.prototype->size() == input.size());
+	ILVQ_TYPE w_norm2;
+	ILVQ_TYPE *w = &(*winner.prototype)[0];
+	switch (metric) {
+	case DM_MANHATTAN:
+		adjust_fused<EM_ABSOLUTE>(w, mu_w, &temp_neighbours[0], count, mu_v, &input[0], input.size(),
+				&temp_scratch[0], w_norm2, &temp_norms[0], &temp_edges[0]);
+		break;
+	case DM_COSINE: case DM_DOTPRODUCT:
+		adjust_fused<EM_DOT>(w, mu_w, &temp_neighbours[0], count, mu_v, &input[0], input.size(),
+				&temp_scratch[0], w_norm2, &temp_norms[0], &temp_edges[0]);
+		break;
+	default:
+		adjust_fused<EM_SQUARED>(w, mu_w, &temp_neighbours[0], count, mu_v, &input[0], input.size(),
+				&temp_scratch[0], w_norm2, &temp_norms[0], &temp_edges[0]);
+	}
+	winner.norm = std::sqrt(w_norm2);
+	winner.version++;
+	int j = 0;
+	for (it_e = e.begin(); it_e != e.end(); ++it_e, ++j) {
+		ILVQ_XSZ_CONNECTION &c = **it_e;
+		c.s2->norm = std::sqrt(temp_norms[j]);
+		c.s2->version++;
+		c.length = temp_edges[j];
+		if (metric == DM_COSINE) {
+			ILVQ_TYPE n = winner.norm * c.s2->norm;
+			c.length = (n <= ILVQ_TYPE(0)) ? ILVQ_TYPE(1) : ILVQ_TYPE(1) - c.length / n;
+		}
+		c.version1 = winner.version;
+		c.version2 = c.s2->version;
+	}
+}
+
+/**
+ * The winner is moved right away, the update of the neighbours is only stored. The input is
+ * stored once in the log, so a neighbour update costs only a (mu, slot) pair. The edge lengths
+ * are not calculated, they are recalculated by edgeLength when needed.
+ */
+void ILVQ_XSZ::updatePrototypeLazy(ILVQ_XSZ_PROTOTYPE &winner, const ILVQ_ASPECT & input, ILVQ_TYPE mu_w,
+		ILVQ_TYPE mu_v) {
+	const int n = input.size();
+	assert (winner.prototype->size() == input.size());
+	flush(winner);
+	winner.norm = std::sqrt(adjust(&(*winner.prototype)[0], &input[0], mu_w, n));
+	winner.version++;
+	ILVQ_XSZ_CONNECTIONS &e = *winner.outgoing_connections;
+	if (e.empty()) return;
+	if (lazy_slot == lazy_window) flush();
+	lazy_inputs.resize(lazy_window * n);
+	std::copy(input.begin(), input.end(), lazy_inputs.begin() + lazy_slot * n);
+	ILVQ_XSZ_PENDING update;
+	update.mu = mu_v;
+	update.slot = lazy_slot++;
+	ILVQ_XSZ_CONNECTIONS::const_iterator it_e;
+	for (it_e = e.begin(); it_e != e.end(); ++it_e) {
+		assert ((*it_e)->s2->prototype->size() == input.size());
+		(*it_e)->s2->pending.push_back(update);
+		(*it_e)->s2->version++;
+	}
+}
+
+/**
+ * The input is a sparse vector, so w + mu (w - x) is written as (1 + mu) w - mu x. With w stored
+ * as s u, that is a new scale s' = (1 + mu) s, and u_i' = u_i - mu x_i / s' for the non-zero x_i
+ * only. The winner is updated before its neighbours, so the dot products of the edges between
+ * them, which are bilinear, can be updated one prototype at a time.
+ */
+void ILVQ_XSZ::updatePrototype(ILVQ_XSZ_PROTOTYPE &winner, const ILVQ_SPARSE_ASPECT & input, ILVQ_TYPE,
+		ILVQ_CLASS_REPRESENTATION & class_rep) {
+	ILVQ_TYPE mu_w = (winner.class_id == class_rep) ? -mu1 : mu1;
+	ILVQ_TYPE mu_v = (winner.class_id == class_rep) ? mu2 : -mu2;
+	adjustSparse(winner, input, mu_w);
+	ILVQ_XSZ_CONNECTIONS::const_iterator it_e;
+	for (it_e = winner.outgoing_connections->begin(); it_e != winner.outgoing_connections->end(); ++it_e) {
+		adjustSparse(*(*it_e)->s2, input, mu_v);
+	}
+}
+
+//! Move the modalities of p that are present in the prepared view x
+static void adjust_view(ILVQ_XSZ_PROTOTYPE &p, const std::vector<ILVQ_MODALITY> & modalities,
+		const std::vector<const ILVQ_TYPE*> & x, ILVQ_TYPE mu) {
+	for (unsigned int m = 0; m < modalities.size(); ++m) {
+		if (x[m] == NULL) continue;
+		ILVQ_TYPE *w = &(*p.prototype)[modalities[m].offset];
+		p.norms[m] = std::sqrt(adjust(w, x[m], mu, modalities[m].dimension));
+	}
+	p.version++;
+}
+
+void ILVQ_XSZ::updatePrototype(ILVQ_XSZ_PROTOTYPE &winner, const ILVQ_VIEW &, const ILVQ_XSZ_VIEW & view,
 		ILVQ_CLASS_REPRESENTATION & class_rep) {
-	if (winner.class_id == class_rep) {
-//		ILVQ_TYPE dist_pre = distance(*winner.prototype, input, DM_EUCLIDEAN);
-		decreaseDistance(*winner.prototype, input, mu1);
-//		ILVQ_TYPE dist_post = distance(*winner.prototype, input, DM_EUCLIDEAN);
-//		cout << "Distance increased with " << dist_post - dist_pre << endl;
-		ILVQ_XSZ_CONNECTIONS &e = *winner.outgoing_connections;
+	ILVQ_TYPE mu_w = (winner.class_id == class_rep) ? -mu1 : mu1;
+	ILVQ_TYPE mu_v = (winner.class_id == class_rep) ? mu2 : -mu2;
+	adjust_view(winner, modalities, view.x, mu_w);
+	ILVQ_XSZ_CONNECTIONS::const_iterator it_e;
+	for (it_e = winner.outgoing_connections->begin(); it_e != winner.outgoing_connections->end(); ++it_e) {
+		adjust_view(*(*it_e)->s2, modalities, view.x, mu_v);
+	}
+}
+
+//! Scale at which the scale is folded into the prototype, and the other way around
+#define ILVQ_SPARSE_RESCALE 1e-3
+
+//! Number of updates after which the running sums are recalculated to get rid of rounding errors
+#define ILVQ_SPARSE_REFRESH 256
+
+void ILVQ_XSZ::adjustSparse(ILVQ_XSZ_PROTOTYPE &p, const ILVQ_SPARSE_ASPECT & input, ILVQ_TYPE mu) {
+	assert (input.dimension == (int)p.prototype->size());
+	const int nnz = input.index.size();
+	ILVQ_TYPE scale = (1 + mu) * p.scale;
+	assert (scale > 0);
+	ILVQ_TYPE f = mu / scale;
+	ILVQ_TYPE *u = &(*p.prototype)[0];
+	const bool tracked = !p.support.empty();
+	temp_delta.resize(nnz);
+	for (int k = 0; k < nnz; ++k) {
+		const int i = input.index[k];
+		ILVQ_TYPE old = u[i];
+		u[i] = old - f * input.value[k];
+		if (tracked) support_add(p, i);
+		temp_delta[k] = u[i] - old;
+		p.norm2 += u[i] * u[i] - old * old;
+	}
+	if (tracked && p.support_count * ILVQ_SUPPORT_DENSE > input.dimension) {
+		std::vector<uint64_t>().swap(p.support);
+		p.support_count = input.dimension;
+	}
+	p.scale = scale;
+	p.version++;
+	if (nnz) {
 		ILVQ_XSZ_CONNECTIONS::const_iterator it_e;
-		for (it_e = e.begin(); it_e != e.end(); ++it_e) {
-			increaseDistance(*(*it_e)->s2->prototype, input, mu2);
+		for (it_e = p.outgoing_connections->begin(); it_e != p.outgoing_connections->end(); ++it_e) {
+			(*it_e)->dot += sparse_dot(&input.index[0], &temp_delta[0], nnz, &(*(*it_e)->s2->prototype)[0]);
+		}
+		for (it_e = p.incoming_connections.begin(); it_e != p.incoming_connections.end(); ++it_e) {
+			(*it_e)->dot += sparse_dot(&input.index[0], &temp_delta[0], nnz, &(*(*it_e)->s1->prototype)[0]);
+		}
+	}
+	bool refresh = !(p.version % ILVQ_SPARSE_REFRESH);
+	if (scale < ILVQ_SPARSE_RESCALE || scale > 1 / ILVQ_SPARSE_RESCALE || refresh) {
+		rescale(p, refresh);
+	}
+	p.norm = p.scale * std::sqrt(std::max(p.norm2, ILVQ_TYPE(0)));
+}
+
+/**
+ * The norm and the dot products are bilinear, so folding the scale into the prototype just scales
+ * them. That leaves only the support to visit.
+ */
+void ILVQ_XSZ::rescale(ILVQ_XSZ_PROTOTYPE &p, bool refresh) {
+	ILVQ_TYPE *u = &(*p.prototype)[0];
+	const int n = p.prototype->size();
+	ILVQ_TYPE norm2 = 0;
+	if (p.support.empty()) {
+		for (int i = 0; i < n; ++i) u[i] *= p.scale;
+		if (refresh) norm2 = dot_product(u, u, n);
+	} else {
+		for (unsigned int j = 0; j < p.support.size(); ++j) {
+			for (uint64_t word = p.support[j]; word; word &= word - 1) {
+				int i = (j << 6) + __builtin_ctzll(word);
+				u[i] *= p.scale;
+				norm2 += u[i] * u[i];
+			}
+		}
+	}
+	ILVQ_XSZ_CONNECTIONS::const_iterator it_e;
+	if (refresh) {
+		p.norm2 = norm2;
+		for (it_e = p.outgoing_connections->begin(); it_e != p.outgoing_connections->end(); ++it_e) {
+			(*it_e)->dot = support_dot(p, *(*it_e)->s2);
+		}
+		for (it_e = p.incoming_connections.begin(); it_e != p.incoming_connections.end(); ++it_e) {
+			(*it_e)->dot = support_dot(*(*it_e)->s1, p);
 		}
 	} else {
-		increaseDistance(*winner.prototype, input, mu1);
-		ILVQ_XSZ_CONNECTIONS &e = *winner.outgoing_connections;
-		ILVQ_XSZ_CONNECTIONS::const_iterator it_e;
-		for (it_e = e.begin(); it_e != e.end(); ++it_e) {
-			decreaseDistance(*(*it_e)->s2->prototype, input, mu2);
+		p.norm2 *= p.scale * p.scale;
+		for (it_e = p.outgoing_connections->begin(); it_e != p.outgoing_connections->end(); ++it_e) {
+			(*it_e)->dot *= p.scale;
 		}
+		for (it_e = p.incoming_connections.begin(); it_e != p.incoming_connections.end(); ++it_e) {
+			(*it_e)->dot *= p.scale;
+		}
+	}
+	p.scale = 1;
+}
+
+/**
+ * In sparse mode the length follows from the norms and the dot product, which are always up to
+ * date, so nothing of the full dimension is touched.
+ */
+ILVQ_TYPE ILVQ_XSZ::edgeLength(ILVQ_XSZ_CONNECTION & c) {
+	if (!modalities.empty()) {
+		if (c.version1 != c.s1->version || c.version2 != c.s2->version) {
+			temp_edge_view.resize(modalities.size());
+			for (unsigned int m = 0; m < modalities.size(); ++m) {
+				temp_edge_view[m] = &(*c.s1->prototype)[modalities[m].offset];
+			}
+			c.length = distance(&temp_edge_view[0], &c.s1->norms[0], &(*c.s2->prototype)[0], &c.s2->norms[0]);
+			c.version1 = c.s1->version;
+			c.version2 = c.s2->version;
+		}
+		return c.length;
+	}
+	if (sparse) {
+		ILVQ_TYPE dot = c.s1->scale * c.s2->scale * c.dot;
+		switch (metric) {
+		case DM_DOTPRODUCT:
+			return dot;
+		case DM_COSINE: {
+			ILVQ_TYPE n = c.s1->norm * c.s2->norm;
+			return (n <= ILVQ_TYPE(0)) ? ILVQ_TYPE(1) : ILVQ_TYPE(1) - dot / n;
+		}
+		default:
+			return std::max(ILVQ_TYPE(0), c.s1->scale * c.s1->scale * c.s1->norm2 +
+					c.s2->scale * c.s2->scale * c.s2->norm2 - 2 * dot);
+		}
+	}
+	if (c.version1 != c.s1->version || c.version2 != c.s2->version) {
+		flush(*c.s1);
+		c.length = distance(*c.s1->prototype, c.s1->norm, *c.s2);
+		c.version1 = c.s1->version;
+		c.version2 = c.s2->version;
 	}
+	return c.length;
 }
 
 /**
@@ -267,7 +1470,7 @@ void ILVQ_XSZ::updateThreshold(ILVQ_XSZ_PROTOTYPE &winner) {
 			ILVQ_XSZ_CONNECTIONS *e = (*it)->outgoing_connections;
 			ILVQ_XSZ_CONNECTIONS::const_iterator it_e;
 			for (it_e = e->begin(); it_e != e->end(); ++it_e, ++within_members) {
-				T_within += distance(*(*it_e)->s1->prototype, *(*it_e)->s2->prototype, DM_EUCLIDEAN);
+				T_within += edgeLength(**it_e);
 			}
 		}
 	}
@@ -288,8 +1491,8 @@ void ILVQ_XSZ::updateThreshold(ILVQ_XSZ_PROTOTYPE &winner) {
 			assert ((*it_e)->s1->prototype != NULL);
 			assert ((*it_e)->s2->prototype != NULL);
 			if ((*it_e)->s2->class_id == class_id) {
-				T_dist = distance(*(*it_e)->s1->prototype, *(*it_e)->s2->prototype, DM_EUCLIDEAN);
-				conn.push_back(make_pair<ILVQ_TYPE,ILVQ_XSZ_CONNECTION*>(T_dist,*it_e));
+				T_dist = edgeLength(**it_e);
+				conn.push_back(make_pair(T_dist,*it_e));
 			}
 		}
 	}
@@ -325,18 +1528,6 @@ void ILVQ_XSZ::updateThreshold(ILVQ_XSZ_PROTOTYPE &winner) {
 	conn.erase(conn.begin(), conn.end());
 }
 
-/**
- * Helper class to delete old edges
- */
-class delete_old {
-	int old;
-public:
-	delete_old(int age): old(age) {}
-	bool operator()(ILVQ_XSZ_CONNECTION *c) const {
-		return (c->age >= old);
-	}
-};
-
 /**
  * Delete edges that are too old.
  */
@@ -344,84 +1535,253 @@ void ILVQ_XSZ::deleteEdges() {
 	std::set<ILVQ_XSZ_PROTOTYPE*>::const_iterator it;
 	for (it = prototypes.begin(); it != prototypes.end(); ++it) {
 		ILVQ_XSZ_CONNECTIONS &e = *(*it)->outgoing_connections;
-		e.erase(std::remove_if(e.begin(), e.end(), delete_old(ageOld)), e.end());
+		ILVQ_XSZ_CONNECTIONS::iterator it_e = e.begin();
+		while (it_e != e.end()) {
+			if ((*it_e)->age >= ageOld) {
+				ILVQ_XSZ_PROTOTYPE *s2 = (*it_e)->s2;
+				s2->incoming_connections.remove(*it_e);
+				delete *it_e;
+				it_e = e.erase(it_e);
+				if (max_prototypes > 0 && eviction == EV_REDUNDANT) {
+					budgetUpdate(*s2);
+					budgetUpdate(**it);
+				}
+			} else {
+				++it_e;
+			}
+		}
+		updateBucket(**it);
 	}
 }
 
-class delete_target {
-	ILVQ_XSZ_PROTOTYPE* target_;
-public:
-	delete_target(ILVQ_XSZ_PROTOTYPE* target): target_(target) {}
-	bool operator()(ILVQ_XSZ_CONNECTION *c) const {
-		return (c->s2 == target_);
+/**
+ * With EV_REDUNDANT the neighbours (over incoming and outgoing connections) are visited again,
+ * that is proportional to the degree, which is small. A prototype without a close neighbour of
+ * its own class, like one that just got created, is not redundant.
+ */
+long ILVQ_XSZ::budgetKey(const ILVQ_XSZ_PROTOTYPE &p) {
+	switch (eviction) {
+	case EV_LEAST_RECENT:
+		return p.last_win;
+	case EV_LEAST_WINS:
+		return p.winner_count;
+	case EV_REDUNDANT: default:
+		long covered = 0;
+		ILVQ_XSZ_CONNECTIONS::const_iterator it_e;
+		for (it_e = p.outgoing_connections->begin(); !covered && it_e != p.outgoing_connections->end(); ++it_e) {
+			if ((*it_e)->s2->class_id == p.class_id && edgeLength(**it_e) <= p.T_s) covered = 1;
+		}
+		for (it_e = p.incoming_connections.begin(); !covered && it_e != p.incoming_connections.end(); ++it_e) {
+			if ((*it_e)->s1->class_id == p.class_id && edgeLength(**it_e) <= p.T_s) covered = 1;
+		}
+		return ((1 - covered) << 32) + p.winner_count;
 	}
-};
+}
 
-void ILVQ_XSZ::deleteEdges(ILVQ_XSZ_PROTOTYPE* target) {
-	std::set<ILVQ_XSZ_PROTOTYPE*>::const_iterator it;
-	for (it = prototypes.begin(); it != prototypes.end(); ++it) {
-		ILVQ_XSZ_CONNECTIONS &e = *(*it)->outgoing_connections;
-		e.erase(std::remove_if(e.begin(), e.end(), delete_target(target)), e.end());
+//! Order of the eviction heap, ties are broken by the index so the order does not depend on addresses
+static inline bool budget_before(const ILVQ_XSZ_PROTOTYPE *a, const ILVQ_XSZ_PROTOTYPE *b) {
+	return a->budget_key < b->budget_key || (a->budget_key == b->budget_key && a->index < b->index);
+}
+
+/**
+ * A binary min-heap in a vector, every prototype knows its position in it, so it can be moved or
+ * removed without a search.
+ */
+void ILVQ_XSZ::budgetSift(int i) {
+	ILVQ_XSZ_PROTOTYPE *p = budget_heap[i];
+	const int n = budget_heap.size();
+	while (i > 0 && budget_before(p, budget_heap[(i - 1) / 2])) {
+		budget_heap[i] = budget_heap[(i - 1) / 2];
+		budget_heap[i]->budget_heap = i;
+		i = (i - 1) / 2;
+	}
+	for (;;) {
+		int c = 2 * i + 1;
+		if (c >= n) break;
+		if (c + 1 < n && budget_before(budget_heap[c + 1], budget_heap[c])) c++;
+		if (!budget_before(budget_heap[c], p)) break;
+		budget_heap[i] = budget_heap[c];
+		budget_heap[i]->budget_heap = i;
+		i = c;
 	}
+	budget_heap[i] = p;
+	p->budget_heap = i;
 }
 
-//! Delete node on two conditions
-struct delete_empty_node {
-	bool operator()(ILVQ_XSZ_PROTOTYPE *p) const {
-		return (p->outgoing_connections->empty());
+void ILVQ_XSZ::budgetUpdate(ILVQ_XSZ_PROTOTYPE &p) {
+	if (p.budget_heap == -2) return;
+	if (p.budget_heap < 0 && eviction != EV_LEAST_RECENT && budget_clock - p.born < max_prototypes) {
+		p.budget_heap = -2;
+		p.budget_young = budget_young.insert(budget_young.end(), &p);
+		return;
 	}
-};
+	p.budget_key = budgetKey(p);
+	if (p.budget_heap < 0) {
+		budget_heap.push_back(&p);
+		p.budget_heap = budget_heap.size() - 1;
+	}
+	budgetSift(p.budget_heap);
+}
 
-class delete_lonely_node {
-	ILVQ_TYPE M_;
-public:
-	delete_lonely_node(ILVQ_TYPE M): M_(M) {}
-	bool operator()(ILVQ_XSZ_PROTOTYPE *p) const {
-		return ((p->outgoing_connections->size() == 1) && (p->winner_count < M_));
+void ILVQ_XSZ::collectAround(ILVQ_XSZ_PROTOTYPE &p) {
+	temp_refresh.push_back(&p);
+	ILVQ_XSZ_CONNECTIONS::const_iterator it_e;
+	for (it_e = p.outgoing_connections->begin(); it_e != p.outgoing_connections->end(); ++it_e) {
+		temp_refresh.push_back((*it_e)->s2);
 	}
-};
+	for (it_e = p.incoming_connections.begin(); it_e != p.incoming_connections.end(); ++it_e) {
+		temp_refresh.push_back((*it_e)->s1);
+	}
+}
 
-int sum_winner_count(int sum, ILVQ_XSZ_PROTOTYPE *p) {
-	return sum + p->winner_count;
+/**
+ * With EV_REDUNDANT the key depends on edge lengths and on T_s. A learning step moves the winner
+ * and its neighbours over outgoing connections, and changes the threshold of the winner. So the
+ * keys of the prototypes that moved and of all prototypes connected to them are updated, each
+ * once.
+ */
+void ILVQ_XSZ::budgetRefresh(ILVQ_XSZ_PROTOTYPE &winner) {
+	temp_refresh.clear();
+	collectAround(winner);
+	ILVQ_XSZ_CONNECTIONS::const_iterator it_e;
+	for (it_e = winner.outgoing_connections->begin(); it_e != winner.outgoing_connections->end(); ++it_e) {
+		collectAround(*(*it_e)->s2);
+	}
+	std::sort(temp_refresh.begin(), temp_refresh.end());
+	std::vector<ILVQ_XSZ_PROTOTYPE*>::const_iterator it, last = std::unique(temp_refresh.begin(), temp_refresh.end());
+	for (it = temp_refresh.begin(); it != last; ++it) budgetUpdate(**it);
+}
+
+void ILVQ_XSZ::budgetRemove(ILVQ_XSZ_PROTOTYPE &p) {
+	if (p.budget_heap == -2) {
+		budget_young.erase(p.budget_young);
+		p.budget_heap = -1;
+		return;
+	}
+	if (p.budget_heap < 0) return;
+	int i = p.budget_heap;
+	p.budget_heap = -1;
+	ILVQ_XSZ_PROTOTYPE *last = budget_heap.back();
+	budget_heap.pop_back();
+	if (last == &p) return;
+	budget_heap[i] = last;
+	budgetSift(i);
+}
+
+/**
+ * The prototypes of which the grace period is over are moved to the heap first. They leave the
+ * queue in order of creation, so that costs O(log n) per prototype, once.
+ */
+void ILVQ_XSZ::evict() {
+	while (!budget_young.empty() && budget_clock - budget_young.front()->born >= max_prototypes) {
+		ILVQ_XSZ_PROTOTYPE *q = budget_young.front();
+		budget_young.pop_front();
+		q->budget_heap = -1;
+		budgetUpdate(*q);
+	}
+	assert (!budget_heap.empty() || !budget_young.empty());
+	ILVQ_XSZ_PROTOTYPE *p = budget_heap.empty() ? budget_young.front() : budget_heap[0];
+	ILVQ_TRACE_EVENT(TE_EVICT, p->index, eviction, p->class_id, 0, 0);
+	if (debug >= LOG_DEBUG) {
+		cout << "Evict prototype ";
+		print(*p->prototype);
+		cout << endl;
+	}
+	deleteNode(p);
 }
 
 /**
- * Prototypes is a set, so we have to "while through it" and cannot use the erase(remove_if)
- * template.
+ * The buckets are doubly linked lists through the prototypes themselves, so moving a prototype
+ * from one bucket to another is constant time and does not allocate.
+ */
+void ILVQ_XSZ::updateBucket(ILVQ_XSZ_PROTOTYPE &p, bool remove) {
+	int bucket = p.outgoing_connections->size();
+	if (bucket > 1 || remove) bucket = -1;
+	if (bucket == p.bucket) return;
+	if (p.bucket >= 0) {
+		if (p.bucket_prev) p.bucket_prev->bucket_next = p.bucket_next;
+		else buckets[p.bucket] = p.bucket_next;
+		if (p.bucket_next) p.bucket_next->bucket_prev = p.bucket_prev;
+	}
+	p.bucket = bucket;
+	p.bucket_prev = p.bucket_next = NULL;
+	if (bucket >= 0) {
+		p.bucket_next = buckets[bucket];
+		if (p.bucket_next) p.bucket_next->bucket_prev = &p;
+		buckets[bucket] = &p;
+	}
+}
+
+/**
+ * The edges are removed from the lists at the other side as well, so this takes time
+ * proportional to the degrees of the node and its neighbours, not to the size of the graph.
+ */
+void ILVQ_XSZ::deleteNode(ILVQ_XSZ_PROTOTYPE *p) {
+	assert (p->prototype != NULL);
+	const bool redundant = max_prototypes > 0 && eviction == EV_REDUNDANT;
+	budgetRemove(*p);
+	ILVQ_XSZ_CONNECTIONS::const_iterator it_e;
+	// delete incoming edges
+	for (it_e = p->incoming_connections.begin(); it_e != p->incoming_connections.end(); ++it_e) {
+		ILVQ_XSZ_PROTOTYPE *s1 = (*it_e)->s1;
+		s1->outgoing_connections->remove(*it_e);
+		updateBucket(*s1);
+		delete *it_e;
+		if (redundant) budgetUpdate(*s1);
+	}
+	p->incoming_connections.clear();
+	// delete outgoing edges
+	ILVQ_XSZ_CONNECTIONS &e = *p->outgoing_connections;
+	for (it_e = e.begin(); it_e != e.end(); ++it_e) {
+		ILVQ_XSZ_PROTOTYPE *s2 = (*it_e)->s2;
+		s2->incoming_connections.remove(*it_e);
+		delete *it_e;
+		if (redundant) budgetUpdate(*s2);
+	}
+	e.clear();
+	updateBucket(*p, true);
+	winner_count_sum -= p->winner_count;
+	prototypes.erase(p);
+	delete p->prototype;
+	delete p->outgoing_connections;
+	delete p;
+}
+
+/**
+ * Prototypes without outgoing connections are deleted, and after that prototypes with a single
+ * connection that did not win often enough. The candidates are taken from the buckets, the
+ * average winner count from the running sum.
  */
 void ILVQ_XSZ::deleteNodes() {
-	std::set<ILVQ_XSZ_PROTOTYPE*>::iterator cur, tmp;
-	cur = prototypes.begin();
-	const std::set<ILVQ_XSZ_PROTOTYPE*>::iterator last = prototypes.end();
-	while ((cur = std::find_if(cur, last, delete_empty_node())) != last) {
-		tmp = cur++;
-		assert ((*tmp)->prototype != NULL);
-		// should not have edges going in either, but who cares, to be sure:
-		deleteEdges(*tmp);
+	temp_victims.clear();
+	for (ILVQ_XSZ_PROTOTYPE *p = buckets[0]; p != NULL; p = p->bucket_next) {
+		temp_victims.push_back(p);
+	}
+	std::vector<ILVQ_XSZ_PROTOTYPE*>::const_iterator it;
+	for (it = temp_victims.begin(); it != temp_victims.end(); ++it) {
+		ILVQ_TRACE_EVENT(TE_DELETE, (*it)->index, 0, (*it)->class_id, 0, 0);
 		if (debug >= LOG_DEBUG) {
 			cout << "Delete prototype without connections ";
-			print(*(*tmp)->prototype);
+			print(*(*it)->prototype);
 			cout << endl;
 		}
-		delete (*tmp)->prototype;
-		prototypes.erase(tmp);
-	}
-	cur = prototypes.begin();
-	ILVQ_TYPE M = std::accumulate(prototypes.begin(), prototypes.end(), 0, sum_winner_count);
-	M /= (prototypes.size()*2.0);
-	while ((cur = std::find_if(cur, last, delete_lonely_node(M))) != last) {
-		tmp = cur++;
-		assert ((*tmp)->prototype != NULL);
-		// delete incoming edges
-		deleteEdges(*tmp);
-		// delete outgoing edges
-		(*tmp)->outgoing_connections->erase((*tmp)->outgoing_connections->begin(), (*tmp)->outgoing_connections->end());
+		deleteNode(*it);
+	}
+	if (prototypes.empty()) return;
+	ILVQ_TYPE M = winner_count_sum / (prototypes.size()*2.0);
+	temp_victims.clear();
+	for (ILVQ_XSZ_PROTOTYPE *p = buckets[1]; p != NULL; p = p->bucket_next) {
+		if (p->winner_count < M) temp_victims.push_back(p);
+	}
+	for (it = temp_victims.begin(); it != temp_victims.end(); ++it) {
+		// deleting a previous one might have removed its connection
+		if ((*it)->bucket != 1) continue;
+		ILVQ_TRACE_EVENT(TE_DELETE, (*it)->index, 1, (*it)->class_id, 0, 0);
 		if (debug >= LOG_DEBUG) {
 			cout << "Delete prototype with single connection ";
-			print(*(*tmp)->prototype);
+			print(*(*it)->prototype);
 			cout << endl;
 		}
-		delete (*tmp)->prototype;
-		prototypes.erase(tmp);
+		deleteNode(*it);
 	}
 }
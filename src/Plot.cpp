@@ -24,6 +24,8 @@
 
 // General files
 #include <Plot.h>
+#include <ilvq/DecisionMap.h>
+#include <ilvq/Downsample.hpp>
 #include <math.h>
 #include <iostream>
 #include <fstream>
@@ -35,6 +37,9 @@
 
 #define VERBOSE
 
+//! Width of the plot area in pixels if plplot does not know the page size (720 x 0.7)
+#define PLOT_COLUMNS 504
+
 using namespace std;
 
 /* **************************************************************************************
@@ -57,6 +62,9 @@ Plot::Plot() {
 	plot_mode = PM_DEFAULT;
 	plot_type = PT_DEFAULT;
 
+	sampling = PS_MINMAX;
+	sample_columns = 0;
+
 	dimensions_set = false;
 }
 
@@ -184,89 +192,120 @@ PLFLT Plot::Scale(const PLFLT input, bool x_axis) {
  * Draw a PPM figure. This is a colour plot with length and width sqrt(data->size). It
  * expects values in the range [0..1] and will multiple them by 255 to obtain chars.
  * Subsequently they are put into four bins, each given a certain main colour, but with
- * the colours gradually changing from bin to bin.
+ * the colours gradually changing from bin to bin (see dobots::ppm_colour). The image is
+ * composed in memory and written at once. For the decision regions of a model, use
+ * dobots::DecisionMap, which classifies the pixels itself.
  */
 void Plot::DrawPPM() {
-	FILE *stream;
 	string file = path + ppm_file + ".ppm";
-	stream = fopen(file.c_str(), "wb" );
-	int len = sqrt(GetData().size());
+	FILE *stream = fopen(file.c_str(), "wb" );
+	if (stream == NULL) {
+		cerr << "Can not open " << file << endl;
+		return;
+	}
+	DataContainer &data = GetData();
+	int len = sqrt(data.size());
 	fprintf( stream, "P6\n%d %d\n255\n", len, len);
 
-	int sections = 4; int nof_colors = sections*255;
-	char rgb[3];
-	for(int j = 0; j < len; ++j) {
-		for (int i = 0; i < len; ++i) {
-			float value = GetData().item< float >(i+j*len) * nof_colors;
-			if(value < 0) {
-				rgb[0] = 0;
-				rgb[1] = 0;
-				rgb[2] = 0;
-			} else
-				if(value < 256)
-				{
-					rgb[0] = 0;
-					rgb[1] = value; // 0 b is bluest, and up to g+b=cyan
-					rgb[2] = 255;
-				}
-				else if(value < 511)
-				{
-					rgb[0] = 0;
-					rgb[1] = 255;
-					rgb[2] = 511 - value; // 255 is g+b=cyan, 511 g is greenest
-				}
-				else if (value < 766)
-				{
-					rgb[0] = value - 511;
-					rgb[1] = 255; // 511 g is greenest, 765 is r+g=yellow
-					rgb[2] = 0;
-				}
-				else if (value < 1021)
-				{
-					rgb[0] = 255;
-					rgb[1] = 1020 - value; // 765 is r+g=yellow, 1020 is reddest
-					rgb[2] = 0;
-				}
-			// 511 is r+g=yellow, 765 is reddest
-			fwrite(&rgb[0], 1, 1, stream);
-			fwrite(&rgb[1], 1, 1, stream);
-			fwrite(&rgb[2], 1, 1, stream);
-		}
+	std::vector<unsigned char> image(len*len*3);
+	for (int i = 0; i < len*len; ++i) {
+		dobots::ppm_colour(data.item< float >(i), &image[i*3]);
 	}
+	fwrite(&image[0], 1, image.size(), stream);
 	fclose( stream );
 }
 
 /**
- * Get the data from the given container.
+ * The points of a container for plotting. DT_FLAT and DT_F2DARRAY data is read in place, for the
+ * latter the index is the x value. Only a DT_MAP is copied to a vector first, item() on a map
+ * would make this quadratic.
+ */
+struct Plot::Series {
+	Plot *plot;
+	const DataFlat *pairs;
+	const float *values;
+
+	inline PLFLT x(int i) const { return plot->Scale(pairs ? (*pairs)[i].first : i, true); }
+	inline PLFLT y(int i) const { return plot->Scale(pairs ? (*pairs)[i].second : values[i], false); }
+};
+
+//! Points that are in the plplot arrays already
+struct PLArrays {
+	const PLFLT *xs;
+	const PLFLT *ys;
+
+	inline PLFLT x(int i) const { return xs[i]; }
+	inline PLFLT y(int i) const { return ys[i]; }
+};
+
+//! Indices of the points to draw, all of them if columns <= 0
+template <typename S>
+static void sample(PlotSampling ps, const S & s, int len, int columns, std::vector<int> & keep) {
+	switch (ps) {
+	case PS_LTTB:
+		dobots::downsample_lttb(s, len, 2 * columns, keep);
+		break;
+	case PS_MINMAX:
+	default:
+		dobots::downsample_minmax(s, len, columns, keep);
+	}
+}
+
+/**
+ * Get the data from the given container. If there are many more points than columns, only the
+ * points that shape the line are put into the arrays (see SetSampling), so plplot and the .svg
+ * file get at most a few points per pixel column. Densities are calculated over all points,
+ * they are reduced afterwards.
  */
-void Plot::GetData(DataContainer &cont, PLData & pld) {
+void Plot::GetData(DataContainer &cont, PLData & pld, int columns) {
 	pld.len = cont.size();
-	if (pld.len == 0) {
+	if (pld.len <= 0) {
+		pld.len = 0;
 		cerr << "No data available!" << endl;
 		return;
 	}
-	pld.x_axis = new PLFLT[pld.len];
-	pld.y_axis = new PLFLT[pld.len];
 	assert (cont.GetID() >= 0);
 	pld.id = cont.GetID();
 
+	DataFlat pairs;
+	Series series;
+	series.plot = this;
+	series.pairs = cont.GetFlat();
+	series.values = cont.GetArray();
+	if (series.pairs == NULL && series.values == NULL) {
+		cont.Flatten(pairs);
+		series.pairs = &pairs;
+	}
+	if (plot_type != PT_DEFAULT && series.pairs == NULL) {
+		cerr << "A density needs (x, count) pairs, not an array" << endl;
+		pld.len = 0;
+		return;
+	}
+	if (sampling == PS_NONE) columns = 0;
+	std::vector<int> keep;
+
 	switch (plot_type) {
 	case PT_DEFAULT:
 		//		cout << "Plot values" << endl;
+		sample(sampling, series, pld.len, columns, keep);
+		pld.len = keep.size();
+		pld.x_axis = new PLFLT[pld.len];
+		pld.y_axis = new PLFLT[pld.len];
 		for (int i = 0; i < pld.len; ++i) {
-			pair<DataDecoratorType,int> item = cont.item< pair<DataDecoratorType,int> >(i);
-			DataDecoratorType x = item.first;
-			int y = item.second;
-			pld.x_axis[i] = Scale(x, true);
-			pld.y_axis[i] = Scale(y, false);
+			pld.x_axis[i] = series.x(keep[i]);
+			pld.y_axis[i] = series.y(keep[i]);
 		}
 		break;
 	case PT_DENSITY:
 	case PT_CUMULATIVE_DENSITY:
+		pld.x_axis = new PLFLT[pld.len];
+		pld.y_axis = new PLFLT[pld.len];
+		const DataFlat & flat = *series.pairs;
+
 		// Total number of samples
 		long int N = 0;
 		for (int i = 0; i < pld.len; ++i) {
-			pair<DataDecoratorType,int> item = cont.item< pair<DataDecoratorType,int> >(i);
+			const pair<DataDecoratorType,int> & item = flat[i];
 			int y = item.second;
 			N += y;
 		}
@@ -280,7 +319,7 @@ void Plot::GetData(DataContainer &cont, PLData & pld) {
 		long int sum = 0;
 		for (int i = 0; i < pld.len; ++i) {
 			int index = (reverse_cdf ? pld.len - 1 - i : i);
-			pair<DataDecoratorType,int> item = cont.item< pair<DataDecoratorType,int> >(index);
+			const pair<DataDecoratorType,int> & item = flat[index];
 			DataDecoratorType x = item.first;
 			int y = item.second;
 			if (plot_type == PT_DENSITY) {
@@ -310,6 +349,17 @@ void Plot::GetData(DataContainer &cont, PLData & pld) {
 		cout << "Integration of density plot: " << lazy_integration << " (should be around 1)" << endl;
 	}
 
+	// Reduce the density in place, the kept indices are increasing
+	if (plot_type != PT_DEFAULT && columns > 0) {
+		PLArrays arrays = { pld.x_axis, pld.y_axis };
+		sample(sampling, arrays, pld.len, columns, keep);
+		for (int i = 0; i < (int)keep.size(); ++i) {
+			pld.x_axis[i] = pld.x_axis[keep[i]];
+			pld.y_axis[i] = pld.y_axis[keep[i]];
+		}
+		pld.len = keep.size();
+	}
+
 	if (!dimensions_set) {
 		pld.x_min = *min_element(pld.x_axis,pld.x_axis+pld.len);
 		pld.x_max = *max_element(pld.x_axis,pld.x_axis+pld.len);
@@ -364,6 +414,19 @@ void Plot::DrawPLPlot() { //bool data2file, bool file2data) {
 		return;
 	}
 
+	// Horizontal part of the page that is used for the plot
+	const PLFLT vp_x_min = 0.15, vp_x_max = 0.85;
+
+	// One column per pixel of the plot area, series are downsampled to that
+	int columns = sample_columns;
+	if (columns <= 0) {
+		PLFLT xp, yp;
+		PLINT xleng = 0, yleng, xoff, yoff;
+		pls->gpage(xp, yp, xleng, yleng, xoff, yoff);
+		columns = (int)(xleng * (vp_x_max - vp_x_min));
+		if (columns <= 0) columns = PLOT_COLUMNS;
+	}
+
 	std::vector<PLData> plds;
 
 	std::vector<DataContainer*>::iterator d_i;
@@ -380,13 +443,15 @@ void Plot::DrawPLPlot() { //bool data2file, bool file2data) {
 //			(*d_i)->write(std::cout);
 		}
 		PLData pld;
-		GetData(**d_i, pld);
+		GetData(**d_i, pld, columns);
 		if (pld.len == 0) {
 			cerr << "No data available, has SetData been called?" << endl;
 			continue;
 		}
 		if (pld.len == 1) {
 			cerr << "Just one data point. Does not make sense to make a plot!" << endl;
+			delete [] pld.x_axis;
+			delete [] pld.y_axis;
 			continue;
 		}
 		plds.push_back(pld);
@@ -424,7 +489,7 @@ void Plot::DrawPLPlot() { //bool data2file, bool file2data) {
 	pls->adv( 0 );
 
 	// Dimensions of the plot in "screen coordinates"
-	pls->vpor( 0.15, 0.85, 0.1, 0.9 );
+	pls->vpor( vp_x_min, vp_x_max, 0.1, 0.9 );
 
 	PLFLT x_border = (lx_max - lx_min) / 5;
 	PLFLT y_border = (ly_max - ly_min) / 5;
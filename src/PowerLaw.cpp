@@ -0,0 +1,163 @@
+/**
+ * @brief Maximum likelihood estimation of power laws with a scan over x_min
+ * @file PowerLaw.cpp
+ *
+ * This file is created at Almende B.V. It is open-source software and part of the Common
+ * Hybrid Agent Platform (CHAP). A toolbox with a lot of open-source tools, ranging from
+ * thread pools and TCP/IP components to control architectures and learning algorithms.
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless,
+ * we personally strongly object against this software used by the military, in the
+ * bio-industry, for animal experimentation, or anything that violates the Universal
+ * Declaration of Human Rights.
+ *
+ * Copyright © 2012 Anne van Rossum <anne@almende.com>
+ *
+ * @author     Anne C. van Rossum
+ * @date       Apr 22, 2012
+ * @project    Replicator FP7
+ * @company    Almende B.V.
+ * @case       Machine learning (fit for Surveyeor robots)
+ */
+
+
+#include <ilvq/PowerLaw.h>
+#include <ilvq/Parallel.hpp>
+
+#include <cmath>
+#include <limits>
+#include <algorithm>
+
+using namespace dobots;
+using namespace std;
+
+PowerLawEstimator::PowerLawEstimator(double x_min, bool discrete): x_min(x_min),
+		discrete(discrete),
+		total_n(0),
+		tail_n(0),
+		tail_log(0) {
+}
+
+/**
+ * A value above all others is inserted at the end with a hint, so sorted data is taken in linear
+ * time.
+ */
+void PowerLawEstimator::addEvent(double x, long count) {
+	if (counts.empty() || counts.rbegin()->first < x) counts.insert(counts.end(), std::make_pair(x, count));
+	else counts[x] += count;
+	total_n += count;
+	if (x >= x_min) {
+		tail_n += count;
+		tail_log += count * std::log(x);
+	}
+}
+
+/**
+ * sum_i ln (x_i / x_m) = sum_i ln x_i - n ln x_m, with x_m = x_min - 1/2 for discrete data.
+ */
+double PowerLawEstimator::getAlpha() const {
+	if (tail_n == 0) return 0;
+	double x_m = discrete ? x_min - 0.5 : x_min;
+	return 1 + tail_n / (tail_log - tail_n * std::log(x_m));
+}
+
+void PowerLawEstimator::setXMin(double x_min) {
+	this->x_min = x_min;
+	tail_n = 0;
+	tail_log = 0;
+	std::map<double,long>::const_iterator it;
+	for (it = counts.lower_bound(x_min); it != counts.end(); ++it) {
+		tail_n += it->second;
+		tail_log += it->second * std::log(it->first);
+	}
+}
+
+/**
+ * The candidates are indices in the sorted values, for each of them the exponent follows from
+ * the suffix sums. The KS distance compares the fraction of the tail at or above every value with
+ * that of the power law, P(X >= x) = ((x - 1/2) / (x_min - 1/2))^(1-alpha) (or without the 1/2).
+ */
+struct PowerLawScan {
+	const std::vector<double> *x;
+	const std::vector<double> *suffix_n, *suffix_log;
+	const std::vector<int> *candidates;
+	bool discrete;
+	std::vector<double> alpha, ks;
+
+	void operator()(int begin, int end, int thread) {
+		const double offset = discrete ? 0.5 : 0;
+		const int m = x->size();
+		for (int c = begin; c < end; ++c) {
+			const int i = (*candidates)[c];
+			const double n = (*suffix_n)[i];
+			const double x_m = (*x)[i] - offset;
+			const double a = 1 + n / ((*suffix_log)[i] - n * std::log(x_m));
+			double d = 0;
+			for (int j = i; j < m; ++j) {
+				double model = std::pow(((*x)[j] - offset) / x_m, 1 - a);
+				d = std::max(d, std::fabs((*suffix_n)[j] / n - model));
+			}
+			alpha[c] = a;
+			ks[c] = d;
+		}
+	}
+};
+
+PowerLawFit PowerLawEstimator::fit(int threads, int max_candidates, long min_tail) {
+	PowerLawFit result;
+	result.alpha = getAlpha();
+	result.x_min = x_min;
+	result.ks = numeric_limits<double>::infinity();
+	result.n = tail_n;
+	const double lowest = discrete ? 0.5 : 0;
+	std::vector<double> x, suffix_n, suffix_log;
+	x.reserve(counts.size());
+	std::map<double,long>::const_iterator it;
+	for (it = counts.upper_bound(lowest); it != counts.end(); ++it) {
+		if (it->second > 0) x.push_back(it->first);
+	}
+	const int m = x.size();
+	if (m < 2) return result;
+	suffix_n.resize(m);
+	suffix_log.resize(m);
+	double n = 0, s = 0;
+	std::map<double,long>::const_reverse_iterator r = counts.rbegin();
+	for (int i = m - 1; i >= 0; --i, ++r) {
+		while (r->first != x[i]) ++r;
+		n += r->second;
+		s += r->second * std::log(r->first);
+		suffix_n[i] = n;
+		suffix_log[i] = s;
+	}
+	// the largest value is not a candidate, a tail needs at least two values
+	int count = 0;
+	while (count < m - 1 && suffix_n[count] >= min_tail) count++;
+	std::vector<int> candidates;
+	const int step = std::max(1, (count + max_candidates - 1) / std::max(1, max_candidates));
+	for (int i = 0; i < count; i += step) candidates.push_back(i);
+	if (candidates.empty()) return result;
+
+	PowerLawScan scan;
+	scan.x = &x;
+	scan.suffix_n = &suffix_n;
+	scan.suffix_log = &suffix_log;
+	scan.candidates = &candidates;
+	scan.discrete = discrete;
+	scan.alpha.resize(candidates.size());
+	scan.ks.resize(candidates.size());
+	parallel_for(candidates.size(), threads, scan);
+
+	int best = 0;
+	for (unsigned int c = 1; c < candidates.size(); ++c) {
+		if (scan.ks[c] < scan.ks[best]) best = c;
+	}
+	result.alpha = scan.alpha[best];
+	result.x_min = x[candidates[best]];
+	result.ks = scan.ks[best];
+	result.n = (long)suffix_n[candidates[best]];
+	x_min = result.x_min;
+	tail_n = result.n;
+	tail_log = suffix_log[candidates[best]];
+	return result;
+}
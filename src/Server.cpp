@@ -0,0 +1,348 @@
+/**
+ * @brief Local classification server over a Unix domain socket
+ * @file Server.cpp
+ *
+ * This file is created at Almende B.V. It is open-source software and part of the Common
+ * Hybrid Agent Platform (CHAP). A toolbox with a lot of open-source tools, ranging from
+ * thread pools and TCP/IP components to control architectures and learning algorithms.
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless,
+ * we personally strongly object against this software used by the military, in the
+ * bio-industry, for animal experimentation, or anything that violates the Universal
+ * Declaration of Human Rights.
+ *
+ * Copyright © 2012 Anne van Rossum <anne@almende.com>
+ *
+ * @author     Anne C. van Rossum
+ * @date       Apr 22, 2012
+ * @project    Replicator FP7
+ * @company    Almende B.V.
+ * @case       Machine learning (fit for Surveyeor robots)
+ */
+
+#include <ilvq/Server.h>
+
+#include <iostream>
+#include <assert.h>
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+using namespace dobots;
+using namespace std;
+
+namespace dobots {
+
+struct ServerConnection {
+	int fd;
+	ClassifyServer *server;
+	pthread_mutex_t write_lock; // also protects outstanding
+	pthread_cond_t idle;
+	int outstanding; // requests in the queue or being classified
+};
+
+struct ServerJob {
+	ServerConnection *connection;
+	uint32_t id;
+	uint32_t k;
+	int64_t arrival;
+	ILVQ_ASPECT input;
+};
+
+}
+
+bool dobots::read_fully(int fd, void *buf, size_t n) {
+	char *p = (char*)buf;
+	while (n > 0) {
+		ssize_t r = ::read(fd, p, n);
+		if (r < 0 && errno == EINTR) continue;
+		if (r <= 0) return false;
+		p += r;
+		n -= r;
+	}
+	return true;
+}
+
+bool dobots::write_fully(int fd, const void *buf, size_t n) {
+	const char *p = (const char*)buf;
+	while (n > 0) {
+		// no SIGPIPE if the other side is gone
+		ssize_t r = ::send(fd, p, n, MSG_NOSIGNAL);
+		if (r < 0 && errno == EINTR) continue;
+		if (r <= 0) return false;
+		p += r;
+		n -= r;
+	}
+	return true;
+}
+
+int64_t dobots::now_us() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void *read_trampoline(void *arg) {
+	ServerConnection *c = (ServerConnection*)arg;
+	c->server->read(c);
+	return NULL;
+}
+
+static void *work_trampoline(void *arg) {
+	((ClassifyServer*)arg)->work();
+	return NULL;
+}
+
+ClassifyServer::ClassifyServer(ILVQ_XSZ & model, const ServerConfig & config): model(model),
+		config(config),
+		dimension(model.getDimension()),
+		stopping(0) {
+	assert (config.workers > 0 && config.max_batch > 0 && config.max_queue > 0 && config.max_connections > 0);
+	pthread_mutex_init(&lock, NULL);
+	// the batching window is a deadline on the monotonic clock
+	pthread_condattr_t attr;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&not_empty, &attr);
+	pthread_cond_init(&fewer_connections, &attr);
+	pthread_condattr_destroy(&attr);
+	pthread_cond_init(&not_full, NULL);
+	pthread_cond_init(&no_connections, NULL);
+}
+
+ClassifyServer::~ClassifyServer() {
+	pthread_cond_destroy(&fewer_connections);
+	pthread_cond_destroy(&no_connections);
+	pthread_cond_destroy(&not_full);
+	pthread_cond_destroy(&not_empty);
+	pthread_mutex_destroy(&lock);
+}
+
+void ClassifyServer::stop() {
+	__atomic_store_n(&stopping, 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * The listening socket is polled, so a stop() from a signal handler is noticed within 100ms. At
+ * the maximum number of connections, it is not polled but the server waits (as long) for one to
+ * close.
+ * After that the connections are shut down for reading, which lets their threads finish, and
+ * the workers answer what is still in the queue.
+ */
+bool ClassifyServer::run(const char *path) {
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (fd < 0 || strlen(path) >= sizeof(addr.sun_path)) {
+		cerr << "Can not create socket " << path << endl;
+		if (fd >= 0) close(fd);
+		return false;
+	}
+	strcpy(addr.sun_path, path);
+	unlink(path);
+	if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(fd, 64) < 0) {
+		cerr << "Can not listen at " << path << ": " << strerror(errno) << endl;
+		close(fd);
+		return false;
+	}
+	std::vector<pthread_t> workers(config.workers);
+	for (int t = 0; t < config.workers; ++t) {
+		pthread_create(&workers[t], NULL, work_trampoline, this);
+	}
+	while (!__atomic_load_n(&stopping, __ATOMIC_ACQUIRE)) {
+		pthread_mutex_lock(&lock);
+		bool full = (int)connections.size() >= config.max_connections;
+		if (full) {
+			int64_t deadline = now_us() + 100000;
+			struct timespec ts = { (time_t)(deadline / 1000000), (long)(deadline % 1000000) * 1000 };
+			pthread_cond_timedwait(&fewer_connections, &lock, &ts);
+		}
+		pthread_mutex_unlock(&lock);
+		if (full) continue;
+		struct pollfd p = { fd, POLLIN, 0 };
+		if (poll(&p, 1, 100) <= 0) continue;
+		int cfd = accept(fd, NULL, NULL);
+		if (cfd < 0) continue;
+		ServerConnection *c = new ServerConnection();
+		c->fd = cfd;
+		c->server = this;
+		c->outstanding = 0;
+		pthread_mutex_init(&c->write_lock, NULL);
+		pthread_cond_init(&c->idle, NULL);
+		pthread_mutex_lock(&lock);
+		connections.insert(c);
+		pthread_mutex_unlock(&lock);
+		pthread_t id;
+		pthread_attr_t attr;
+		pthread_attr_init(&attr);
+		pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+		pthread_create(&id, &attr, read_trampoline, c);
+		pthread_attr_destroy(&attr);
+	}
+	close(fd);
+	unlink(path);
+	pthread_mutex_lock(&lock);
+	std::set<ServerConnection*>::const_iterator it;
+	for (it = connections.begin(); it != connections.end(); ++it) {
+		shutdown((*it)->fd, SHUT_RD);
+	}
+	pthread_cond_broadcast(&not_empty);
+	pthread_cond_broadcast(&not_full);
+	pthread_mutex_unlock(&lock);
+	for (int t = 0; t < config.workers; ++t) {
+		pthread_join(workers[t], NULL);
+	}
+	pthread_mutex_lock(&lock);
+	while (!connections.empty()) pthread_cond_wait(&no_connections, &lock);
+	pthread_mutex_unlock(&lock);
+	return true;
+}
+
+/**
+ * Reads requests until the connection is closed. Requests that can not be answered are answered
+ * right away with SS_BAD_REQUEST. On exit it waits until all requests of the connection have been
+ * answered before the connection is closed.
+ */
+void ClassifyServer::read(ServerConnection *c) {
+	ServerRequest request;
+	while (read_fully(c->fd, &request, sizeof(request))) {
+		if (request.dimension > SERVER_MAX_DIMENSION) break;
+		ServerJob *job = new ServerJob();
+		job->connection = c;
+		job->id = request.id;
+		job->k = (request.type == SR_CLASSIFY) ? 1 : request.k;
+		job->input.resize(request.dimension);
+		if (request.dimension && !read_fully(c->fd, &job->input[0], request.dimension * sizeof(ILVQ_TYPE))) {
+			delete job;
+			break;
+		}
+		ServerResponse response = { request.id, SS_OK, 0, (uint32_t)dimension };
+		if (request.type == SR_INFO) {
+			respond(c, response, NULL);
+			delete job;
+			continue;
+		}
+		if ((request.type != SR_CLASSIFY && request.type != SR_TOPK) || job->k < 1 || job->k > SERVER_MAX_K ||
+				(int)request.dimension != dimension) {
+			response.status = SS_BAD_REQUEST;
+			respond(c, response, NULL);
+			delete job;
+			continue;
+		}
+		pthread_mutex_lock(&c->write_lock);
+		c->outstanding++;
+		pthread_mutex_unlock(&c->write_lock);
+		pthread_mutex_lock(&lock);
+		while ((int)queue.size() >= config.max_queue && !__atomic_load_n(&stopping, __ATOMIC_ACQUIRE)) {
+			pthread_cond_wait(&not_full, &lock);
+		}
+		if (__atomic_load_n(&stopping, __ATOMIC_ACQUIRE)) {
+			// the workers might be gone already
+			pthread_mutex_unlock(&lock);
+			done(c);
+			delete job;
+			break;
+		}
+		job->arrival = now_us();
+		queue.push_back(job);
+		pthread_cond_signal(&not_empty);
+		pthread_mutex_unlock(&lock);
+	}
+	pthread_mutex_lock(&c->write_lock);
+	while (c->outstanding > 0) pthread_cond_wait(&c->idle, &c->write_lock);
+	pthread_mutex_unlock(&c->write_lock);
+	close(c->fd);
+	pthread_cond_destroy(&c->idle);
+	pthread_mutex_destroy(&c->write_lock);
+	pthread_mutex_lock(&lock);
+	connections.erase(c);
+	pthread_cond_signal(&fewer_connections);
+	if (connections.empty()) pthread_cond_broadcast(&no_connections);
+	pthread_mutex_unlock(&lock);
+	delete c;
+}
+
+/**
+ * A worker waits for a first request, and then until the batch is full or the window since the
+ * arrival of that first request has passed. When stopping, it goes on until the queue is empty.
+ */
+void ClassifyServer::work() {
+	std::vector<ServerJob*> jobs;
+	pthread_mutex_lock(&lock);
+	for (;;) {
+		while (queue.empty() && !__atomic_load_n(&stopping, __ATOMIC_ACQUIRE)) {
+			pthread_cond_wait(&not_empty, &lock);
+		}
+		if (queue.empty()) break;
+		int64_t deadline = queue.front()->arrival + config.window_us;
+		while ((int)queue.size() < config.max_batch && !__atomic_load_n(&stopping, __ATOMIC_ACQUIRE)) {
+			if (now_us() >= deadline) break;
+			struct timespec ts = { (time_t)(deadline / 1000000), (long)(deadline % 1000000) * 1000 };
+			pthread_cond_timedwait(&not_empty, &lock, &ts);
+			// another worker might have taken them in the meantime
+			if (queue.empty()) break;
+		}
+		if (queue.empty()) continue;
+		jobs.clear();
+		while (!queue.empty() && (int)jobs.size() < config.max_batch) {
+			jobs.push_back(queue.front());
+			queue.pop_front();
+		}
+		pthread_cond_broadcast(&not_full);
+		pthread_mutex_unlock(&lock);
+		process(jobs);
+		pthread_mutex_lock(&lock);
+	}
+	pthread_mutex_unlock(&lock);
+}
+
+/**
+ * All requests of the batch are asked for the largest k in it, the results are cut off per
+ * request. The model is read-only, so the workers can do this concurrently.
+ */
+void ClassifyServer::process(std::vector<ServerJob*> & jobs) {
+	const int n = jobs.size();
+	uint32_t k = 1;
+	std::vector<ILVQ_ASPECT> inputs(n);
+	for (int j = 0; j < n; ++j) {
+		inputs[j].swap(jobs[j]->input);
+		k = std::max(k, jobs[j]->k);
+	}
+	std::vector<ILVQ_CLASS_REPRESENTATION> ids(n * k);
+	std::vector<ILVQ_TYPE> dists(n * k);
+	model.classifyTopK(inputs, k, &ids[0], &dists[0], 1);
+	ServerResult results[SERVER_MAX_K];
+	for (int j = 0; j < n; ++j) {
+		ServerResponse response = { jobs[j]->id, SS_OK, 0, (uint32_t)dimension };
+		for (uint32_t i = 0; i < jobs[j]->k && ids[j*k+i] >= 0; ++i) {
+			results[i].class_id = ids[j*k+i];
+			results[i].distance = dists[j*k+i];
+			response.count++;
+		}
+		respond(jobs[j]->connection, response, results);
+		done(jobs[j]->connection);
+		delete jobs[j];
+	}
+}
+
+void ClassifyServer::respond(ServerConnection *c, const ServerResponse & response, const ServerResult *results) {
+	// one write, so the client does not wait for the second half
+	char buf[sizeof(ServerResponse) + SERVER_MAX_K * sizeof(ServerResult)];
+	memcpy(buf, &response, sizeof(response));
+	if (response.count) memcpy(buf + sizeof(response), results, response.count * sizeof(ServerResult));
+	pthread_mutex_lock(&c->write_lock);
+	write_fully(c->fd, buf, sizeof(response) + response.count * sizeof(ServerResult));
+	pthread_mutex_unlock(&c->write_lock);
+}
+
+void ClassifyServer::done(ServerConnection *c) {
+	pthread_mutex_lock(&c->write_lock);
+	if (--c->outstanding == 0) pthread_cond_signal(&c->idle);
+	pthread_mutex_unlock(&c->write_lock);
+}
@@ -0,0 +1,357 @@
+/**
+ * @brief Read-only snapshots of a model in POSIX shared memory, for many reader processes
+ * @file SharedModel.cpp
+ *
+ * This file is created at Almende B.V. It is open-source software and part of the Common
+ * Hybrid Agent Platform (CHAP). A toolbox with a lot of open-source tools, ranging from
+ * thread pools and TCP/IP components to control architectures and learning algorithms.
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless,
+ * we personally strongly object against this software used by the military, in the
+ * bio-industry, for animal experimentation, or anything that violates the Universal
+ * Declaration of Human Rights.
+ *
+ * Copyright © 2012 Anne van Rossum <anne@almende.com>
+ *
+ * @author     Anne C. van Rossum
+ * @date       Apr 22, 2012
+ * @project    Replicator FP7
+ * @company    Almende B.V.
+ * @case       Machine learning (fit for Surveyeor robots)
+ */
+
+
+#include <ilvq/SharedModel.h>
+#include <ilvq/Kernels.h>
+
+#include <cmath>
+#include <iostream>
+#include <limits>
+#include <sstream>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+using namespace dobots;
+using namespace std;
+
+//! Name of the segment of a generation
+static std::string segment(const std::string & name, uint64_t generation) {
+	std::ostringstream s;
+	s << name << "." << generation;
+	return s.str();
+}
+
+//! Bytes of the modality records, padded so the positions that follow stay aligned
+static size_t modalities_size(int modalities) {
+	return ((size_t)modalities * sizeof(ILVQ_XSZ_FILE_MODALITY) + 7) & ~(size_t)7;
+}
+
+//! Bytes needed for a generation
+static size_t segment_size(int prototypes, int dimension, int modalities) {
+	return sizeof(SharedModelHeader) + modalities_size(modalities) +
+			(size_t)prototypes * (dimension + 1 + modalities) * sizeof(ILVQ_TYPE) +
+			(size_t)prototypes * sizeof(ILVQ_CLASS_REPRESENTATION);
+}
+
+SharedModelWriter::SharedModelWriter(const std::string & name): name(name), control(NULL), generation(0) {
+	int fd = shm_open(name.c_str(), O_RDWR | O_CREAT, 0644);
+	struct stat st;
+	if (fd < 0 || fstat(fd, &st) < 0 ||
+			(st.st_size < (off_t)sizeof(SharedModelControl) && ftruncate(fd, sizeof(SharedModelControl)) < 0)) {
+		cerr << "Can not create shared memory " << name << ": " << strerror(errno) << endl;
+		if (fd >= 0) close(fd);
+		return;
+	}
+	void *m = mmap(NULL, sizeof(SharedModelControl), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (m == MAP_FAILED) {
+		cerr << "Can not map shared memory " << name << ": " << strerror(errno) << endl;
+		return;
+	}
+	control = (SharedModelControl*)m;
+	if (memcmp(control->magic, "ILVQSHM1", 8)) {
+		memcpy(control->magic, "ILVQSHM1", 8);
+		__atomic_store_n(&control->generation, 0, __ATOMIC_RELEASE);
+	}
+	generation = __atomic_load_n(&control->generation, __ATOMIC_ACQUIRE);
+}
+
+SharedModelWriter::~SharedModelWriter() {
+	// the model stays published, so readers go on after the publisher quits
+	if (control != NULL) munmap(control, sizeof(SharedModelControl));
+}
+
+/**
+ * The new generation is written and unmapped before it is made current with a release store, so a
+ * reader that sees the new generation number (with an acquire load) sees all of its contents.
+ */
+bool SharedModelWriter::publish(ILVQ_XSZ & model) {
+	if (control == NULL) return false;
+	const int dim = model.getDimension();
+	const int count = model.getPrototypeCount();
+	const std::vector<ILVQ_MODALITY> & mods = model.getModalities();
+	const int modalities = mods.size();
+	const size_t size = segment_size(count, dim, modalities);
+	const uint64_t next = generation + 1;
+	const std::string seg = segment(name, next);
+	shm_unlink(seg.c_str()); // left over from a publisher that crashed
+	int fd = shm_open(seg.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+	if (fd < 0 || ftruncate(fd, size) < 0) {
+		cerr << "Can not create shared memory " << seg << ": " << strerror(errno) << endl;
+		if (fd >= 0) {
+			close(fd);
+			shm_unlink(seg.c_str());
+		}
+		return false;
+	}
+	void *m = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (m == MAP_FAILED) {
+		cerr << "Can not map shared memory " << seg << ": " << strerror(errno) << endl;
+		shm_unlink(seg.c_str());
+		return false;
+	}
+	SharedModelHeader *h = (SharedModelHeader*)m;
+	memcpy(h->magic, "ILVQGEN2", 8);
+	h->generation = next;
+	h->dimension = dim;
+	h->prototypes = count;
+	h->metric = model.getMetric();
+	h->modalities = modalities;
+	ILVQ_XSZ_FILE_MODALITY *records = (ILVQ_XSZ_FILE_MODALITY*)(h + 1);
+	for (int m = 0; m < modalities; ++m) {
+		records[m].dimension = mods[m].dimension;
+		records[m].metric = mods[m].metric;
+		records[m].weight = mods[m].weight;
+	}
+	ILVQ_TYPE *positions = (ILVQ_TYPE*)((char*)(h + 1) + modalities_size(modalities));
+	ILVQ_TYPE *norms = positions + (size_t)count * dim;
+	ILVQ_TYPE *modality_norms = norms + count;
+	model.exportPrototypes(positions, norms, (ILVQ_CLASS_REPRESENTATION*)(modality_norms + (size_t)count * modalities),
+			modality_norms);
+	munmap(m, size);
+
+	__atomic_store_n(&control->generation, next, __ATOMIC_RELEASE);
+	if (generation > 0) shm_unlink(segment(name, generation).c_str());
+	generation = next;
+	return true;
+}
+
+void SharedModelWriter::unpublish() {
+	if (control == NULL) return;
+	__atomic_store_n(&control->generation, 0, __ATOMIC_RELEASE);
+	if (generation > 0) shm_unlink(segment(name, generation).c_str());
+	shm_unlink(name.c_str());
+	generation = 0;
+}
+
+SharedModelReader::SharedModelReader(const std::string & name): name(name), control(NULL), header(NULL),
+		size(0), modalities(NULL), positions(NULL), norms(NULL), modality_norms(NULL), classes(NULL) {
+	refresh();
+}
+
+SharedModelReader::~SharedModelReader() {
+	release();
+	if (control != NULL) munmap(control, sizeof(SharedModelControl));
+}
+
+void SharedModelReader::release() {
+	if (header != NULL) munmap((void*)header, size);
+	header = NULL;
+	size = 0;
+	modalities = NULL;
+	positions = norms = modality_norms = NULL;
+	classes = NULL;
+	offsets.clear();
+}
+
+/**
+ * The publisher unlinks a generation as soon as a newer one is current, so opening the generation
+ * that was just read can fail. Then there is a newer one, which is tried instead.
+ */
+bool SharedModelReader::refresh() {
+	if (control == NULL) {
+		int fd = shm_open(name.c_str(), O_RDONLY, 0);
+		if (fd < 0) return false; // nothing published yet
+		void *m = mmap(NULL, sizeof(SharedModelControl), PROT_READ, MAP_SHARED, fd, 0);
+		close(fd);
+		if (m == MAP_FAILED) return false;
+		control = (SharedModelControl*)m;
+	}
+	uint64_t g = __atomic_load_n(&control->generation, __ATOMIC_ACQUIRE);
+	while (g != 0 && g != getGeneration()) {
+		int fd = shm_open(segment(name, g).c_str(), O_RDONLY, 0);
+		if (fd < 0) {
+			uint64_t newer = __atomic_load_n(&control->generation, __ATOMIC_ACQUIRE);
+			if (newer == g) return false; // the publisher is gone while publishing
+			g = newer;
+			continue;
+		}
+		struct stat st;
+		void *m = MAP_FAILED;
+		if (fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(SharedModelHeader)) {
+			m = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+		}
+		close(fd);
+		if (m == MAP_FAILED) return false;
+		const SharedModelHeader *h = (const SharedModelHeader*)m;
+		const ILVQ_XSZ_FILE_MODALITY *records = (const ILVQ_XSZ_FILE_MODALITY*)(h + 1);
+		bool valid = !memcmp(h->magic, "ILVQGEN2", 8) && h->generation == g && h->metric >= 0 &&
+				h->metric < DM_TYPES && h->modalities >= 0 && h->prototypes >= 0 && h->dimension >= 0 &&
+				(size_t)st.st_size >= segment_size(h->prototypes, h->dimension, h->modalities);
+		int packed = 0;
+		for (int i = 0; valid && i < h->modalities; ++i) {
+			valid = records[i].dimension > 0 && records[i].metric >= 0 && records[i].metric < DM_TYPES;
+			packed += records[i].dimension;
+		}
+		if (!valid || (h->modalities > 0 && packed != h->dimension)) {
+			cerr << "Corrupt shared model " << segment(name, g) << endl;
+			munmap(m, st.st_size);
+			return false;
+		}
+		release();
+		header = h;
+		size = st.st_size;
+		modalities = records;
+		positions = (const ILVQ_TYPE*)((const char*)(h + 1) + modalities_size(h->modalities));
+		norms = positions + (size_t)h->prototypes * h->dimension;
+		modality_norms = norms + h->prototypes;
+		classes = (const ILVQ_CLASS_REPRESENTATION*)(modality_norms + (size_t)h->prototypes * h->modalities);
+		offsets.resize(h->modalities);
+		for (int i = 0, offset = 0; i < h->modalities; offset += records[i].dimension, ++i) offsets[i] = offset;
+		return true;
+	}
+	return false;
+}
+
+/**
+ * The same distances as ILVQ::distance, on the rows of the snapshot. The prototypes are in the same
+ * order as in the model, so ties are broken the same way and the result equals ILVQ_XSZ::classify.
+ */
+ILVQ_CLASS_REPRESENTATION SharedModelReader::classify(const ILVQ_ASPECT & input) {
+	if (header == NULL || header->prototypes == 0) return -1;
+	const int dim = header->dimension;
+	if ((int)input.size() != dim) {
+		cerr << "Aspect size " << input.size() << " while prototype size " << dim << endl;
+		return -1;
+	}
+	if (header->modalities > 0) {
+		temp_x.resize(header->modalities);
+		temp_norms.resize(header->modalities);
+		for (int m = 0; m < header->modalities; ++m) {
+			temp_x[m] = &input[offsets[m]];
+			temp_norms[m] = (modalities[m].metric == DM_COSINE) ?
+					std::sqrt(dot_product(temp_x[m], temp_x[m], modalities[m].dimension)) : 0;
+		}
+		return classify(&temp_x[0], &temp_norms[0]);
+	}
+	const DistanceMetric metric = (DistanceMetric)header->metric;
+	const ILVQ_TYPE *x = &input[0];
+	const ILVQ_TYPE x_norm = (metric == DM_COSINE) ? ILVQ::norm(input) : 0;
+	ILVQ_TYPE best = numeric_limits<ILVQ_TYPE>::max();
+	int winner = 0;
+	const ILVQ_TYPE *w = positions;
+	for (int j = 0; j < header->prototypes; ++j, w += dim) {
+		ILVQ_TYPE d;
+		switch (metric) {
+		case DM_DOTPRODUCT:
+			d = dot_product(x, w, dim);
+			break;
+		case DM_COSINE: {
+			ILVQ_TYPE n = x_norm * norms[j];
+			d = (n <= ILVQ_TYPE(0)) ? ILVQ_TYPE(1) : ILVQ_TYPE(1) - dot_product(x, w, dim) / n;
+			break;
+		}
+		case DM_MANHATTAN:
+			d = manhattan(x, w, dim);
+			break;
+		default:
+			d = squared_euclidean(x, w, dim);
+		}
+		if (d < best) {
+			best = d;
+			winner = j;
+		}
+	}
+	return classes[winner];
+}
+
+/**
+ * Absent modalities are skipped, as in ILVQ_XSZ::prepareView. A model without modalities takes a
+ * view of one aspect.
+ */
+ILVQ_CLASS_REPRESENTATION SharedModelReader::classify(const ILVQ_VIEW & input) {
+	if (header == NULL || header->prototypes == 0) return -1;
+	if (header->modalities == 0) {
+		if (input.size() != 1 || input[0] == NULL) {
+			cerr << "The shared model has no modalities, a view should have one aspect" << endl;
+			return -1;
+		}
+		return classify(*input[0]);
+	}
+	if ((int)input.size() != header->modalities) {
+		cerr << "View with " << input.size() << " modalities while the model has " << header->modalities << endl;
+		return -1;
+	}
+	temp_x.resize(header->modalities);
+	temp_norms.resize(header->modalities);
+	for (int m = 0; m < header->modalities; ++m) {
+		const ILVQ_ASPECT *a = input[m];
+		if (a == NULL || a->empty()) {
+			temp_x[m] = NULL;
+			continue;
+		}
+		if ((int)a->size() != modalities[m].dimension) {
+			cerr << "Aspect size " << a->size() << " while modality " << m << " has size " << modalities[m].dimension << endl;
+			return -1;
+		}
+		temp_x[m] = &(*a)[0];
+		temp_norms[m] = (modalities[m].metric == DM_COSINE) ? ILVQ::norm(*a) : 0;
+	}
+	return classify(&temp_x[0], &temp_norms[0]);
+}
+
+/**
+ * The same sum over the modalities as ILVQ_XSZ::distance, weighted, with the metric of each.
+ */
+ILVQ_CLASS_REPRESENTATION SharedModelReader::classify(const ILVQ_TYPE * const * x, const ILVQ_TYPE *x_norms) {
+	const int dim = header->dimension, count = header->modalities;
+	ILVQ_TYPE best = numeric_limits<ILVQ_TYPE>::max();
+	int winner = 0;
+	const ILVQ_TYPE *w = positions, *w_norms = modality_norms;
+	for (int j = 0; j < header->prototypes; ++j, w += dim, w_norms += count) {
+		ILVQ_TYPE sum = 0;
+		for (int m = 0; m < count; ++m) {
+			if (x[m] == NULL) continue;
+			const ILVQ_XSZ_FILE_MODALITY & mod = modalities[m];
+			const ILVQ_TYPE *wm = w + offsets[m];
+			ILVQ_TYPE d;
+			switch (mod.metric) {
+			case DM_DOTPRODUCT:
+				d = dot_product(x[m], wm, mod.dimension);
+				break;
+			case DM_COSINE: {
+				ILVQ_TYPE n = x_norms[m] * w_norms[m];
+				d = (n <= ILVQ_TYPE(0)) ? ILVQ_TYPE(1) : ILVQ_TYPE(1) - dot_product(x[m], wm, mod.dimension) / n;
+				break;
+			}
+			case DM_MANHATTAN:
+				d = manhattan(x[m], wm, mod.dimension);
+				break;
+			default:
+				d = squared_euclidean(x[m], wm, mod.dimension);
+			}
+			sum += mod.weight * d;
+		}
+		if (sum < best) {
+			best = sum;
+			winner = j;
+		}
+	}
+	return classes[winner];
+}
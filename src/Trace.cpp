@@ -0,0 +1,145 @@
+/**
+ * @brief Compile-time log levels and binary event tracing
+ * @file Trace.cpp
+ *
+ * This file is created at Almende B.V. It is open-source software and part of the Common
+ * Hybrid Agent Platform (CHAP). A toolbox with a lot of open-source tools, ranging from
+ * thread pools and TCP/IP components to control architectures and learning algorithms.
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless,
+ * we personally strongly object against this software used by the military, in the
+ * bio-industry, for animal experimentation, or anything that violates the Universal
+ * Declaration of Human Rights.
+ *
+ * Copyright © 2012 Anne van Rossum <anne@almende.com>
+ *
+ * @author     Anne C. van Rossum
+ * @date       Apr 22, 2012
+ * @project    Replicator FP7
+ * @company    Almende B.V.
+ * @case       Machine learning (fit for Surveyeor robots)
+ */
+
+#include <ilvq/Trace.h>
+
+#include <string.h>
+#include <time.h>
+
+using namespace dobots;
+
+static const char trace_magic[8] = { 'I', 'L', 'V', 'Q', 'T', 'R', 'C', '1' };
+
+TraceRing *Trace::rings = NULL;
+
+uint32_t Trace::capacity = 1 << 16;
+
+//! The ring of the current thread, NULL until the thread records its first event
+static __thread TraceRing *thread_ring = NULL;
+
+void Trace::setCapacity(uint32_t events) {
+	uint32_t c = 1;
+	while (c < events) c <<= 1;
+	capacity = c;
+}
+
+/**
+ * Allocate a ring for the calling thread and push it on the (lock-free) list of rings. This is
+ * only done once per thread, so it is not part of the hot path.
+ */
+TraceRing *Trace::ring() {
+	if (thread_ring != NULL) return thread_ring;
+	static uint32_t thread_count = 0;
+	TraceRing *r = new TraceRing();
+	r->events = new TraceEvent[capacity];
+	r->mask = capacity - 1;
+	r->thread = __atomic_fetch_add(&thread_count, 1, __ATOMIC_RELAXED);
+	r->head = r->tail = r->dropped = 0;
+	r->next = __atomic_load_n(&rings, __ATOMIC_RELAXED);
+	while (!__atomic_compare_exchange_n(&rings, &r->next, r, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+	thread_ring = r;
+	return r;
+}
+
+/**
+ * Write one event. Only the owning thread writes "head", so a plain store with release semantics
+ * is enough to publish the event to the consumer.
+ */
+void Trace::record(uint16_t type, int32_t id1, int32_t id2, int32_t class_id, float d1, float d2) {
+	TraceRing *r = ring();
+	uint64_t head = r->head;
+	if (head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) > r->mask) {
+		__atomic_store_n(&r->dropped, r->dropped + 1, __ATOMIC_RELAXED);
+		return;
+	}
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	TraceEvent &e = r->events[head & r->mask];
+	e.timestamp = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+	e.type = type;
+	e.thread = r->thread;
+	e.id1 = id1;
+	e.id2 = id2;
+	e.class_id = class_id;
+	e.d1 = d1;
+	e.d2 = d2;
+	__atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Drain all rings into a binary file. The header is written if the file is still empty, so this
+ * function can be called periodically on the same file. Events are not sorted over threads, the
+ * decoder (or your own script) can sort on timestamp.
+ */
+uint64_t Trace::dump(FILE *file) {
+	if (ftell(file) == 0) {
+		TraceFileHeader header;
+		memcpy(header.magic, trace_magic, sizeof(trace_magic));
+		header.version = 1;
+		header.event_size = sizeof(TraceEvent);
+		fwrite(&header, sizeof(header), 1, file);
+	}
+	uint64_t written = 0;
+	for (TraceRing *r = __atomic_load_n(&rings, __ATOMIC_ACQUIRE); r != NULL; r = r->next) {
+		uint64_t tail = r->tail;
+		uint64_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+		while (tail != head) {
+			// write the contiguous part up to the end of the ring in one go
+			uint64_t first = tail & r->mask;
+			uint64_t n = head - tail;
+			if (first + n > (uint64_t)r->mask + 1) n = r->mask + 1 - first;
+			fwrite(&r->events[first], sizeof(TraceEvent), n, file);
+			tail += n;
+			written += n;
+		}
+		__atomic_store_n(&r->tail, tail, __ATOMIC_RELEASE);
+	}
+	fflush(file);
+	return written;
+}
+
+uint64_t Trace::dropped() {
+	uint64_t sum = 0;
+	for (TraceRing *r = __atomic_load_n(&rings, __ATOMIC_ACQUIRE); r != NULL; r = r->next) {
+		sum += __atomic_load_n(&r->dropped, __ATOMIC_RELAXED);
+	}
+	return sum;
+}
+
+const char *Trace::name(uint16_t type) {
+	switch (type) {
+	case TE_WINNERS: return "winners";
+	case TE_CLASSIFY: return "classify";
+	case TE_CREATE: return "create";
+	case TE_DELETE: return "delete";
+	case TE_EVICT: return "evict";
+	default: return "unknown";
+	}
+}
+
+bool Trace::readHeader(FILE *file) {
+	TraceFileHeader header;
+	if (fread(&header, sizeof(header), 1, file) != 1) return false;
+	if (memcmp(header.magic, trace_magic, sizeof(trace_magic))) return false;
+	return (header.event_size == sizeof(TraceEvent));
+}
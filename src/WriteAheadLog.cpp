@@ -0,0 +1,479 @@
+/**
+ * @brief Write-ahead log of training operations, for recovery after a crash
+ * @file WriteAheadLog.cpp
+ *
+ * This file is created at Almende B.V. It is open-source software and part of the Common
+ * Hybrid Agent Platform (CHAP). A toolbox with a lot of open-source tools, ranging from
+ * thread pools and TCP/IP components to control architectures and learning algorithms.
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless,
+ * we personally strongly object against this software used by the military, in the
+ * bio-industry, for animal experimentation, or anything that violates the Universal
+ * Declaration of Human Rights.
+ *
+ * Copyright © 2012 Anne van Rossum <anne@almende.com>
+ *
+ * @author     Anne C. van Rossum
+ * @date       Apr 22, 2012
+ * @project    Replicator FP7
+ * @company    Almende B.V.
+ * @case       Machine learning (fit for Surveyeor robots)
+ */
+
+
+#include <ilvq/WriteAheadLog.h>
+
+#include <algorithm>
+#include <iostream>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+using namespace dobots;
+using namespace std;
+
+//! Largest dimension that is accepted while replaying, anything larger is taken as a torn record
+#define WAL_MAX_DIMENSION (1 << 24)
+
+static int64_t now_us() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int64_t now_ms() {
+	return now_us() / 1000;
+}
+
+//! Standard crc32 (as in zlib), continued from crc
+static uint32_t crc32(uint32_t crc, const void *data, size_t n) {
+	static uint32_t table[256];
+	static bool initialized = false;
+	if (!initialized) {
+		for (uint32_t i = 0; i < 256; ++i) {
+			uint32_t c = i;
+			for (int k = 0; k < 8; ++k) c = (c & 1) ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+			table[i] = c;
+		}
+		initialized = true;
+	}
+	const unsigned char *p = (const unsigned char*)data;
+	crc = ~crc;
+	while (n--) crc = table[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+	return ~crc;
+}
+
+static uint32_t checksum(const WalRecord & r, const ILVQ_TYPE *values) {
+	uint32_t crc = crc32(0, &r.dimension, sizeof(r.dimension));
+	crc = crc32(crc, &r.class_id, sizeof(r.class_id));
+	return crc32(crc, values, r.dimension * sizeof(ILVQ_TYPE));
+}
+
+//! Sync the directory of the file, so a rename in it is durable
+static bool sync_dir(const std::string & file) {
+	std::string::size_type slash = file.rfind('/');
+	std::string dir = (slash == std::string::npos) ? "." : (slash == 0) ? "/" : file.substr(0, slash);
+	int fd = open(dir.c_str(), O_RDONLY);
+	if (fd < 0) return false;
+	bool ok = (fsync(fd) == 0);
+	close(fd);
+	return ok;
+}
+
+//! Write function of the stream of a background snapshot, counts the bytes that are written
+static ssize_t progress_write(void *cookie, const char *buf, size_t n) {
+	std::pair<int,WalProgress*> *c = (std::pair<int,WalProgress*>*)cookie;
+	size_t left = n;
+	while (left > 0) {
+		ssize_t w = ::write(c->first, buf, left);
+		if (w < 0 && errno == EINTR) continue;
+		if (w < 0) return -1;
+		buf += w;
+		left -= w;
+		__atomic_add_fetch(&c->second->written, w, __ATOMIC_RELAXED);
+	}
+	return n;
+}
+
+WriteAheadLog::WriteAheadLog(ILVQ_XSZ & model, const std::string & path, const WalConfig & config): model(model),
+		path(path),
+		config(config),
+		fd(-1),
+		epoch(0),
+		records(0),
+		replayed(0),
+		buffered(0),
+		unsynced(0),
+		last_sync(0),
+		dir_unsynced(false),
+		failed(false),
+		compact_after(0),
+		child(-1),
+		state(WS_NONE),
+		progress(NULL),
+		stall(0) {
+	assert (config.group > 0 && config.sync_every >= 0 && config.sync_ms >= 0 && config.compact_every >= 0);
+	void *m = mmap(NULL, sizeof(WalProgress), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (m != MAP_FAILED) {
+		progress = (WalProgress*)m;
+		progress->written = progress->total = 0;
+	}
+}
+
+WriteAheadLog::~WriteAheadLog() {
+	if (child > 0) {
+		int status;
+		pid_t r;
+		while ((r = waitpid(child, &status, 0)) < 0 && errno == EINTR);
+		child = -1;
+		if (r > 0 && WIFEXITED(status) && WEXITSTATUS(status) == 0) unlink((path + ".log.old").c_str());
+	}
+	if (progress != NULL) munmap(progress, sizeof(WalProgress));
+	if (fd < 0) return;
+	sync();
+	close(fd);
+}
+
+bool WriteAheadLog::readHeader(const std::string & file, const char *magic, WalHeader & h) {
+	FILE *f = fopen(file.c_str(), "rb");
+	if (f == NULL) return false;
+	bool ok = fread(&h, sizeof(h), 1, f) == 1 && !memcmp(h.magic, magic, 8);
+	fclose(f);
+	return ok;
+}
+
+/**
+ * The snapshot determines the epoch. The log of the same epoch holds the records after it. A log
+ * of an older epoch is left over from a compaction that did not finish, its records are already in
+ * the snapshot. A log of a newer epoch means that its snapshot is lost, which is an error.
+ *
+ * If a background compaction did not finish, there is an old log of the epoch of the snapshot,
+ * and a log of the next epoch with the records after the fork. Both are replayed, and the
+ * compaction is done again, now in the foreground.
+ */
+bool WriteAheadLog::recover() {
+	assert (fd < 0 && child < 0);
+	WalHeader h;
+	epoch = 0;
+	const std::string snapshot = path + ".snapshot", log = path + ".log", old = log + ".old";
+	FILE *f = fopen(snapshot.c_str(), "rb");
+	if (f != NULL) {
+		bool ok = fread(&h, sizeof(h), 1, f) == 1 && !memcmp(h.magic, "ILVQSNP1", 8) && model.load(f);
+		fclose(f);
+		if (!ok) {
+			cerr << "Can not load snapshot " << snapshot << endl;
+			return false;
+		}
+		epoch = h.epoch;
+	}
+
+	replayed = records = 0;
+	bool unfinished = readHeader(old, "ILVQWAL1", h) && h.epoch == epoch;
+	if (unfinished && !replay(old)) return false;
+	if (!readHeader(log, "ILVQWAL1", h) || h.epoch < epoch) {
+		// no log, or one that is already in the snapshot
+		if (unfinished) return compact();
+		unlink(old.c_str());
+		return createLog();
+	}
+	if (h.epoch > epoch + (unfinished ? 1 : 0)) {
+		cerr << "Log " << log << " is newer than the snapshot" << endl;
+		return false;
+	}
+	if (!replay(log)) return false;
+	if (unfinished) return compact();
+	unlink(old.c_str());
+	records = replayed;
+	fd = open(log.c_str(), O_WRONLY | O_APPEND);
+	last_sync = now_ms();
+	return fd >= 0;
+}
+
+bool WriteAheadLog::replay(const std::string & log) {
+	FILE *f = fopen(log.c_str(), "rb");
+	if (f == NULL) return false;
+	// replay directly on the model, with large reads
+	std::vector<char> io(1 << 20);
+	setvbuf(f, &io[0], _IOFBF, io.size());
+	long good = sizeof(WalHeader);
+	fseek(f, good, SEEK_SET);
+	WalRecord r;
+	ILVQ_ASPECT input;
+	while (fread(&r, sizeof(r), 1, f) == 1) {
+		if (r.dimension == 0 || r.dimension > WAL_MAX_DIMENSION ||
+				(model.getDimension() && (int)r.dimension != model.getDimension())) break;
+		input.resize(r.dimension);
+		if (fread(&input[0], sizeof(ILVQ_TYPE), r.dimension, f) != r.dimension) break;
+		if (checksum(r, &input[0]) != r.checksum) break;
+		ILVQ_CLASS_REPRESENTATION class_rep = r.class_id;
+		model.add(input, class_rep);
+		good += sizeof(r) + r.dimension * sizeof(ILVQ_TYPE);
+		replayed++;
+	}
+	fclose(f);
+	// cut off a torn record, so new records are appended after the last good one
+	struct stat st;
+	if (stat(log.c_str(), &st) == 0 && st.st_size > good) {
+		cerr << "Cut off " << (st.st_size - good) << " bytes of a torn record from " << log << endl;
+		if (truncate(log.c_str(), good) < 0) return false;
+	}
+	return true;
+}
+
+bool WriteAheadLog::createLog() {
+	const std::string log = path + ".log", tmp = log + ".tmp";
+	if (fd >= 0) close(fd);
+	fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		cerr << "Can not create log " << tmp << ": " << strerror(errno) << endl;
+		return false;
+	}
+	WalHeader h;
+	memcpy(h.magic, "ILVQWAL1", 8);
+	h.epoch = epoch;
+	if (::write(fd, &h, sizeof(h)) != (ssize_t)sizeof(h) || fsync(fd) < 0 || rename(tmp.c_str(), log.c_str()) < 0 ||
+			!sync_dir(log)) {
+		cerr << "Can not create log " << log << ": " << strerror(errno) << endl;
+		close(fd);
+		fd = -1;
+		return false;
+	}
+	// the file descriptor was opened without O_APPEND, but it is at the end of the file
+	records = 0;
+	buffer.clear();
+	buffered = unsynced = 0;
+	last_sync = now_ms();
+	return true;
+}
+
+/**
+ * The record is taken out of the buffer again if it can not be written or synced, so it is neither
+ * in the log nor in the model. Records of earlier calls in the same group stay in the buffer, they
+ * are in the model already and are written with the next group. A failed sync leaves the log in an
+ * unknown state, so from then on nothing is added. A failed compaction is tried again only after
+ * another compact_every records.
+ */
+bool WriteAheadLog::add(ILVQ_ASPECT & input, ILVQ_CLASS_REPRESENTATION & class_rep) {
+	if (fd < 0 || failed) return false;
+	const size_t start = buffer.size();
+	WalRecord r;
+	r.dimension = input.size();
+	r.class_id = class_rep;
+	r.checksum = checksum(r, &input[0]);
+	buffer.insert(buffer.end(), (const char*)&r, (const char*)(&r + 1));
+	buffer.insert(buffer.end(), (const char*)&input[0], (const char*)(&input[0] + input.size()));
+	buffered++;
+	if (buffered >= config.group) {
+		if (!write()) {
+			buffer.resize(start);
+			buffered--;
+			return false;
+		}
+		if (child > 0) pollSnapshot();
+	}
+	if ((config.sync_every && unsynced >= config.sync_every) ||
+			(config.sync_ms && now_ms() - last_sync >= config.sync_ms)) {
+		if (!write()) {
+			buffer.resize(start);
+			buffered--;
+			return false;
+		}
+		if (!sync()) {
+			cerr << "Can not sync log, stop logging" << endl;
+			failed = true;
+			return false;
+		}
+	}
+	records++;
+
+	model.add(input, class_rep);
+
+	if (config.compact_every && records >= std::max((long)config.compact_every, compact_after)) {
+		bool ok;
+		if (config.background) {
+			ok = (child > 0) || compactBackground();
+		} else {
+			ok = compact();
+		}
+		compact_after = ok ? 0 : records + config.compact_every;
+		if (!ok) cerr << "Compaction failed, try again after " << config.compact_every << " records" << endl;
+	}
+	return true;
+}
+
+/**
+ * A failed write is cut off from the log again, so a retry does not leave a torn record in the
+ * middle of the log.
+ */
+bool WriteAheadLog::write() {
+	if (buffer.empty()) return true;
+	off_t end = lseek(fd, 0, SEEK_END);
+	const char *p = &buffer[0];
+	size_t n = buffer.size();
+	while (n > 0) {
+		ssize_t w = ::write(fd, p, n);
+		if (w < 0 && errno == EINTR) continue;
+		if (w < 0) {
+			int error = errno;
+			if (end >= 0 && p != &buffer[0] && ftruncate(fd, end) == 0) lseek(fd, end, SEEK_SET);
+			cerr << "Can not write log: " << strerror(error) << endl;
+			return false;
+		}
+		p += w;
+		n -= w;
+	}
+	unsynced += buffered;
+	buffered = 0;
+	buffer.clear();
+	return true;
+}
+
+bool WriteAheadLog::sync() {
+	if (!write()) return false;
+	last_sync = now_ms();
+	if (dir_unsynced) {
+		if (fsync(fd) < 0 || !sync_dir(path + ".log")) return false;
+		dir_unsynced = false;
+		unsynced = 0;
+	}
+	if (!unsynced) return true;
+	unsynced = 0;
+	return fdatasync(fd) == 0;
+}
+
+/**
+ * The snapshot is written to a temporary file and renamed when it is complete and durable. If a
+ * stream is given (background mode) it writes to the temporary file already, which is open as f_fd.
+ */
+bool WriteAheadLog::writeSnapshot(uint64_t epoch, FILE *f, int f_fd) {
+	const std::string snapshot = path + ".snapshot", tmp = snapshot + ".tmp";
+	if (f == NULL) {
+		f = fopen(tmp.c_str(), "wb");
+		f_fd = (f == NULL) ? -1 : fileno(f);
+	}
+	if (f == NULL) {
+		cerr << "Can not create snapshot " << tmp << ": " << strerror(errno) << endl;
+		return false;
+	}
+	WalHeader h;
+	memcpy(h.magic, "ILVQSNP1", 8);
+	h.epoch = epoch;
+	bool ok = fwrite(&h, sizeof(h), 1, f) == 1 && model.save(f) && fsync(f_fd) == 0;
+	ok = (fclose(f) == 0) && ok;
+	if (!ok || rename(tmp.c_str(), snapshot.c_str()) < 0 || !sync_dir(snapshot)) {
+		cerr << "Can not write snapshot " << snapshot << endl;
+		unlink(tmp.c_str());
+		return false;
+	}
+	return true;
+}
+
+/**
+ * The snapshot of the new epoch is made durable first, then the log of the new epoch replaces the
+ * old one. The records that were collected but not written yet are in the snapshot, so they are
+ * dropped.
+ */
+bool WriteAheadLog::compact() {
+	pollSnapshot();
+	if (child > 0) return false;
+	if (!writeSnapshot(epoch + 1)) return false;
+	epoch++;
+	state = WS_NONE;
+	if (!createLog()) return false;
+	unlink((path + ".log.old").c_str());
+	return true;
+}
+
+/**
+ * Only what can not wait is done before the fork: the collected records are written to the old
+ * log, and the old log is renamed and replaced by a new one, without syncing. The child syncs the
+ * old log and the directory before it writes the snapshot. The records in the new log are synced
+ * as usual, the first sync includes the directory. The parent does not wait for the child, it
+ * looks at it with pollSnapshot().
+ */
+bool WriteAheadLog::compactBackground() {
+	if (pollSnapshot() == WS_FAILED) return compact();
+	if (child > 0 || progress == NULL) return false;
+	int64_t t0 = now_us();
+	const std::string log = path + ".log", old = log + ".old", tmp = path + ".snapshot.tmp";
+	FILE *f = fopen(tmp.c_str(), "wb");
+	if (f == NULL || !write() || rename(log.c_str(), old.c_str()) < 0) {
+		cerr << "Can not start background snapshot: " << strerror(errno) << endl;
+		if (f != NULL) fclose(f);
+		return false;
+	}
+	int old_fd = fd;
+	fd = open(log.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	WalHeader h;
+	memcpy(h.magic, "ILVQWAL1", 8);
+	h.epoch = epoch + 1;
+	if (fd < 0 || ::write(fd, &h, sizeof(h)) != (ssize_t)sizeof(h)) {
+		// go on with the old log
+		cerr << "Can not create log " << log << ": " << strerror(errno) << endl;
+		if (fd >= 0) close(fd);
+		fd = old_fd;
+		rename(old.c_str(), log.c_str());
+		fclose(f);
+		unlink(tmp.c_str());
+		return false;
+	}
+	epoch++;
+	records = 0;
+	unsynced = 0;
+	dir_unsynced = true;
+	progress->written = 0;
+	progress->total = sizeof(WalHeader) + model.getSaveSize();
+	pid_t pid = fork();
+	if (pid == 0) {
+		// child: the old log and the renames have to be durable before the snapshot replaces them
+		bool ok = fdatasync(old_fd) == 0 && sync_dir(log);
+		std::pair<int,WalProgress*> cookie(fileno(f), progress);
+		cookie_io_functions_t io = { NULL, progress_write, NULL, NULL };
+		FILE *out = fopencookie(&cookie, "w", io);
+		ok = ok && out != NULL && writeSnapshot(epoch, out, fileno(f));
+		_exit(ok ? EXIT_SUCCESS : EXIT_FAILURE);
+	}
+	close(old_fd);
+	fclose(f);
+	if (pid < 0) {
+		// the old log stays, recover() replays both, the next compaction is done in the foreground
+		cerr << "Can not fork: " << strerror(errno) << endl;
+		unlink(tmp.c_str());
+		state = WS_FAILED;
+		return false;
+	}
+	child = pid;
+	state = WS_RUNNING;
+	stall = now_us() - t0;
+	return true;
+}
+
+WalSnapshotState WriteAheadLog::pollSnapshot() {
+	if (child < 0) return state;
+	int status;
+	pid_t r = waitpid(child, &status, WNOHANG);
+	if (r == 0 || (r < 0 && errno == EINTR)) return state;
+	child = -1;
+	if (r > 0 && WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS) {
+		unlink((path + ".log.old").c_str());
+		state = WS_DONE;
+	} else {
+		cerr << "Background snapshot failed" << endl;
+		state = WS_FAILED;
+	}
+	return state;
+}
+
+float WriteAheadLog::getSnapshotProgress() {
+	if (progress == NULL || !progress->total) return 0;
+	if (child < 0) return (state == WS_DONE) ? 1 : 0;
+	return std::min(1.0f, __atomic_load_n(&progress->written, __ATOMIC_RELAXED) / (float)progress->total);
+}
@@ -18,3 +18,9 @@ COMPILER_PREFIX=
 # as space-separated values in  ADDITIONAL_INCLUDE_PATHS and the library itself in ADDITIONAL_LIBRARY_PATHS
 ADDITIONAL_INCLUDE_PATHS=
 ADDITIONAL_LIBRARY_PATHS=
+
+# Record binary trace events (winners, creation/deletion of prototypes) into per-thread ring buffers
+TRACE=false
+
+# Compile-time log level, e.g. LOG_DEBUG, leave empty for the default (LOG_ERR)
+LOG_LEVEL=